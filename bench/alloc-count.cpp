@@ -0,0 +1,181 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <cerrno>
+
+#include <glib.h>
+
+#include "alloc-count.h"
+
+extern "C" {
+
+void* __libc_malloc(size_t t_size);
+void* __libc_calloc(size_t t_count, size_t t_size);
+void* __libc_realloc(void* t_ptr, size_t t_size);
+void* __libc_memalign(size_t t_alignment, size_t t_size);
+void __libc_free(void* t_ptr);
+
+}
+
+/* Pointer sized, so they can be updated with g_atomic_pointer_add from any thread */
+static gssize allocations = 0;
+static gssize frees = 0;
+static gssize live_bytes = 0;
+
+static inline void counted(void* t_ptr)
+{
+    if (t_ptr != nullptr)
+    {
+        g_atomic_pointer_add(&allocations, 1);
+        g_atomic_pointer_add(&live_bytes, (gssize) malloc_usable_size(t_ptr));
+    }
+}
+
+static inline void uncounted(void* t_ptr)
+{
+    if (t_ptr != nullptr)
+    {
+        g_atomic_pointer_add(&frees, 1);
+        g_atomic_pointer_add(&live_bytes, -(gssize) malloc_usable_size(t_ptr));
+    }
+}
+
+extern "C" {
+
+void* malloc(size_t t_size)
+{
+    void* ptr = __libc_malloc(t_size);
+    counted(ptr);
+
+    return ptr;
+}
+
+void* calloc(size_t t_count, size_t t_size)
+{
+    void* ptr = __libc_calloc(t_count, t_size);
+    counted(ptr);
+
+    return ptr;
+}
+
+void* realloc(void* t_ptr, size_t t_size)
+{
+    gssize old_size = t_ptr != nullptr ? (gssize) malloc_usable_size(t_ptr) : 0;
+    void* ptr = __libc_realloc(t_ptr, t_size);
+
+    // A failed realloc leaves the old block alone, a zero sized one frees it
+    if (ptr == nullptr && t_size != 0)
+    {
+        return nullptr;
+    }
+
+    g_atomic_pointer_add(&live_bytes, (ptr != nullptr ? (gssize) malloc_usable_size(ptr) : 0) - old_size);
+
+    if (t_ptr == nullptr)
+    {
+        g_atomic_pointer_add(&allocations, 1);
+    }
+    else if (ptr == nullptr)
+    {
+        g_atomic_pointer_add(&frees, 1);
+    }
+
+    return ptr;
+}
+
+void* memalign(size_t t_alignment, size_t t_size)
+{
+    void* ptr = __libc_memalign(t_alignment, t_size);
+    counted(ptr);
+
+    return ptr;
+}
+
+void* aligned_alloc(size_t t_alignment, size_t t_size)
+{
+    return memalign(t_alignment, t_size);
+}
+
+int posix_memalign(void** t_ptr, size_t t_alignment, size_t t_size)
+{
+    void* ptr = memalign(t_alignment, t_size);
+
+    if (ptr == nullptr)
+    {
+        return ENOMEM;
+    }
+
+    *t_ptr = ptr;
+
+    return 0;
+}
+
+void free(void* t_ptr)
+{
+    uncounted(t_ptr);
+    __libc_free(t_ptr);
+}
+
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void alloc_count_get(AllocCounts* t_counts)
+{
+    t_counts->allocations = (gint64) g_atomic_pointer_get(&allocations);
+    t_counts->frees = (gint64) g_atomic_pointer_get(&frees);
+    t_counts->live_bytes = (gint64) g_atomic_pointer_get(&live_bytes);
+}
+
+/* Resident set size in bytes, from /proc */
+gint64 alloc_count_rss()
+{
+    FILE* statm = fopen("/proc/self/statm", "r");
+    long size = 0, resident = 0;
+
+    if (statm == nullptr)
+    {
+        return 0;
+    }
+
+    if (fscanf(statm, "%ld %ld", &size, &resident) != 2)
+    {
+        resident = 0;
+    }
+
+    fclose(statm);
+
+    return (gint64) resident * sysconf(_SC_PAGESIZE);
+}
+
+/* The highest resident set size so far, in bytes */
+gint64 alloc_count_peak_rss()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (gint64) usage.ru_maxrss * 1024;
+}
@@ -0,0 +1,47 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Counts every heap allocation in the process, glib's and the extension's
+ * included, by wrapping malloc and friends. Linking alloc-count.o into a
+ * bench is all it takes, this relies on glibc.
+ */
+struct AllocCounts
+{
+    gint64  allocations;
+    gint64  frees;
+    gint64  live_bytes;
+};
+
+void alloc_count_get(AllocCounts* t_counts);
+
+gint64 alloc_count_rss();
+gint64 alloc_count_peak_rss();
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <glib.h>
+
+#include "bench-util.h"
+
+/*
+ * Returns:
+ * A unix socket listening on t_path, -1 if that failed.
+ */
+int bench_listen_unix(const gchar* t_path)
+{
+    struct sockaddr_un addr;
+    int sock = socket(PF_UNIX, SOCK_STREAM, 0);
+
+    if (sock < 0)
+    {
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    g_strlcpy(addr.sun_path, t_path, sizeof(addr.sun_path));
+
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 4) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/*
+ * Returns:
+ * false if the other side went away before everything was written.
+ */
+gboolean bench_write_all(int t_sock, const gchar* t_data, gsize t_length)
+{
+    while (t_length > 0)
+    {
+        ssize_t written = send(t_sock, t_data, t_length, MSG_NOSIGNAL);
+
+        if (written <= 0)
+        {
+            return false;
+        }
+
+        t_data += written;
+        t_length -= written;
+    }
+
+    return true;
+}
+
+/*
+ * Finds the end of the first message in t_pending, which is the first
+ * line that says "done".
+ *
+ * Returns:
+ * The length of that message including the "done" line, 0 if it isn't
+ * complete yet.
+ */
+gsize bench_message_length(GString* t_pending)
+{
+    gsize line = 0;
+
+    while (line < t_pending->len)
+    {
+        const gchar* newline = (const gchar *) memchr(t_pending->str + line, '\n', t_pending->len - line);
+
+        if (newline == nullptr)
+        {
+            return 0;
+        }
+
+        gsize next = newline - t_pending->str + 1;
+
+        if (next - line == 5 && strncmp(t_pending->str + line, "done", 4) == 0)
+        {
+            return next;
+        }
+
+        line = next;
+    }
+
+    return 0;
+}
+
+void bench_sleep_until(gint64 t_time)
+{
+    gint64 wait = t_time - g_get_monotonic_time();
+
+    if (wait > 0)
+    {
+        g_usleep(wait);
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* What the benches that stand in for dropbox need to talk to the client */
+int bench_listen_unix(const gchar* t_path);
+gboolean bench_write_all(int t_sock, const gchar* t_data, gsize t_length);
+gsize bench_message_length(GString* t_pending);
+
+void bench_sleep_until(gint64 t_time);
+
+G_END_DECLS
+
+#endif
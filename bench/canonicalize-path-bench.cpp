@@ -0,0 +1,147 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <limits.h>
+#include <cstring>
+
+#include <glib.h>
+
+#include "dropbox-path-util.h"
+
+static const int ITERATIONS = 1000000;
+
+static const gchar* inputs[] = {
+    "/home/user/Dropbox",
+    "/home/user/Dropbox/Photos/2018/Holiday/IMG_0001.jpg",
+    "/home/user/Dropbox/.dropbox.cache/old_files/a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p/notes.txt",
+    "/home/user/Dropbox/Documents/Résumé (final) - copy.odt",
+    "/home/user/Dropbox/./Photos//2018/../2017/IMG_0001.jpg",
+    "/home/user/Dropbox/Projects/dna/src/../bench/",
+    nullptr
+};
+
+/* The implementation this module replaced, kept to compare against */
+static gchar* legacy_canonicalize_path(gchar* t_path)
+{
+    int i, j = 0;
+    gchar* toret = nullptr;
+    gchar** cpy;
+    gchar** elts;
+
+    g_assert(t_path != nullptr);
+    g_assert(t_path[0] == '/');
+
+    elts = g_strsplit(t_path, "/", 0);
+    cpy = g_new(gchar *, g_strv_length(elts) + 1);
+    cpy[j++] = (gchar *) "/";
+
+    for (i = 0; elts[i] != nullptr; i++)
+    {
+        if (strcmp(elts[i], "..") == 0)
+        {
+            if (j > 0)
+            {
+                j--;
+            }
+            else
+            {
+                toret = nullptr;
+                goto exit;
+            }
+        }
+        else if (strcmp(elts[i], ".") != 0 && elts[i][0] != '\0')
+        {
+            cpy[j++] = elts[i];
+        }
+    }
+
+    cpy[j] = nullptr;
+    toret = g_build_filenamev(cpy);
+
+    exit:
+        g_free(cpy);
+        g_strfreev(elts);
+
+    return toret;
+}
+
+static gdouble bench_legacy(const gchar* t_input)
+{
+    gchar* input = g_strdup(t_input);
+    gint64 start = g_get_monotonic_time();
+
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        g_free(legacy_canonicalize_path(input));
+    }
+
+    gint64 elapsed = g_get_monotonic_time() - start;
+    g_free(input);
+
+    return elapsed * 1000.0 / ITERATIONS;
+}
+
+static gdouble bench_current(const gchar* t_input)
+{
+    gchar buffer[PATH_MAX];
+    volatile gsize sink = 0;
+    gint64 start = g_get_monotonic_time();
+
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        const gchar* result = dropbox_path_util_canonicalize(t_input, buffer, sizeof(buffer));
+        sink = sink + (result != nullptr ? result[0] : 0);
+    }
+
+    return (g_get_monotonic_time() - start) * 1000.0 / ITERATIONS;
+}
+
+int main(int argc, char** argv)
+{
+    gboolean failed = false;
+
+    g_print("%-10s %10s %10s %8s  %s\n", "case", "legacy ns", "new ns", "speedup", "path");
+
+    for (int i = 0; inputs[i] != nullptr; i++)
+    {
+        gchar buffer[PATH_MAX];
+        gchar* input = g_strdup(inputs[i]);
+        gchar* expected = legacy_canonicalize_path(input);
+        const gchar* actual = dropbox_path_util_canonicalize(inputs[i], buffer, sizeof(buffer));
+
+        if (g_strcmp0(expected, actual) != 0)
+        {
+            g_printerr("mismatch for %s: legacy %s, new %s\n", inputs[i], expected, actual);
+            failed = true;
+        }
+
+        gdouble legacy = bench_legacy(inputs[i]);
+        gdouble current = bench_current(inputs[i]);
+
+        g_print("%-10s %10.1f %10.1f %7.1fx  %s\n",
+            dropbox_path_util_is_canonical(inputs[i], strlen(inputs[i])) ? "canonical" : "simplify",
+            legacy, current, legacy / current, inputs[i]);
+
+        g_free(expected);
+        g_free(input);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <glib.h>
+
+#include "dropbox-command-queue.h"
+
+/* Nautilus asks about a directory's worth of files at a time, while other threads keep pushing */
+static const int REQUESTS = 200000;
+static const int BURST = 2000;
+static const int BACKGROUND_THREADS[] = { 0, 1, 3, -1 };
+
+/* Roughly what the command thread spends on a request, minus the socket */
+static const int CONSUMER_SPIN = 200;
+
+struct BenchQueue
+{
+    const gchar*    name;
+    gpointer        (*create)();
+    void            (*push)(gpointer, gpointer);
+    gpointer        (*timeout_pop)(gpointer, guint64);
+    void            (*destroy)(gpointer);
+};
+
+static gpointer async_queue_create()
+{
+    return g_async_queue_new();
+}
+
+static void async_queue_push(gpointer t_queue, gpointer t_item)
+{
+    g_async_queue_push((GAsyncQueue *) t_queue, t_item);
+}
+
+static gpointer async_queue_timeout_pop(gpointer t_queue, guint64 t_timeout)
+{
+    return g_async_queue_timeout_pop((GAsyncQueue *) t_queue, t_timeout);
+}
+
+static void async_queue_destroy(gpointer t_queue)
+{
+    g_async_queue_unref((GAsyncQueue *) t_queue);
+}
+
+static gpointer ring_create()
+{
+    DropboxCommandQueue* queue = new DropboxCommandQueue;
+    dropbox_command_queue_init(queue, 4096);
+
+    return queue;
+}
+
+static void ring_push(gpointer t_queue, gpointer t_item)
+{
+    dropbox_command_queue_push((DropboxCommandQueue *) t_queue, t_item);
+}
+
+static gpointer ring_timeout_pop(gpointer t_queue, guint64 t_timeout)
+{
+    return dropbox_command_queue_timeout_pop((DropboxCommandQueue *) t_queue, t_timeout);
+}
+
+static void ring_destroy(gpointer t_queue)
+{
+    dropbox_command_queue_clear((DropboxCommandQueue *) t_queue);
+    delete (DropboxCommandQueue *) t_queue;
+}
+
+static const BenchQueue queues[] = {
+    { "GAsyncQueue", async_queue_create, async_queue_push, async_queue_timeout_pop, async_queue_destroy },
+    { "ring", ring_create, ring_push, ring_timeout_pop, ring_destroy },
+};
+
+struct BenchRun
+{
+    const BenchQueue*   queue;
+    gpointer            q;
+    gint                remaining;
+    gint                main_taken;
+    gint64              checksum;
+};
+
+/* Items are never NULL, the main thread pushes its index plus one and the others the negation of that */
+static gpointer consumer_thread(BenchRun* t_run)
+{
+    volatile int sink = 0;
+
+    while (g_atomic_int_get(&(t_run->remaining)) > 0)
+    {
+        gpointer item = t_run->queue->timeout_pop(t_run->q, G_USEC_PER_SEC / 10);
+
+        if (item == nullptr)
+        {
+            continue;
+        }
+
+        t_run->checksum += GPOINTER_TO_INT(item);
+        g_atomic_int_add(&(t_run->remaining), -1);
+
+        if (GPOINTER_TO_INT(item) > 0)
+        {
+            g_atomic_int_add(&(t_run->main_taken), 1);
+        }
+
+        for (int i = 0; i < CONSUMER_SPIN; i++)
+        {
+            sink = sink + i;
+        }
+    }
+
+    return nullptr;
+}
+
+static gpointer background_thread(BenchRun* t_run)
+{
+    for (int i = 0; i < REQUESTS; i++)
+    {
+        t_run->queue->push(t_run->q, GINT_TO_POINTER(-(i + 1)));
+    }
+
+    return nullptr;
+}
+
+static gint64 percentile(std::vector<gint64>& t_samples, gdouble t_p)
+{
+    return t_samples[(gsize) (t_p * (t_samples.size() - 1))];
+}
+
+/* Returns false if the consumer didn't see exactly the items that were pushed */
+static gboolean bench(const BenchQueue* t_queue, int t_background)
+{
+    BenchRun run;
+    std::vector<GThread*> threads;
+    std::vector<gint64> samples(REQUESTS);
+
+    run.queue = t_queue;
+    run.q = t_queue->create();
+    run.remaining = REQUESTS * (t_background + 1);
+    run.main_taken = 0;
+    run.checksum = 0;
+
+    GThread* consumer = g_thread_new("consumer", (GThreadFunc) consumer_thread, &run);
+
+    for (int i = 0; i < t_background; i++)
+    {
+        threads.push_back(g_thread_new("background", (GThreadFunc) background_thread, &run));
+    }
+
+    // This thread plays the main loop, queueing a request for every file it is shown
+    for (int i = 0; i < REQUESTS; i++)
+    {
+        // A single push is well below the resolution of g_get_monotonic_time
+        auto before = std::chrono::steady_clock::now();
+        t_queue->push(run.q, GINT_TO_POINTER(i + 1));
+        samples[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - before).count();
+
+        // Then it draws the directory while the replies come in
+        if ((i + 1) % BURST == 0)
+        {
+            while (g_atomic_int_get(&(run.main_taken)) <= i)
+            {
+                g_usleep(100);
+            }
+        }
+    }
+
+    gint64 total = 0;
+
+    for (gint64 sample : samples)
+    {
+        total += sample;
+    }
+
+    for (GThread* thread : threads)
+    {
+        g_thread_join(thread);
+    }
+
+    g_thread_join(consumer);
+    t_queue->destroy(run.q);
+
+    std::sort(samples.begin(), samples.end());
+
+    g_print("%-12s %10d %10.1f %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT "\n",
+        t_queue->name, t_background, (gdouble) total / REQUESTS,
+        percentile(samples, 0.5), percentile(samples, 0.99), samples.back());
+
+    gint64 expected = (gint64) REQUESTS * (REQUESTS + 1) / 2 * (1 - t_background);
+
+    if (run.checksum != expected)
+    {
+        g_printerr("%s lost or duplicated requests\n", t_queue->name);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    gboolean failed = false;
+
+    g_print("%-12s %10s %10s %8s %8s %8s\n", "queue", "background", "mean ns", "p50 ns", "p99 ns", "max ns");
+
+    for (int i = 0; BACKGROUND_THREADS[i] >= 0; i++)
+    {
+        for (const BenchQueue& queue : queues)
+        {
+            failed |= !bench(&queue, BACKGROUND_THREADS[i]);
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,505 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <glib.h>
+
+#include "harness.h"
+
+/*
+ * Runs the whole extension against the mock daemon in a headless nautilus
+ * and times how long it takes to put emblems on files, for the situations
+ * users run into. Results can be written to JSON to compare builds.
+ */
+
+/* Every tenth entry is a directory, like a typical home folder */
+static const int DIRECTORY_EVERY = 10;
+
+/* How many files fit on a screen, and how long a user looks at one while scrolling */
+static const int SCREEN = 500;
+static const gint64 SCROLL_PAUSE = 2000;
+
+static const gint64 CONNECT_TIMEOUT = 10 * G_USEC_PER_SEC;
+static const gint64 LOAD_TIMEOUT = 120 * G_USEC_PER_SEC;
+
+struct ScenarioResult
+{
+    int                     files;
+    int                     emblemed;
+    int                     failed;
+    int                     cancelled;
+    gint64                  start;
+    gint64                  last;
+    std::vector<gint64>     latencies;
+    gint64                  stall_max;
+    gint64                  stall_total;
+    gint                    daemon_requests;
+    gboolean                finished;
+};
+
+struct Scenario
+{
+    const gchar*    name;
+    int             files;
+    void            (*run)(Harness*, const Scenario*, ScenarioResult*);
+};
+
+static gchar* json_file = nullptr;
+static gchar* only = nullptr;
+
+static GOptionEntry entries[] = {
+    { "json", 0, 0, G_OPTION_ARG_FILENAME, &json_file, "Also write the results to FILE", "FILE" },
+    { "scenario", 0, 0, G_OPTION_ARG_STRING, &only, "Only run the scenarios starting with NAME", "NAME" },
+    { nullptr }
+};
+
+static std::vector<HarnessFile*> make_files(Harness* t_harness, const gchar* t_dir, int t_count)
+{
+    gchar* dir = g_build_filename(t_harness->daemon->root, t_dir, nullptr);
+    std::vector<HarnessFile*> files;
+
+    for (int i = 0; i < t_count; i++)
+    {
+        gchar* name = g_strdup_printf("file-%d", i);
+        gchar* path = g_build_filename(dir, name, nullptr);
+
+        files.push_back(harness_file_new(t_harness, path, i % DIRECTORY_EVERY == 0));
+
+        g_free(path);
+        g_free(name);
+    }
+
+    g_free(dir);
+
+    return files;
+}
+
+/* What nautilus does when it leaves a directory, the extension sees every file die */
+static void free_files(std::vector<HarnessFile*>& t_files)
+{
+    for (HarnessFile* file : t_files)
+    {
+        g_object_unref(file);
+    }
+
+    t_files.clear();
+}
+
+static void request_all(Harness* t_harness, std::vector<HarnessFile*>& t_files, int t_from, int t_to)
+{
+    for (int i = t_from; i < t_to; i++)
+    {
+        harness_update_file_info(t_harness, t_files[i]);
+    }
+}
+
+struct EmblemWait
+{
+    Harness*                        harness;
+    std::vector<HarnessFile*>*      files;
+    guint                           min_updates;
+};
+
+/* Idle isn't enough when the extension resets files a few at a time */
+static gboolean all_emblemed(EmblemWait* t_wait)
+{
+    if (g_hash_table_size(t_wait->harness->handles) != 0 || !g_queue_is_empty(&(t_wait->harness->invalidated)))
+    {
+        return false;
+    }
+
+    for (HarnessFile* file : *(t_wait->files))
+    {
+        if (file->updates < t_wait->min_updates || file->emblemed == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static gboolean wait_emblemed(Harness* t_harness, std::vector<HarnessFile*>& t_files, guint t_min_updates)
+{
+    EmblemWait wait = { t_harness, &t_files, t_min_updates };
+
+    return harness_run_until(t_harness, (HarnessDoneFunc) all_emblemed, &wait, LOAD_TIMEOUT);
+}
+
+/* Looks at the files that were asked about since t_result->start */
+static void collect(ScenarioResult* t_result, std::vector<HarnessFile*>& t_files)
+{
+    t_result->files = t_files.size();
+    t_result->last = t_result->start;
+
+    for (HarnessFile* file : t_files)
+    {
+        if (file->emblemed != 0 && file->requested >= t_result->start)
+        {
+            t_result->emblemed++;
+            t_result->latencies.push_back(file->emblemed - file->requested);
+            t_result->last = MAX(t_result->last, file->emblemed);
+        }
+
+        if (file->result == NAUTILUS_OPERATION_FAILED && file->handle == nullptr && file->completed != 0)
+        {
+            t_result->failed++;
+        }
+    }
+}
+
+static void start(Harness* t_harness, ScenarioResult* t_result)
+{
+    harness_reset_stalls(t_harness);
+    t_result->daemon_requests = g_atomic_int_get(&(t_harness->daemon->requests));
+    t_result->start = g_get_monotonic_time();
+}
+
+static void stop(Harness* t_harness, ScenarioResult* t_result)
+{
+    t_result->stall_max = t_harness->stall_max;
+    t_result->stall_total = t_harness->stall_total;
+    t_result->daemon_requests = g_atomic_int_get(&(t_harness->daemon->requests)) - t_result->daemon_requests;
+}
+
+/* Opens a directory nobody looked at before */
+static void scenario_open(Harness* t_harness, const Scenario* t_scenario, ScenarioResult* t_result)
+{
+    std::vector<HarnessFile*> files = make_files(t_harness, t_scenario->name, t_scenario->files);
+
+    start(t_harness, t_result);
+    request_all(t_harness, files, 0, files.size());
+    t_result->finished = wait_emblemed(t_harness, files, 1);
+    stop(t_harness, t_result);
+
+    collect(t_result, files);
+    free_files(files);
+}
+
+/* Leaves a directory and comes back to it, so the extension has seen the paths but not the files */
+static void scenario_revisit(Harness* t_harness, const Scenario* t_scenario, ScenarioResult* t_result)
+{
+    std::vector<HarnessFile*> files = make_files(t_harness, t_scenario->name, t_scenario->files);
+
+    request_all(t_harness, files, 0, files.size());
+    wait_emblemed(t_harness, files, 1);
+    free_files(files);
+
+    files = make_files(t_harness, t_scenario->name, t_scenario->files);
+
+    start(t_harness, t_result);
+    request_all(t_harness, files, 0, files.size());
+    t_result->finished = wait_emblemed(t_harness, files, 1);
+    stop(t_harness, t_result);
+
+    collect(t_result, files);
+    free_files(files);
+}
+
+/*
+ * Scrolls through a directory a screen at a time, faster than the emblems
+ * come in. Nautilus cancels the requests for files that scrolled away, only
+ * the last screen has to get its emblems.
+ */
+static void scenario_scroll(Harness* t_harness, const Scenario* t_scenario, ScenarioResult* t_result)
+{
+    std::vector<HarnessFile*> files = make_files(t_harness, t_scenario->name, t_scenario->files);
+    int count = files.size();
+    int screen = 0;
+
+    start(t_harness, t_result);
+
+    for (screen = 0; screen + SCREEN < count; screen += SCREEN)
+    {
+        request_all(t_harness, files, screen, screen + SCREEN);
+        g_usleep(SCROLL_PAUSE);
+        g_main_context_iteration(nullptr, false);
+
+        for (int i = screen; i < screen + SCREEN; i++)
+        {
+            if (files[i]->handle != nullptr)
+            {
+                harness_cancel_update(t_harness, files[i]);
+                t_result->cancelled++;
+            }
+
+            files[i]->visible = false;
+        }
+    }
+
+    std::vector<HarnessFile*> last(files.begin() + screen, files.end());
+
+    request_all(t_harness, files, screen, count);
+    t_result->finished = wait_emblemed(t_harness, last, 1) && harness_wait_idle(t_harness, LOAD_TIMEOUT);
+    stop(t_harness, t_result);
+
+    collect(t_result, last);
+    t_result->files = count;
+    free_files(files);
+}
+
+/* The daemon goes away a quarter of the way into opening a directory */
+static void scenario_reconnect(Harness* t_harness, const Scenario* t_scenario, ScenarioResult* t_result)
+{
+    std::vector<HarnessFile*> files = make_files(t_harness, t_scenario->name, t_scenario->files);
+    guint completions = t_harness->completions;
+
+    start(t_harness, t_result);
+    request_all(t_harness, files, 0, files.size());
+
+    while (t_harness->completions - completions < files.size() / 4 && g_hash_table_size(t_harness->handles) != 0)
+    {
+        g_main_context_iteration(nullptr, true);
+    }
+
+    mock_daemon_disconnect(t_harness->daemon);
+
+    t_result->finished = wait_emblemed(t_harness, files, 1);
+    stop(t_harness, t_result);
+
+    collect(t_result, files);
+    free_files(files);
+}
+
+struct TouchStorm
+{
+    MockDaemon*     daemon;
+    GPtrArray*      paths;
+    guint           count;
+    gint            done;
+};
+
+/* Plays dropbox, the extension reads the touches on the main loop meanwhile */
+static gpointer touch_storm_daemon(TouchStorm* t_storm)
+{
+    mock_daemon_shell_touch_storm(t_storm->daemon, (const gchar* const*) t_storm->paths->pdata, t_storm->count);
+    g_atomic_int_set(&(t_storm->done), true);
+
+    return nullptr;
+}
+
+static gboolean touch_storm_done(TouchStorm* t_storm)
+{
+    return g_atomic_int_get(&(t_storm->done));
+}
+
+/* Dropbox touches every file in a directory that is on screen, like after a big sync */
+static void scenario_storm(Harness* t_harness, const Scenario* t_scenario, ScenarioResult* t_result)
+{
+    std::vector<HarnessFile*> files = make_files(t_harness, t_scenario->name, t_scenario->files);
+    GPtrArray* paths = g_ptr_array_new_with_free_func(g_free);
+
+    request_all(t_harness, files, 0, files.size());
+    wait_emblemed(t_harness, files, 1);
+
+    for (HarnessFile* file : files)
+    {
+        g_ptr_array_add(paths, g_filename_from_uri(file->uri, nullptr, nullptr));
+    }
+
+    g_ptr_array_add(paths, nullptr);
+
+    TouchStorm storm = { t_harness->daemon, paths, (guint) files.size(), false };
+
+    start(t_harness, t_result);
+    GThread* daemon = g_thread_new("touch-storm", (GThreadFunc) touch_storm_daemon, &storm);
+    t_result->finished = wait_emblemed(t_harness, files, 2);
+    stop(t_harness, t_result);
+
+    // The touches that didn't change anything may still be on their way
+    harness_run_until(t_harness, (HarnessDoneFunc) touch_storm_done, &storm, LOAD_TIMEOUT);
+    g_thread_join(daemon);
+
+    collect(t_result, files);
+    free_files(files);
+    g_ptr_array_free(paths, true);
+}
+
+static void menu_items_updated(NautilusMenuProvider* t_provider, gboolean* t_updated)
+{
+    *t_updated = true;
+}
+
+static gboolean is_set(gboolean* t_flag)
+{
+    return *t_flag;
+}
+
+/*
+ * Right-clicks a selection while dropbox answers with options that don't
+ * parse. The extension has to show no menu at all, and not crash doing so.
+ */
+static void scenario_malformed_menu(Harness* t_harness, const Scenario* t_scenario, ScenarioResult* t_result)
+{
+    std::vector<HarnessFile*> files = make_files(t_harness, t_scenario->name, t_scenario->files);
+    GList* selection = nullptr;
+    gboolean updated = false;
+    gulong handler = g_signal_connect(t_harness->provider, "items-updated", G_CALLBACK(menu_items_updated), &updated);
+
+    for (HarnessFile* file : files)
+    {
+        selection = g_list_prepend(selection, file);
+    }
+
+    g_atomic_int_set(&(t_harness->daemon->options.malformed_menu), true);
+    start(t_harness, t_result);
+
+    // The first time there's only the placeholder, the options are asked for meanwhile
+    g_list_free_full(harness_get_file_items(t_harness, selection), (GDestroyNotify) g_object_unref);
+
+    if (harness_run_until(t_harness, (HarnessDoneFunc) is_set, &updated, LOAD_TIMEOUT))
+    {
+        GList* items = harness_get_file_items(t_harness, selection);
+
+        t_result->finished = items == nullptr;
+        g_list_free_full(items, (GDestroyNotify) g_object_unref);
+    }
+
+    stop(t_harness, t_result);
+    g_atomic_int_set(&(t_harness->daemon->options.malformed_menu), false);
+
+    g_signal_handler_disconnect(t_harness->provider, handler);
+    g_list_free(selection);
+    t_result->files = files.size();
+    free_files(files);
+}
+
+static const Scenario scenarios[] = {
+    { "open-1k", 1000, scenario_open },
+    { "open-10k", 10000, scenario_open },
+    { "open-100k", 100000, scenario_open },
+    { "revisit-10k", 10000, scenario_revisit },
+    { "scroll-cancel-10k", 10000, scenario_scroll },
+    { "reconnect-10k", 10000, scenario_reconnect },
+    { "touch-storm-10k", 10000, scenario_storm },
+    { "menu-malformed", 8, scenario_malformed_menu },
+};
+
+static gint64 percentile(std::vector<gint64>& t_samples, gdouble t_p)
+{
+    return t_samples.empty() ? 0 : t_samples[(gsize) (t_p * (t_samples.size() - 1))];
+}
+
+static gdouble files_per_second(ScenarioResult* t_result)
+{
+    gint64 elapsed = t_result->last - t_result->start;
+
+    return elapsed > 0 ? t_result->emblemed * (gdouble) G_USEC_PER_SEC / elapsed : 0;
+}
+
+static void print_result(const Scenario* t_scenario, ScenarioResult* t_result)
+{
+    g_print("%-18s %8d %8d %8d %8d %10.3f %10.1f %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT "%s\n",
+        t_scenario->name, t_result->files, t_result->emblemed, t_result->failed, t_result->cancelled,
+        (t_result->last - t_result->start) / (gdouble) G_USEC_PER_SEC, files_per_second(t_result),
+        percentile(t_result->latencies, 0.5), percentile(t_result->latencies, 0.99), t_result->stall_max,
+        t_result->finished ? "" : " (timed out)");
+}
+
+static void append_json(GString* t_json, const Scenario* t_scenario, ScenarioResult* t_result)
+{
+    g_string_append_printf(t_json,
+        "%s\n    \"%s\": {\"files\": %d, \"emblemed\": %d, \"failed\": %d, \"cancelled\": %d, "
+        "\"seconds\": %.6f, \"files_per_sec\": %.1f, \"p50_usec\": %" G_GINT64_FORMAT ", "
+        "\"p99_usec\": %" G_GINT64_FORMAT ", \"max_usec\": %" G_GINT64_FORMAT ", "
+        "\"stall_max_usec\": %" G_GINT64_FORMAT ", \"stall_total_usec\": %" G_GINT64_FORMAT ", "
+        "\"daemon_requests\": %d, \"finished\": %s}",
+        t_json->len > 2 ? "," : "", t_scenario->name, t_result->files, t_result->emblemed, t_result->failed,
+        t_result->cancelled, (t_result->last - t_result->start) / (gdouble) G_USEC_PER_SEC,
+        files_per_second(t_result), percentile(t_result->latencies, 0.5), percentile(t_result->latencies, 0.99),
+        t_result->latencies.empty() ? 0 : t_result->latencies.back(), t_result->stall_max, t_result->stall_total,
+        t_result->daemon_requests, t_result->finished ? "true" : "false");
+}
+
+int main(int argc, char** argv)
+{
+    GError* error = nullptr;
+    GOptionContext* context = g_option_context_new("- time emblems end to end");
+    MockDaemonOptions options;
+    gboolean failed = false;
+
+    g_option_context_add_main_entries(context, entries, nullptr);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    mock_daemon_options_init(&options);
+
+    Harness* harness = harness_new(&options, &error);
+
+    if (harness == nullptr)
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    if (!harness_wait_connected(harness, CONNECT_TIMEOUT))
+    {
+        g_printerr("the extension didn't connect to the mock daemon\n");
+        harness_free(harness);
+        return 1;
+    }
+
+    GString* json = g_string_new("{");
+
+    g_print("%-18s %8s %8s %8s %8s %10s %10s %8s %8s %8s\n", "scenario", "files", "emblemed", "failed",
+        "cancel", "seconds", "files/s", "p50 us", "p99 us", "stall us");
+
+    for (const Scenario& scenario : scenarios)
+    {
+        if (only != nullptr && !g_str_has_prefix(scenario.name, only))
+        {
+            continue;
+        }
+
+        ScenarioResult result = ScenarioResult();
+
+        scenario.run(harness, &scenario, &result);
+        std::sort(result.latencies.begin(), result.latencies.end());
+
+        print_result(&scenario, &result);
+        append_json(json, &scenario, &result);
+
+        failed |= !result.finished;
+
+        // Whatever is left of a timed out scenario would skew the next one
+        harness_wait_idle(harness, LOAD_TIMEOUT);
+    }
+
+    g_string_append(json, "\n}\n");
+
+    if (json_file != nullptr && !g_file_set_contents(json_file, json->str, json->len, &error))
+    {
+        g_printerr("%s\n", error->message);
+        failed = true;
+    }
+
+    g_string_free(json, true);
+    harness_free(harness);
+    g_option_context_free(context);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,566 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstring>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glib-object.h>
+
+#include <libnautilus-extension/nautilus-extension-types.h>
+
+#include "harness.h"
+#include "nautilus-dropbox.h"
+
+/* How often a waiting harness looks at the clock */
+static const guint RUN_TICK_MSEC = 10;
+
+struct HarnessModule
+{
+    GTypeModule         parent;
+};
+
+struct HarnessModuleClass
+{
+    GTypeModuleClass    parent_class;
+};
+
+static Harness* the_harness = nullptr;
+static gpointer file_parent_class = nullptr;
+
+/* The extension is linked in, so there is nothing to load */
+static gboolean harness_module_load(GTypeModule* t_module)
+{
+    return true;
+}
+
+static void harness_module_unload(GTypeModule* t_module)
+{
+
+}
+
+static void harness_module_class_init(HarnessModuleClass* t_class)
+{
+    G_TYPE_MODULE_CLASS(t_class)->load = harness_module_load;
+    G_TYPE_MODULE_CLASS(t_class)->unload = harness_module_unload;
+}
+
+static GType harness_module_get_type()
+{
+    static GType type = 0;
+
+    if (type == 0)
+    {
+        static const GTypeInfo info = {
+            sizeof (HarnessModuleClass),
+            (GBaseInitFunc) nullptr,
+            (GBaseFinalizeFunc) nullptr,
+            (GClassInitFunc) harness_module_class_init,
+            (GClassFinalizeFunc) nullptr,
+            nullptr,
+            sizeof (HarnessModule),
+            0,
+            (GInstanceInitFunc) nullptr,
+        };
+
+        type = g_type_register_static(G_TYPE_TYPE_MODULE, "HarnessModule", &info, (GTypeFlags) 0);
+    }
+
+    return type;
+}
+
+static void queue_refresh(HarnessFile* t_file);
+
+static gboolean file_is_gone(NautilusFileInfo* t_file)
+{
+    return HARNESS_FILE(t_file)->gone;
+}
+
+static gchar* file_get_name(NautilusFileInfo* t_file)
+{
+    return g_path_get_basename(HARNESS_FILE(t_file)->uri);
+}
+
+static gchar* file_get_uri(NautilusFileInfo* t_file)
+{
+    return g_strdup(HARNESS_FILE(t_file)->uri);
+}
+
+static gchar* file_get_parent_uri(NautilusFileInfo* t_file)
+{
+    return g_path_get_dirname(HARNESS_FILE(t_file)->uri);
+}
+
+static gchar* file_get_uri_scheme(NautilusFileInfo* t_file)
+{
+    return g_strdup("file");
+}
+
+static gchar* file_get_mime_type(NautilusFileInfo* t_file)
+{
+    return g_strdup(HARNESS_FILE(t_file)->directory ? "inode/directory" : "application/octet-stream");
+}
+
+static gboolean file_is_mime_type(NautilusFileInfo* t_file, const gchar* t_mime_type)
+{
+    gchar* mime_type = file_get_mime_type(t_file);
+    gboolean is = strcmp(mime_type, t_mime_type) == 0;
+
+    g_free(mime_type);
+
+    return is;
+}
+
+static gboolean file_is_directory(NautilusFileInfo* t_file)
+{
+    return HARNESS_FILE(t_file)->directory;
+}
+
+static void file_add_emblem(NautilusFileInfo* t_file, const gchar* t_emblem_name)
+{
+    HarnessFile* file = HARNESS_FILE(t_file);
+
+    if (file->emblemed == 0)
+    {
+        file->emblemed = g_get_monotonic_time();
+    }
+
+    g_ptr_array_add(file->emblems, g_strdup(t_emblem_name));
+}
+
+static gchar* file_get_string_attribute(NautilusFileInfo* t_file, const gchar* t_attribute_name)
+{
+    return nullptr;
+}
+
+static void file_add_string_attribute(NautilusFileInfo* t_file, const gchar* t_attribute_name, const gchar* t_value)
+{
+
+}
+
+/* Nautilus drops what the extension told it and asks again once the file is on screen */
+static void file_invalidate_extension_info(NautilusFileInfo* t_file)
+{
+    HarnessFile* file = HARNESS_FILE(t_file);
+
+    file->invalidations++;
+    g_ptr_array_set_size(file->emblems, 0);
+
+    if (file->visible && !file->gone)
+    {
+        queue_refresh(file);
+    }
+}
+
+static void harness_file_info_iface_init(NautilusFileInfoIface* t_iface)
+{
+    t_iface->is_gone = file_is_gone;
+    t_iface->get_name = file_get_name;
+    t_iface->get_uri = file_get_uri;
+    t_iface->get_parent_uri = file_get_parent_uri;
+    t_iface->get_uri_scheme = file_get_uri_scheme;
+    t_iface->get_mime_type = file_get_mime_type;
+    t_iface->is_mime_type = file_is_mime_type;
+    t_iface->is_directory = file_is_directory;
+    t_iface->add_emblem = file_add_emblem;
+    t_iface->get_string_attribute = file_get_string_attribute;
+    t_iface->add_string_attribute = file_add_string_attribute;
+    t_iface->invalidate_extension_info = file_invalidate_extension_info;
+}
+
+static void harness_file_finalize(GObject* t_object)
+{
+    HarnessFile* file = HARNESS_FILE(t_object);
+
+    g_free(file->uri);
+    g_ptr_array_free(file->emblems, true);
+
+    G_OBJECT_CLASS(file_parent_class)->finalize(t_object);
+}
+
+static void harness_file_class_init(HarnessFileClass* t_class)
+{
+    file_parent_class = g_type_class_peek_parent(t_class);
+    G_OBJECT_CLASS(t_class)->finalize = harness_file_finalize;
+
+    // What nautilus emits when a file is renamed or its attributes change
+    g_signal_new("changed", HARNESS_TYPE_FILE, G_SIGNAL_RUN_LAST, 0, nullptr, nullptr, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+}
+
+static void harness_file_init(HarnessFile* t_file)
+{
+    t_file->emblems = g_ptr_array_new_with_free_func(g_free);
+    t_file->visible = true;
+    t_file->result = NAUTILUS_OPERATION_IN_PROGRESS;
+}
+
+GType harness_file_get_type()
+{
+    static GType type = 0;
+
+    if (type == 0)
+    {
+        static const GTypeInfo info = {
+            sizeof (HarnessFileClass),
+            (GBaseInitFunc) nullptr,
+            (GBaseFinalizeFunc) nullptr,
+            (GClassInitFunc) harness_file_class_init,
+            (GClassFinalizeFunc) nullptr,
+            nullptr,
+            sizeof (HarnessFile),
+            0,
+            (GInstanceInitFunc) harness_file_init,
+        };
+
+        static const GInterfaceInfo file_info_iface_info = {
+            (GInterfaceInitFunc) harness_file_info_iface_init,
+            nullptr,
+            nullptr
+        };
+
+        type = g_type_register_static(G_TYPE_OBJECT, "HarnessFile", &info, (GTypeFlags) 0);
+        g_type_add_interface_static(type, NAUTILUS_TYPE_FILE_INFO, &file_info_iface_info);
+    }
+
+    return type;
+}
+
+/* Asks about the invalidated files that are still visible, in one go like nautilus */
+static gboolean refresh_invalidated(Harness* t_harness)
+{
+    HarnessFile* file;
+
+    t_harness->refresh_source = 0;
+
+    while ((file = (HarnessFile *) g_queue_pop_head(&(t_harness->invalidated))) != nullptr)
+    {
+        file->queued = false;
+
+        if (file->visible && !file->gone)
+        {
+            harness_update_file_info(t_harness, file);
+        }
+
+        g_object_unref(file);
+    }
+
+    return false;
+}
+
+static void queue_refresh(HarnessFile* t_file)
+{
+    Harness* harness = t_file->harness;
+
+    if (t_file->queued)
+    {
+        return;
+    }
+
+    t_file->queued = true;
+    g_queue_push_tail(&(harness->invalidated), g_object_ref(t_file));
+
+    if (harness->refresh_source == 0)
+    {
+        harness->refresh_source = g_idle_add((GSourceFunc) refresh_invalidated, harness);
+    }
+}
+
+static void update_complete(NautilusInfoProvider* t_provider, NautilusOperationHandle* t_handle, NautilusOperationResult t_result, Harness* t_harness)
+{
+    gpointer key;
+    gpointer value;
+
+    // Cancelled requests were forgotten already
+    if (!g_hash_table_lookup_extended(t_harness->handles, t_handle, &key, &value))
+    {
+        return;
+    }
+
+    HarnessFile* file = HARNESS_FILE(value);
+
+    g_hash_table_steal(t_harness->handles, t_handle);
+
+    if (file->handle == t_handle)
+    {
+        file->handle = nullptr;
+        file->completed = g_get_monotonic_time();
+        file->result = t_result;
+    }
+
+    t_harness->completions++;
+    g_object_unref(file);
+}
+
+/*
+ * Starts a mock daemon with t_options and loads the extension, which
+ * connects to it.
+ *
+ * Returns:
+ * nullptr if there is a harness already or the daemon couldn't start.
+ */
+Harness* harness_new(const MockDaemonOptions* t_options, GError** t_err)
+{
+    if (the_harness != nullptr)
+    {
+        g_set_error(t_err, g_quark_from_static_string("harness"), 0, "there can only be one harness");
+        return nullptr;
+    }
+
+    gchar* home = g_dir_make_tmp("dna-harness-XXXXXX", t_err);
+
+    if (home == nullptr)
+    {
+        return nullptr;
+    }
+
+    // The extension finds dropbox under HOME, this has to happen before anything asks for it
+    g_setenv("HOME", home, true);
+
+    MockDaemon* daemon = mock_daemon_new(home, t_options, t_err);
+
+    if (daemon == nullptr)
+    {
+        g_rmdir(home);
+        g_free(home);
+
+        return nullptr;
+    }
+
+    Harness* harness = g_new0(Harness, 1);
+
+    harness->home = home;
+    harness->daemon = daemon;
+    harness->handles = g_hash_table_new_full(g_direct_hash, g_direct_equal, nullptr, g_object_unref);
+    g_queue_init(&(harness->invalidated));
+
+    GTypeModule* module = G_TYPE_MODULE(g_object_new(harness_module_get_type(), nullptr));
+    const GType* types;
+    int type_count;
+
+    g_type_module_use(module);
+    nautilus_module_initialize(module);
+    nautilus_module_list_types(&types, &type_count);
+
+    // Otherwise the extension reports every file as complete right away and the closure is never called
+    dropbox_use_operation_in_progress_workaround = false;
+
+    harness->provider = G_OBJECT(g_object_new(types[0], nullptr));
+
+    harness->update_complete = g_cclosure_new(G_CALLBACK(update_complete), harness, nullptr);
+    g_closure_set_marshal(harness->update_complete, g_cclosure_marshal_generic);
+    g_closure_ref(harness->update_complete);
+    g_closure_sink(harness->update_complete);
+
+    the_harness = harness;
+
+    return harness;
+}
+
+/*
+ * Stops the daemon and cleans up HOME. The extension stays loaded, it keeps
+ * trying to reconnect until the process exits.
+ */
+void harness_free(Harness* t_harness)
+{
+    nautilus_module_shutdown();
+
+    gchar* info = g_build_filename(t_harness->daemon->dropbox_dir, "info.json", nullptr);
+
+    g_unlink(info);
+    g_rmdir(t_harness->daemon->root);
+    g_rmdir(t_harness->daemon->dropbox_dir);
+    g_free(info);
+
+    mock_daemon_free(t_harness->daemon);
+    g_rmdir(t_harness->home);
+
+    if (t_harness->refresh_source != 0)
+    {
+        g_source_remove(t_harness->refresh_source);
+    }
+
+    g_queue_free_full(&(t_harness->invalidated), g_object_unref);
+    g_hash_table_destroy(t_harness->handles);
+    g_closure_unref(t_harness->update_complete);
+    g_free(t_harness->home);
+    g_free(t_harness);
+}
+
+/* A visible file at t_path, which doesn't have to exist */
+HarnessFile* harness_file_new(Harness* t_harness, const gchar* t_path, gboolean t_directory)
+{
+    HarnessFile* file = HARNESS_FILE(g_object_new(HARNESS_TYPE_FILE, nullptr));
+
+    file->harness = t_harness;
+    file->uri = g_filename_to_uri(t_path, nullptr, nullptr);
+    file->directory = t_directory;
+
+    return file;
+}
+
+/* Moves the file to t_path and tells whoever is listening, like nautilus does */
+void harness_file_rename(HarnessFile* t_file, const gchar* t_path)
+{
+    g_free(t_file->uri);
+    t_file->uri = g_filename_to_uri(t_path, nullptr, nullptr);
+
+    g_signal_emit_by_name(t_file, "changed");
+}
+
+/*
+ * Asks the extension about t_file through NautilusInfoProvider, starting
+ * the clock for its emblems.
+ */
+NautilusOperationResult harness_update_file_info(Harness* t_harness, HarnessFile* t_file)
+{
+    NautilusOperationHandle* handle = nullptr;
+    NautilusOperationResult result;
+
+    t_file->requested = g_get_monotonic_time();
+    t_file->emblemed = 0;
+    t_file->completed = 0;
+    t_file->updates++;
+    t_harness->requests++;
+
+    result = nautilus_info_provider_update_file_info(NAUTILUS_INFO_PROVIDER(t_harness->provider), NAUTILUS_FILE_INFO(t_file), t_harness->update_complete, &handle);
+
+    if (result == NAUTILUS_OPERATION_IN_PROGRESS)
+    {
+        t_file->handle = handle;
+        g_hash_table_insert(t_harness->handles, handle, g_object_ref(t_file));
+    }
+    else
+    {
+        t_file->completed = g_get_monotonic_time();
+        t_harness->completions++;
+    }
+
+    t_file->result = result;
+
+    return result;
+}
+
+/* What nautilus does when a file scrolls out of view before it got its emblems */
+void harness_cancel_update(Harness* t_harness, HarnessFile* t_file)
+{
+    NautilusOperationHandle* handle = t_file->handle;
+
+    if (handle == nullptr)
+    {
+        return;
+    }
+
+    nautilus_info_provider_cancel_update(NAUTILUS_INFO_PROVIDER(t_harness->provider), handle);
+
+    t_file->handle = nullptr;
+    t_file->result = NAUTILUS_OPERATION_FAILED;
+    g_hash_table_remove(t_harness->handles, handle);
+}
+
+/* The context menu items for a selection of HarnessFiles, free them with nautilus_menu_item_list_free */
+GList* harness_get_file_items(Harness* t_harness, GList* t_files)
+{
+    return nautilus_menu_provider_get_file_items(NAUTILUS_MENU_PROVIDER(t_harness->provider), nullptr, t_files);
+}
+
+/* A tick that comes late means something held up the main loop, which is nautilus' UI thread */
+static gboolean keep_ticking(Harness* t_harness)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (t_harness->last_tick != 0)
+    {
+        gint64 stall = now - t_harness->last_tick - RUN_TICK_MSEC * 1000;
+
+        if (stall > 0)
+        {
+            t_harness->stall_max = MAX(t_harness->stall_max, stall);
+            t_harness->stall_total += stall;
+        }
+    }
+
+    t_harness->last_tick = now;
+
+    return true;
+}
+
+/* Starts measuring main loop stalls from scratch */
+void harness_reset_stalls(Harness* t_harness)
+{
+    t_harness->last_tick = 0;
+    t_harness->stall_max = 0;
+    t_harness->stall_total = 0;
+}
+
+/*
+ * Runs the main loop until t_done returns true.
+ *
+ * Returns:
+ * false if that didn't happen within t_timeout_usec.
+ */
+gboolean harness_run_until(Harness* t_harness, HarnessDoneFunc t_done, gpointer t_ud, gint64 t_timeout_usec)
+{
+    gint64 deadline = g_get_monotonic_time() + t_timeout_usec;
+    guint tick = g_timeout_add(RUN_TICK_MSEC, (GSourceFunc) keep_ticking, t_harness);
+    gboolean done;
+
+    t_harness->last_tick = 0;
+
+    while (!(done = t_done(t_ud)) && g_get_monotonic_time() < deadline)
+    {
+        g_main_context_iteration(nullptr, true);
+    }
+
+    g_source_remove(tick);
+
+    return done;
+}
+
+static gboolean is_connected(Harness* t_harness)
+{
+    return dropbox_client_is_connected(&(((NautilusDropbox *) t_harness->provider)->dc));
+}
+
+static gboolean is_idle(Harness* t_harness)
+{
+    return g_hash_table_size(t_harness->handles) == 0 && g_queue_is_empty(&(t_harness->invalidated));
+}
+
+/* Waits for the extension to connect to the daemon and settle down */
+gboolean harness_wait_connected(Harness* t_harness, gint64 t_timeout_usec)
+{
+    if (!harness_run_until(t_harness, (HarnessDoneFunc) is_connected, t_harness, t_timeout_usec))
+    {
+        return false;
+    }
+
+    // What the extension does when it connects
+    while (g_main_context_iteration(nullptr, false))
+    {
+    }
+
+    return true;
+}
+
+/* Waits until every request that wasn't cancelled completed */
+gboolean harness_wait_idle(Harness* t_harness, gint64 t_timeout_usec)
+{
+    return harness_run_until(t_harness, (HarnessDoneFunc) is_idle, t_harness, t_timeout_usec);
+}
@@ -0,0 +1,115 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include <libnautilus-extension/nautilus-file-info.h>
+#include <libnautilus-extension/nautilus-info-provider.h>
+#include <libnautilus-extension/nautilus-menu-provider.h>
+
+#include "mock-daemon.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Hosts the extension the way nautilus does, without nautilus or a display.
+ *
+ * The extension is loaded through nautilus_module_initialize and talks to a
+ * mock daemon under a temporary HOME. Files are HarnessFile objects, which
+ * implement NautilusFileInfo and remember when they were asked about and
+ * when they got their emblems. Like nautilus, the harness asks about files
+ * again when the extension invalidates them, if they are visible.
+ *
+ * The extension can only be loaded once, so there is one harness per
+ * process.
+ */
+#define HARNESS_TYPE_FILE   (harness_file_get_type())
+#define HARNESS_FILE(o)     (G_TYPE_CHECK_INSTANCE_CAST((o), HARNESS_TYPE_FILE, HarnessFile))
+
+struct Harness;
+
+struct HarnessFile
+{
+    GObject                     parent;
+    Harness*                    harness;
+    gchar*                      uri;
+    gboolean                    directory;
+    gboolean                    gone;
+    gboolean                    visible;
+    gboolean                    queued;
+    GPtrArray*                  emblems;
+    NautilusOperationHandle*    handle;
+    gint64                      requested;
+    gint64                      emblemed;
+    gint64                      completed;
+    NautilusOperationResult     result;
+    guint                       updates;
+    guint                       invalidations;
+};
+
+struct HarnessFileClass
+{
+    GObjectClass                parent_class;
+};
+
+struct Harness
+{
+    gchar*                  home;
+    MockDaemon*             daemon;
+    GObject*                provider;
+    GClosure*               update_complete;
+    GHashTable*             handles;
+    GQueue                  invalidated;
+    guint                   refresh_source;
+    guint                   requests;
+    guint                   completions;
+
+    // How late the main loop ran a timer while the harness waited on it
+    gint64                  last_tick;
+    gint64                  stall_max;
+    gint64                  stall_total;
+};
+
+typedef gboolean (*HarnessDoneFunc)(gpointer);
+
+GType harness_file_get_type();
+
+Harness* harness_new(const MockDaemonOptions* t_options, GError** t_err);
+void harness_free(Harness* t_harness);
+
+HarnessFile* harness_file_new(Harness* t_harness, const gchar* t_path, gboolean t_directory);
+void harness_file_rename(HarnessFile* t_file, const gchar* t_path);
+
+NautilusOperationResult harness_update_file_info(Harness* t_harness, HarnessFile* t_file);
+void harness_cancel_update(Harness* t_harness, HarnessFile* t_file);
+GList* harness_get_file_items(Harness* t_harness, GList* t_files);
+
+gboolean harness_run_until(Harness* t_harness, HarnessDoneFunc t_done, gpointer t_ud, gint64 t_timeout_usec);
+gboolean harness_wait_connected(Harness* t_harness, gint64 t_timeout_usec);
+void harness_reset_stalls(Harness* t_harness);
+gboolean harness_wait_idle(Harness* t_harness, gint64 t_timeout_usec);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <deque>
+#include <vector>
+
+#include <glib.h>
+
+#include "alloc-count.h"
+#include "harness.h"
+#include "nautilus-dropbox.h"
+
+/*
+ * Simulates a nautilus window that stays open for weeks: it visits
+ * directory after directory, keeping the last few open, while files are
+ * renamed and dropbox restarts every now and then. Reports how the heap and
+ * RSS grow, and what the extension keeps per file it tracks.
+ *
+ * Allocation counts cover the whole process, including the mock daemon
+ * thread, which only holds on to memory while it answers.
+ */
+
+static const gint64 CONNECT_TIMEOUT = 10 * G_USEC_PER_SEC;
+static const gint64 VISIT_TIMEOUT = 60 * G_USEC_PER_SEC;
+static const int CHECKPOINTS = 10;
+
+static gint files = 1000000;
+static gint directory_size = 1000;
+static gint open_directories = 10;
+static gdouble rename_rate = 0.01;
+static gint reconnect_every = 100;
+static gchar* json_file = nullptr;
+
+static GOptionEntry entries[] = {
+    { "files", 0, 0, G_OPTION_ARG_INT, &files, "Visit N files in total", "N" },
+    { "directory-size", 0, 0, G_OPTION_ARG_INT, &directory_size, "Files per directory", "N" },
+    { "open-directories", 0, 0, G_OPTION_ARG_INT, &open_directories, "Keep the last N directories open, the rest die", "N" },
+    { "rename-rate", 0, 0, G_OPTION_ARG_DOUBLE, &rename_rate, "Rename this fraction of the files in every directory", "RATE" },
+    { "reconnect-every", 0, 0, G_OPTION_ARG_INT, &reconnect_every, "Restart the daemon every N directories, 0 for never", "N" },
+    { "json", 0, 0, G_OPTION_ARG_FILENAME, &json_file, "Also write the results to FILE", "FILE" },
+    { nullptr }
+};
+
+static guint tracked_files(Harness* t_harness)
+{
+    return ((NautilusDropbox *) t_harness->provider)->file_index.size;
+}
+
+static std::vector<HarnessFile*> make_directory(Harness* t_harness, int t_n)
+{
+    gchar* dir = g_strdup_printf("%s/visit-%d", t_harness->daemon->root, t_n);
+    std::vector<HarnessFile*> directory;
+
+    for (int i = 0; i < directory_size; i++)
+    {
+        gchar* path = g_strdup_printf("%s/file-%d", dir, i);
+
+        directory.push_back(harness_file_new(t_harness, path, false));
+        g_free(path);
+    }
+
+    g_free(dir);
+
+    return directory;
+}
+
+/* Renames go through the "changed" signal, which the extension follows in changed_cb */
+static guint rename_some(std::vector<HarnessFile*>& t_directory, GRand* t_rand)
+{
+    guint renamed = 0;
+
+    for (HarnessFile* file : t_directory)
+    {
+        if (g_rand_double(t_rand) >= rename_rate)
+        {
+            continue;
+        }
+
+        gchar* path = g_filename_from_uri(file->uri, nullptr, nullptr);
+        gchar* renamed_path = g_strconcat(path, "-renamed", nullptr);
+
+        harness_file_rename(file, renamed_path);
+        renamed++;
+
+        g_free(renamed_path);
+        g_free(path);
+    }
+
+    return renamed;
+}
+
+/* Leaving a directory drops the last reference to its files, the extension sees them die */
+static void close_directory(std::vector<HarnessFile*>& t_directory)
+{
+    for (HarnessFile* file : t_directory)
+    {
+        g_object_unref(file);
+    }
+}
+
+static void print_checkpoint(int t_visited, guint t_tracked, AllocCounts* t_base)
+{
+    AllocCounts counts;
+
+    alloc_count_get(&counts);
+
+    g_print("%10d %10u %12.1f %10.1f %14" G_GINT64_FORMAT "\n", t_visited, t_tracked,
+        (counts.live_bytes - t_base->live_bytes) / 1048576.0, alloc_count_rss() / 1048576.0,
+        counts.allocations - t_base->allocations);
+}
+
+int main(int argc, char** argv)
+{
+    GError* error = nullptr;
+    GOptionContext* context = g_option_context_new("- measure memory over a long session");
+    MockDaemonOptions options;
+
+    g_option_context_add_main_entries(context, entries, nullptr);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    int directories = MAX(1, files / MAX(directory_size, 1));
+
+    mock_daemon_options_init(&options);
+
+    Harness* harness = harness_new(&options, &error);
+
+    if (harness == nullptr)
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    if (!harness_wait_connected(harness, CONNECT_TIMEOUT))
+    {
+        g_printerr("the extension didn't connect to the mock daemon\n");
+        harness_free(harness);
+        return 1;
+    }
+
+    GRand* rand = g_rand_new_with_seed(1);
+    std::deque<std::vector<HarnessFile*>> open;
+    AllocCounts base, before, after;
+    gint64 rss_start = alloc_count_rss();
+    gint64 attached_bytes = 0, attached_allocations = 0;
+    guint tracked_peak = 0, renamed = 0, reconnects = 0;
+    gboolean failed = false;
+    int visited = 0;
+
+    alloc_count_get(&base);
+
+    g_print("%10s %10s %12s %10s %14s\n", "visited", "tracked", "heap MB", "rss MB", "allocations");
+
+    for (int d = 0; d < directories; d++)
+    {
+        std::vector<HarnessFile*> directory = make_directory(harness, d);
+
+        // Only count what the extension keeps for the files, not the files themselves
+        alloc_count_get(&before);
+
+        for (HarnessFile* file : directory)
+        {
+            harness_update_file_info(harness, file);
+        }
+
+        if (!harness_wait_idle(harness, VISIT_TIMEOUT))
+        {
+            g_printerr("directory %d didn't load within %" G_GINT64_FORMAT " seconds\n", d, VISIT_TIMEOUT / G_USEC_PER_SEC);
+            failed = true;
+        }
+
+        alloc_count_get(&after);
+        attached_bytes += after.live_bytes - before.live_bytes;
+        attached_allocations += after.allocations - before.allocations;
+
+        visited += directory.size();
+        renamed += rename_some(directory, rand);
+        tracked_peak = MAX(tracked_peak, tracked_files(harness));
+
+        open.push_back(directory);
+
+        if ((int) open.size() > open_directories)
+        {
+            close_directory(open.front());
+            open.pop_front();
+        }
+
+        if (reconnect_every > 0 && (d + 1) % reconnect_every == 0)
+        {
+            mock_daemon_disconnect(harness->daemon);
+            reconnects++;
+
+            if (!harness_wait_connected(harness, CONNECT_TIMEOUT) || !harness_wait_idle(harness, VISIT_TIMEOUT))
+            {
+                g_printerr("the extension didn't come back after a reconnect\n");
+                failed = true;
+            }
+        }
+
+        if ((d + 1) % MAX(1, directories / CHECKPOINTS) == 0)
+        {
+            print_checkpoint(visited, tracked_files(harness), &base);
+        }
+    }
+
+    while (!open.empty())
+    {
+        close_directory(open.front());
+        open.pop_front();
+    }
+
+    harness_wait_idle(harness, VISIT_TIMEOUT);
+
+    while (g_main_context_iteration(nullptr, false))
+    {
+    }
+
+    AllocCounts end;
+
+    alloc_count_get(&end);
+
+    gdouble bytes_per_file = visited > 0 ? attached_bytes / (gdouble) visited : 0;
+    gdouble allocations_per_file = visited > 0 ? attached_allocations / (gdouble) visited : 0;
+    gdouble leaked_per_file = visited > 0 ? (end.live_bytes - base.live_bytes) / (gdouble) visited : 0;
+    gint64 rss_end = alloc_count_rss();
+    gint64 rss_peak = alloc_count_peak_rss();
+
+    g_print("\n");
+    g_print("%-28s %12d\n", "files visited", visited);
+    g_print("%-28s %12u\n", "renamed", renamed);
+    g_print("%-28s %12u\n", "reconnects", reconnects);
+    g_print("%-28s %12u\n", "tracked at most", tracked_peak);
+    g_print("%-28s %12u\n", "tracked at the end", tracked_files(harness));
+    g_print("%-28s %12.1f\n", "bytes per tracked file", bytes_per_file);
+    g_print("%-28s %12.2f\n", "allocations per file", allocations_per_file);
+    g_print("%-28s %12.1f\n", "bytes left per visited file", leaked_per_file);
+    g_print("%-28s %12.1f MB\n", "rss at start", rss_start / 1048576.0);
+    g_print("%-28s %12.1f MB\n", "rss at end", rss_end / 1048576.0);
+    g_print("%-28s %12.1f MB\n", "peak rss", rss_peak / 1048576.0);
+
+    gchar* json = g_strdup_printf(
+        "{\n    \"long-session\": {\"files\": %d, \"renamed\": %u, \"reconnects\": %u, \"tracked_peak\": %u, "
+        "\"bytes_per_tracked_file\": %.1f, \"allocations_per_file\": %.2f, \"leaked_bytes_per_file\": %.1f, "
+        "\"rss_start_bytes\": %" G_GINT64_FORMAT ", \"rss_end_bytes\": %" G_GINT64_FORMAT ", "
+        "\"rss_peak_bytes\": %" G_GINT64_FORMAT ", \"heap_end_bytes\": %" G_GINT64_FORMAT ", \"finished\": %s}\n}\n",
+        visited, renamed, reconnects, tracked_peak, bytes_per_file, allocations_per_file, leaked_per_file,
+        rss_start, rss_end, rss_peak, end.live_bytes, failed ? "false" : "true");
+
+    if (json_file != nullptr && !g_file_set_contents(json_file, json, -1, &error))
+    {
+        g_printerr("%s\n", error->message);
+        failed = true;
+    }
+
+    g_free(json);
+    g_rand_free(rand);
+    harness_free(harness);
+    g_option_context_free(context);
+
+    return failed ? 1 : 0;
+}
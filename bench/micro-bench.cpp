@@ -0,0 +1,420 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <limits.h>
+#include <cstring>
+#include <vector>
+
+#include <glib.h>
+
+#include "dropbox-client-util.h"
+#include "dropbox-path-util.h"
+#include "dropbox-selection.h"
+#include "nautilus-dropbox.h"
+
+/*
+ * Microbenchmarks for the helpers that run once per file or per menu item,
+ * in the spirit of Google Benchmark: every case runs a growing number of
+ * iterations until it takes long enough to time, and reports the time per
+ * call and the throughput.
+ *
+ * Usage: micro-bench [--filter TEXT] [--min-time SECONDS] [--json FILE]
+ */
+
+/* Don't bother timing runs shorter than this while looking for the iteration count */
+static const gdouble CALIBRATE_FRACTION = 0.1;
+static const guint64 MAX_ITERATIONS = G_GUINT64_CONSTANT(1000000000);
+
+/* The options dropbox offers for a typical selection, and for a directory with a lot of shared folders */
+static const int MENU_ITEMS = 8;
+static const int HUGE_MENU_ITEMS = 5000;
+
+static const int DEEP_PATH_COMPONENTS = 64;
+static const int ESCAPED_VALUES = 64;
+
+struct MicroState
+{
+    guint64         iterations;
+    gconstpointer   arg;
+
+    // What one iteration processes, for the throughput
+    gint64          items;
+    gint64          bytes;
+};
+
+struct MicroBench
+{
+    const gchar*    name;
+    void            (*run)(MicroState*);
+    gconstpointer*  arg;
+};
+
+static gchar* filter = nullptr;
+static gdouble min_time = 0.5;
+static gchar* json_file = nullptr;
+
+static GOptionEntry entries[] = {
+    { "filter", 0, 0, G_OPTION_ARG_STRING, &filter, "Only run the cases whose name contains TEXT", "TEXT" },
+    { "min-time", 0, 0, G_OPTION_ARG_DOUBLE, &min_time, "Time every case for at least SECONDS", "SECONDS" },
+    { "json", 0, 0, G_OPTION_ARG_FILENAME, &json_file, "Also write the results to FILE", "FILE" },
+    { nullptr }
+};
+
+/* Keeps the compiler from dropping the calls that are timed */
+static volatile gsize sink = 0;
+
+static gconstpointer short_path;
+static gconstpointer deep_path;
+static gconstpointer deep_messy_path;
+static gconstpointer unicode_path;
+static gconstpointer escaped_path;
+static gconstpointer sanitized_path;
+static gconstpointer sanitized_unicode_path;
+static gconstpointer sanitized_escaped_path;
+static gconstpointer path_line;
+static gconstpointer unicode_line;
+static gconstpointer escaped_line;
+static gconstpointer menu_option;
+static gconstpointer encoded_option;
+static gconstpointer menu;
+static gconstpointer submenu;
+static gconstpointer huge_menu;
+
+/* "Option N~Does thing N~verb-N" URL encoded, the way dropbox sends it */
+static gchar* make_option(int t_n, gboolean t_encode_all)
+{
+    gchar* name = g_strdup_printf("Option %d", t_n);
+    gchar* tooltip = g_strdup_printf("Does thing %d to «ünïcödé» files", t_n);
+    gchar* verb = g_strdup_printf("verb-%d", t_n);
+    const gchar* parts[] = { name, tooltip, verb };
+    GString* option = g_string_new(nullptr);
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (i > 0)
+        {
+            g_string_append_c(option, '~');
+        }
+
+        if (t_encode_all)
+        {
+            for (const gchar* c = parts[i]; *c != '\0'; c++)
+            {
+                g_string_append_printf(option, "%%%02X", (guchar) *c);
+            }
+        }
+        else
+        {
+            gchar* escaped = g_uri_escape_string(parts[i], nullptr, false);
+            g_string_append(option, escaped);
+            g_free(escaped);
+        }
+    }
+
+    g_free(verb);
+    g_free(tooltip);
+    g_free(name);
+
+    return g_string_free(option, false);
+}
+
+static gchar** make_menu(int t_items)
+{
+    gchar** options = g_new(gchar *, t_items + 1);
+
+    for (int i = 0; i < t_items; i++)
+    {
+        options[i] = make_option(i, false);
+    }
+
+    options[t_items] = nullptr;
+
+    return options;
+}
+
+/* One item whose inner part is a whole menu, dropbox nests the sharing options like this */
+static gchar** make_submenu(int t_items)
+{
+    gchar** items = make_menu(t_items);
+    gchar* joined = g_strjoinv("|", items);
+    gchar* inner = g_uri_escape_string(joined, nullptr, false);
+    gchar** options = g_new(gchar *, 2);
+
+    options[0] = g_strdup_printf("Share~%s~share", inner);
+    options[1] = nullptr;
+
+    g_free(inner);
+    g_free(joined);
+    g_strfreev(items);
+
+    return options;
+}
+
+static void make_inputs()
+{
+    GString* path = g_string_new("/home/user/Dropbox");
+    GString* messy = g_string_new("/home/user/Dropbox");
+    GString* escaped = g_string_new("/home/user/Dropbox/");
+    GString* line = g_string_new("options");
+
+    for (int i = 0; i < DEEP_PATH_COMPONENTS; i++)
+    {
+        g_string_append_printf(path, "/directory-%02d", i);
+        g_string_append_printf(messy, i % 8 == 7 ? "/./directory-%02d/../directory-%02d/" : "//directory-%02d", i, i);
+    }
+
+    g_string_append(path, "/notes.txt");
+    g_string_append(messy, "/notes.txt");
+
+    // Every character the protocol escapes, over and over
+    for (int i = 0; i < DEEP_PATH_COMPONENTS; i++)
+    {
+        g_string_append(escaped, "tab\there\\back\\slash\nnew line ");
+    }
+
+    short_path = "/home/user/Dropbox/Photos/2018/Holiday/IMG_0001.jpg";
+    deep_path = g_string_free(path, false);
+    deep_messy_path = g_string_free(messy, false);
+    unicode_path = "/home/user/Dropbox/Фотографии/日本語のフォルダ/Ünïcödé – ñame (copy) 🙂.txt";
+    escaped_path = g_string_free(escaped, false);
+    sanitized_path = dropbox_client_util_sanitize((const gchar *) short_path);
+    sanitized_unicode_path = dropbox_client_util_sanitize((const gchar *) unicode_path);
+    sanitized_escaped_path = dropbox_client_util_sanitize((const gchar *) escaped_path);
+
+    for (int i = 0; i < ESCAPED_VALUES; i++)
+    {
+        g_string_append_printf(line, "\t%s", (const gchar *) sanitized_escaped_path);
+    }
+
+    path_line = g_strdup_printf("path\t%s", (const gchar *) sanitized_path);
+    unicode_line = g_strdup_printf("path\t%s", (const gchar *) sanitized_unicode_path);
+    escaped_line = g_string_free(line, false);
+
+    menu_option = make_option(1, false);
+    encoded_option = make_option(1, true);
+    menu = make_menu(MENU_ITEMS);
+    submenu = make_submenu(MENU_ITEMS);
+    huge_menu = make_menu(HUGE_MENU_ITEMS);
+}
+
+static void bench_canonicalize(MicroState* t_state)
+{
+    const gchar* path = (const gchar *) t_state->arg;
+    gchar buffer[PATH_MAX];
+
+    for (guint64 i = 0; i < t_state->iterations; i++)
+    {
+        const gchar* result = dropbox_path_util_canonicalize(path, buffer, sizeof(buffer));
+        sink = sink + (result != nullptr ? result[0] : 0);
+    }
+
+    t_state->bytes = strlen(path);
+}
+
+static void bench_sanitize(MicroState* t_state)
+{
+    const gchar* s = (const gchar *) t_state->arg;
+
+    for (guint64 i = 0; i < t_state->iterations; i++)
+    {
+        gchar* result = dropbox_client_util_sanitize(s);
+        sink = sink + result[0];
+        g_free(result);
+    }
+
+    t_state->bytes = strlen(s);
+}
+
+static void bench_desanitize(MicroState* t_state)
+{
+    const gchar* s = (const gchar *) t_state->arg;
+
+    for (guint64 i = 0; i < t_state->iterations; i++)
+    {
+        gchar* result = dropbox_client_util_desanitize(s);
+        sink = sink + result[0];
+        g_free(result);
+    }
+
+    t_state->bytes = strlen(s);
+}
+
+/* The command thread parses every reply line into a fresh table */
+static void bench_parse_arg(MicroState* t_state)
+{
+    const gchar* line = (const gchar *) t_state->arg;
+    GHashTable* table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_strfreev);
+
+    for (guint64 i = 0; i < t_state->iterations; i++)
+    {
+        sink = sink + dropbox_client_util_command_parse_arg(line, table);
+        g_hash_table_remove_all(table);
+    }
+
+    g_hash_table_destroy(table);
+    t_state->bytes = strlen(line);
+}
+
+/* Decoding is in place, so every iteration starts from a fresh copy like the menu parser does */
+static void bench_url_decode(MicroState* t_state)
+{
+    const gchar* option = (const gchar *) t_state->arg;
+    gsize length = strlen(option) + 1;
+    gchar* buffer = g_new(gchar, length);
+
+    for (guint64 i = 0; i < t_state->iterations; i++)
+    {
+        memcpy(buffer, option, length);
+        sink = sink + dropbox_client_util_url_decode_in_place(buffer)[0];
+    }
+
+    g_free(buffer);
+    t_state->bytes = length - 1;
+}
+
+static void bench_parse_menu(MicroState* t_state)
+{
+    gchar** options = (gchar **) t_state->arg;
+    DropboxSelection* selection = dropbox_selection_new(nullptr);
+    int items = 0;
+
+    for (guint64 i = 0; i < t_state->iterations; i++)
+    {
+        NautilusMenu* root = nautilus_menu_new();
+
+        items = nautilus_dropbox_parse_menu(options, root, nullptr, nullptr, selection);
+        g_object_unref(root);
+    }
+
+    dropbox_selection_unref(selection);
+    t_state->items = items;
+}
+
+static const MicroBench benches[] = {
+    { "canonicalize/short", bench_canonicalize, &short_path },
+    { "canonicalize/deep", bench_canonicalize, &deep_path },
+    { "canonicalize/deep_messy", bench_canonicalize, &deep_messy_path },
+    { "canonicalize/unicode", bench_canonicalize, &unicode_path },
+    { "sanitize/short", bench_sanitize, &short_path },
+    { "sanitize/unicode", bench_sanitize, &unicode_path },
+    { "sanitize/escaping", bench_sanitize, &escaped_path },
+    { "desanitize/short", bench_desanitize, &sanitized_path },
+    { "desanitize/unicode", bench_desanitize, &sanitized_unicode_path },
+    { "desanitize/escaping", bench_desanitize, &sanitized_escaped_path },
+    { "command_parse_arg/path", bench_parse_arg, &path_line },
+    { "command_parse_arg/unicode", bench_parse_arg, &unicode_line },
+    { "command_parse_arg/escaping", bench_parse_arg, &escaped_line },
+    { "url_decode/option", bench_url_decode, &menu_option },
+    { "url_decode/all_encoded", bench_url_decode, &encoded_option },
+    { "parse_menu/8", bench_parse_menu, &menu },
+    { "parse_menu/submenu", bench_parse_menu, &submenu },
+    { "parse_menu/5k", bench_parse_menu, &huge_menu },
+};
+
+static gdouble run(const MicroBench* t_bench, MicroState* t_state)
+{
+    t_state->arg = *(t_bench->arg);
+    t_state->items = 1;
+    t_state->bytes = 0;
+
+    gint64 start = g_get_monotonic_time();
+    t_bench->run(t_state);
+
+    return (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+}
+
+/* Grows the iteration count until a run is long enough to time, then does the real run */
+static gdouble measure(const MicroBench* t_bench, MicroState* t_state)
+{
+    gdouble seconds;
+
+    t_state->iterations = 1;
+
+    while ((seconds = run(t_bench, t_state)) < min_time * CALIBRATE_FRACTION && t_state->iterations < MAX_ITERATIONS)
+    {
+        t_state->iterations *= 10;
+    }
+
+    if (seconds < min_time)
+    {
+        t_state->iterations = MIN(MAX_ITERATIONS, (guint64) (t_state->iterations * min_time * 1.2 / MAX(seconds, 1e-9)));
+        seconds = run(t_bench, t_state);
+    }
+
+    return seconds;
+}
+
+int main(int argc, char** argv)
+{
+    GError* error = nullptr;
+    GOptionContext* context = g_option_context_new("- time the per file and per menu item helpers");
+    gboolean failed = false;
+
+    g_option_context_add_main_entries(context, entries, nullptr);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    // The parser would otherwise append every item to the list handed to nautilus
+    dropbox_use_nautilus_submenu_workaround = false;
+
+    make_inputs();
+
+    GString* json = g_string_new("{");
+
+    g_print("%-28s %12s %12s %14s %10s\n", "case", "iterations", "ns/op", "items/s", "MB/s");
+
+    for (const MicroBench& bench : benches)
+    {
+        if (filter != nullptr && strstr(bench.name, filter) == nullptr)
+        {
+            continue;
+        }
+
+        MicroState state;
+        gdouble seconds = measure(&bench, &state);
+        gdouble ns = seconds * 1e9 / state.iterations;
+        gdouble items_per_second = state.items * state.iterations / seconds;
+        gdouble mb_per_second = state.bytes * state.iterations / seconds / (1024 * 1024);
+
+        g_print("%-28s %12" G_GUINT64_FORMAT " %12.1f %14.0f %10.1f\n", bench.name, state.iterations, ns, items_per_second, mb_per_second);
+
+        g_string_append_printf(json,
+            "%s\n    \"%s\": {\"iterations\": %" G_GUINT64_FORMAT ", \"ns_per_op\": %.2f, "
+            "\"items_per_sec\": %.1f, \"bytes_per_sec\": %.1f}",
+            json->len > 1 ? "," : "", bench.name, state.iterations, ns, items_per_second, mb_per_second * 1024 * 1024);
+    }
+
+    g_string_append(json, "\n}\n");
+
+    if (json_file != nullptr && !g_file_set_contents(json_file, json->str, json->len, &error))
+    {
+        g_printerr("%s\n", error->message);
+        failed = true;
+    }
+
+    g_string_free(json, true);
+    g_option_context_free(context);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,518 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstring>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "bench-util.h"
+#include "dropbox-client-util.h"
+#include "mock-daemon.h"
+
+struct MockConnection
+{
+    MockDaemon*     daemon;
+    int             sock;
+    guint32         seed;
+};
+
+void mock_daemon_options_init(MockDaemonOptions* t_options)
+{
+    t_options->latency_usec = 0;
+    t_options->jitter_usec = 0;
+    t_options->error_rate = 0;
+    t_options->disconnect_rate = 0;
+    t_options->emblems = false;
+    t_options->menu_items = 8;
+    t_options->malformed_menu = false;
+    t_options->seed = 1;
+}
+
+static void append_values(GString* t_out, const gchar* t_key, const gchar* const* t_values)
+{
+    gchar* key = dropbox_client_util_sanitize(t_key);
+
+    g_string_append(t_out, key);
+    g_free(key);
+
+    for (gint i = 0; t_values[i] != nullptr; i++)
+    {
+        gchar* value = dropbox_client_util_sanitize(t_values[i]);
+
+        g_string_append_c(t_out, '\t');
+        g_string_append(t_out, value);
+        g_free(value);
+    }
+
+    g_string_append_c(t_out, '\n');
+}
+
+static void append_value(GString* t_out, const gchar* t_key, const gchar* t_value)
+{
+    const gchar* values[] = { t_value, nullptr };
+
+    append_values(t_out, t_key, values);
+}
+
+static const gchar* path_arg(GHashTable* t_args, const gchar* t_key)
+{
+    gchar** values = (gchar **) g_hash_table_lookup(t_args, t_key);
+
+    return values != nullptr && values[0] != nullptr ? values[0] : "/";
+}
+
+/* Most files are up to date, a few are syncing and fewer still can't be synced */
+static const gchar* file_status(const gchar* t_path)
+{
+    guint hash = g_str_hash(t_path);
+
+    if (hash % 64 == 0)
+    {
+        return "unsyncable";
+    }
+
+    return hash % 16 == 1 ? "syncing" : "up to date";
+}
+
+static const gchar* folder_tag(const gchar* t_path)
+{
+    static const gchar* tags[] = { "shared", "public", "photos" };
+    guint kind = (g_str_hash(t_path) / 64) % 16;
+
+    return kind < G_N_ELEMENTS(tags) ? tags[kind] : "";
+}
+
+/* Writes the answer to a request into t_out the way dropbox would */
+static void respond(MockDaemon* t_daemon, const gchar* t_command, GHashTable* t_args, GString* t_out)
+{
+    if (strcmp(t_command, "get_emblems") == 0 && !t_daemon->options.emblems)
+    {
+        // Like older versions of dropbox, which makes the client ask for status and tag
+        g_string_append(t_out, "notok\ndone\n");
+        return;
+    }
+
+    g_string_append(t_out, "ok\n");
+
+    if (strcmp(t_command, "get_emblems") == 0)
+    {
+        const gchar* status = file_status(path_arg(t_args, "path"));
+
+        append_value(t_out, "emblems", strcmp(status, "up to date") == 0 ? "dropbox-uptodate" : strcmp(status, "syncing") == 0 ? "dropbox-syncing" : "dropbox-unsyncable");
+    }
+    else if (strcmp(t_command, "icon_overlay_file_status") == 0)
+    {
+        append_value(t_out, "status", file_status(path_arg(t_args, "path")));
+    }
+    else if (strcmp(t_command, "get_folder_tag") == 0)
+    {
+        append_value(t_out, "tag", folder_tag(path_arg(t_args, "path")));
+    }
+    else if (strcmp(t_command, "icon_overlay_context_options") == 0)
+    {
+        gchar** options = g_new(gchar *, t_daemon->options.menu_items + 1);
+
+        // URL encoded "name~tooltip~verb", like the real thing, or without the separators
+        for (guint i = 0; i < t_daemon->options.menu_items; i++)
+        {
+            if (g_atomic_int_get(&(t_daemon->options.malformed_menu)))
+            {
+                options[i] = g_strdup_printf("Option%%20%u%%20without%%20a%%20verb", i);
+            }
+            else
+            {
+                options[i] = g_strdup_printf("Option%%20%u~Does%%20thing%%20%u~verb-%u", i, i, i);
+            }
+        }
+
+        options[t_daemon->options.menu_items] = nullptr;
+        append_values(t_out, "options", options);
+        g_strfreev(options);
+    }
+    else if (strcmp(t_command, "get_emblem_paths") == 0)
+    {
+        gchar* path = g_build_filename(t_daemon->dropbox_dir, "emblems", nullptr);
+
+        append_value(t_out, "path", path);
+        g_free(path);
+    }
+
+    g_string_append(t_out, "done\n");
+}
+
+/*
+ * Parses the request at the start of t_pending and answers it.
+ *
+ * Returns:
+ * false if the connection should be dropped.
+ */
+static gboolean handle_request(MockConnection* t_connection, GRand* t_rand, GString* t_pending, gsize t_length)
+{
+    MockDaemon* daemon = t_connection->daemon;
+    const MockDaemonOptions* options = &(daemon->options);
+    gchar* request = g_strndup(t_pending->str, t_length);
+    gchar** lines = g_strsplit(request, "\n", 0);
+    GHashTable* args = g_hash_table_new_full((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal, (GDestroyNotify) g_free, (GDestroyNotify) g_strfreev);
+    gchar* command = dropbox_client_util_desanitize(lines[0]);
+    GString* response = g_string_new(nullptr);
+    gboolean keep = true;
+
+    g_free(request);
+
+    // Everything between the command and "done"
+    for (gint i = 1; lines[i] != nullptr && strcmp(lines[i], "done") != 0; i++)
+    {
+        dropbox_client_util_command_parse_arg(lines[i], args);
+    }
+
+    g_atomic_int_inc(&(daemon->requests));
+
+    if (g_rand_double(t_rand) < options->disconnect_rate)
+    {
+        g_atomic_int_inc(&(daemon->disconnects));
+        keep = false;
+    }
+    else
+    {
+        gint64 latency = options->latency_usec;
+
+        if (options->jitter_usec > 0)
+        {
+            latency += g_rand_int_range(t_rand, 0, (gint32) MIN(options->jitter_usec + 1, G_MAXINT32));
+        }
+
+        if (latency > 0)
+        {
+            g_usleep(latency);
+        }
+
+        if (g_rand_double(t_rand) < options->error_rate)
+        {
+            g_atomic_int_inc(&(daemon->errors));
+            g_string_append(response, "notok\ndone\n");
+        }
+        else
+        {
+            respond(daemon, command, args, response);
+        }
+
+        keep = bench_write_all(t_connection->sock, response->str, response->len);
+    }
+
+    g_string_free(response, true);
+    g_free(command);
+    g_hash_table_unref(args);
+    g_strfreev(lines);
+
+    return keep;
+}
+
+static gpointer serve_command_connection(MockConnection* t_connection)
+{
+    MockDaemon* daemon = t_connection->daemon;
+    GRand* rand = g_rand_new_with_seed(t_connection->seed);
+    GString* pending = g_string_new(nullptr);
+    gchar buf[4096];
+
+    while (true)
+    {
+        gsize length = bench_message_length(pending);
+
+        if (length == 0)
+        {
+            ssize_t n = read(t_connection->sock, buf, sizeof(buf));
+
+            if (n <= 0)
+            {
+                break;
+            }
+
+            g_string_append_len(pending, buf, n);
+            continue;
+        }
+
+        if (!handle_request(t_connection, rand, pending, length))
+        {
+            break;
+        }
+
+        g_string_erase(pending, 0, length);
+    }
+
+    g_mutex_lock(&(daemon->mutex));
+    daemon->command_socks = g_slist_remove(daemon->command_socks, GINT_TO_POINTER(t_connection->sock));
+    g_mutex_unlock(&(daemon->mutex));
+
+    close(t_connection->sock);
+
+    g_string_free(pending, true);
+    g_rand_free(rand);
+    g_free(t_connection);
+
+    return nullptr;
+}
+
+static gpointer accept_command_connections(MockDaemon* t_daemon)
+{
+    guint32 connections = 0;
+
+    while (!g_atomic_int_get(&(t_daemon->stopping)))
+    {
+        int sock = accept(t_daemon->command_listener, nullptr, nullptr);
+
+        if (sock < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        MockConnection* connection = g_new(MockConnection, 1);
+
+        connection->daemon = t_daemon;
+        connection->sock = sock;
+        connection->seed = t_daemon->options.seed + connections++;
+
+        g_mutex_lock(&(t_daemon->mutex));
+        t_daemon->command_socks = g_slist_prepend(t_daemon->command_socks, GINT_TO_POINTER(sock));
+        t_daemon->command_threads = g_slist_prepend(t_daemon->command_threads, g_thread_new("mock-command", (GThreadFunc) serve_command_connection, connection));
+        g_mutex_unlock(&(t_daemon->mutex));
+    }
+
+    return nullptr;
+}
+
+/* The client never writes to the hook socket, so all this does is keep the latest connection */
+static gpointer accept_hook_connections(MockDaemon* t_daemon)
+{
+    while (!g_atomic_int_get(&(t_daemon->stopping)))
+    {
+        int sock = accept(t_daemon->hook_listener, nullptr, nullptr);
+
+        if (sock < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        g_mutex_lock(&(t_daemon->mutex));
+
+        if (t_daemon->hook_sock >= 0)
+        {
+            close(t_daemon->hook_sock);
+        }
+
+        t_daemon->hook_sock = sock;
+        g_mutex_unlock(&(t_daemon->mutex));
+    }
+
+    return nullptr;
+}
+
+/*
+ * Starts serving under t_home/.dropbox, creating it if needed.
+ *
+ * Returns:
+ * nullptr if the sockets couldn't be created.
+ */
+MockDaemon* mock_daemon_new(const gchar* t_home, const MockDaemonOptions* t_options, GError** t_err)
+{
+    MockDaemon* daemon = g_new0(MockDaemon, 1);
+
+    daemon->options = *t_options;
+    daemon->root = g_build_filename(t_home, "Dropbox", nullptr);
+    daemon->dropbox_dir = g_build_filename(t_home, ".dropbox", nullptr);
+    daemon->command_path = g_build_filename(daemon->dropbox_dir, "command_socket", nullptr);
+    daemon->hook_path = g_build_filename(daemon->dropbox_dir, "iface_socket", nullptr);
+    daemon->hook_sock = -1;
+
+    g_mutex_init(&(daemon->mutex));
+    g_mkdir_with_parents(daemon->dropbox_dir, 0700);
+    g_mkdir_with_parents(daemon->root, 0700);
+
+    gchar* info = g_build_filename(daemon->dropbox_dir, "info.json", nullptr);
+    gchar* root = g_strescape(daemon->root, nullptr);
+    gchar* contents = g_strdup_printf("{\"personal\": {\"path\": \"%s\", \"host\": 1}}", root);
+
+    g_file_set_contents(info, contents, -1, nullptr);
+
+    g_free(contents);
+    g_free(root);
+    g_free(info);
+
+    // Left behind by a daemon that didn't get to clean up
+    g_unlink(daemon->command_path);
+    g_unlink(daemon->hook_path);
+
+    daemon->command_listener = bench_listen_unix(daemon->command_path);
+    daemon->hook_listener = bench_listen_unix(daemon->hook_path);
+
+    if (daemon->command_listener < 0 || daemon->hook_listener < 0)
+    {
+        g_set_error(t_err, g_quark_from_static_string("mock daemon"), 0, "couldn't listen under %s: %s", daemon->dropbox_dir, g_strerror(errno));
+        mock_daemon_free(daemon);
+
+        return nullptr;
+    }
+
+    daemon->command_acceptor = g_thread_new("mock-accept-command", (GThreadFunc) accept_command_connections, daemon);
+    daemon->hook_acceptor = g_thread_new("mock-accept-hook", (GThreadFunc) accept_hook_connections, daemon);
+
+    return daemon;
+}
+
+/* Stops serving and removes the sockets */
+void mock_daemon_free(MockDaemon* t_daemon)
+{
+    g_atomic_int_set(&(t_daemon->stopping), true);
+
+    // Wakes up the threads blocked in accept
+    if (t_daemon->command_acceptor != nullptr)
+    {
+        shutdown(t_daemon->command_listener, SHUT_RDWR);
+        shutdown(t_daemon->hook_listener, SHUT_RDWR);
+
+        g_thread_join(t_daemon->command_acceptor);
+        g_thread_join(t_daemon->hook_acceptor);
+    }
+
+    mock_daemon_disconnect(t_daemon);
+    g_slist_free_full(t_daemon->command_threads, (GDestroyNotify) g_thread_join);
+
+    if (t_daemon->command_listener >= 0)
+    {
+        close(t_daemon->command_listener);
+    }
+
+    if (t_daemon->hook_listener >= 0)
+    {
+        close(t_daemon->hook_listener);
+    }
+
+    g_unlink(t_daemon->command_path);
+    g_unlink(t_daemon->hook_path);
+
+    g_mutex_clear(&(t_daemon->mutex));
+    g_free(t_daemon->command_path);
+    g_free(t_daemon->hook_path);
+    g_free(t_daemon->dropbox_dir);
+    g_free(t_daemon->root);
+    g_free(t_daemon);
+}
+
+/*
+ * Tells the client t_path changed.
+ *
+ * Returns:
+ * false if no client was listening.
+ *
+ * @note This function is threadsafe
+ */
+gboolean mock_daemon_shell_touch(MockDaemon* t_daemon, const gchar* t_path)
+{
+    GString* message = g_string_new("shell_touch\n");
+    gboolean sent = false;
+
+    append_value(message, "path", t_path);
+    g_string_append(message, "done\n");
+
+    g_mutex_lock(&(t_daemon->mutex));
+
+    if (t_daemon->hook_sock >= 0)
+    {
+        sent = bench_write_all(t_daemon->hook_sock, message->str, message->len);
+
+        if (!sent)
+        {
+            close(t_daemon->hook_sock);
+            t_daemon->hook_sock = -1;
+        }
+    }
+
+    g_mutex_unlock(&(t_daemon->mutex));
+    g_string_free(message, true);
+
+    if (sent)
+    {
+        g_atomic_int_inc(&(t_daemon->touches));
+    }
+
+    return sent;
+}
+
+/*
+ * Sends t_count touches as fast as the client takes them, going round the
+ * nullptr terminated t_paths. This blocks once the socket fills up, so don't
+ * call it on the thread that runs the client's main loop.
+ *
+ * Returns:
+ * How many were sent.
+ *
+ * @note This function is threadsafe
+ */
+guint mock_daemon_shell_touch_storm(MockDaemon* t_daemon, const gchar* const* t_paths, guint t_count)
+{
+    guint paths = g_strv_length((gchar **) t_paths);
+    guint sent = 0;
+
+    while (paths > 0 && sent < t_count && mock_daemon_shell_touch(t_daemon, t_paths[sent % paths]))
+    {
+        sent++;
+    }
+
+    return sent;
+}
+
+/*
+ * Drops every connection, as if dropbox restarted. The client is let back
+ * in when it reconnects.
+ *
+ * @note This function is threadsafe
+ */
+void mock_daemon_disconnect(MockDaemon* t_daemon)
+{
+    g_mutex_lock(&(t_daemon->mutex));
+
+    // Their threads close them
+    for (GSList* l = t_daemon->command_socks; l != nullptr; l = l->next)
+    {
+        shutdown(GPOINTER_TO_INT(l->data), SHUT_RDWR);
+    }
+
+    if (t_daemon->hook_sock >= 0)
+    {
+        close(t_daemon->hook_sock);
+        t_daemon->hook_sock = -1;
+    }
+
+    g_mutex_unlock(&(t_daemon->mutex));
+}
@@ -0,0 +1,83 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MOCK_DAEMON_H
+#define MOCK_DAEMON_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Stands in for dropbox on command_socket and iface_socket under a fake
+ * HOME, so the client can be run and measured without an account.
+ *
+ * The answers depend on nothing but the path, so repeat visits see the same
+ * emblems. Every connection is served by its own thread. Like dropbox it
+ * writes info.json, pointing the client at t_home/Dropbox.
+ */
+struct MockDaemonOptions
+{
+    gint64      latency_usec;
+    gint64      jitter_usec;
+    gdouble     error_rate;
+    gdouble     disconnect_rate;
+    gboolean    emblems;
+    guint       menu_items;
+    gboolean    malformed_menu;
+    guint32     seed;
+};
+
+struct MockDaemon
+{
+    MockDaemonOptions   options;
+    gchar*              root;
+    gchar*              dropbox_dir;
+    gchar*              command_path;
+    gchar*              hook_path;
+    int                 command_listener;
+    int                 hook_listener;
+
+    GMutex              mutex;
+    GSList*             command_socks;
+    int                 hook_sock;
+    gint                stopping;
+    GThread*            command_acceptor;
+    GThread*            hook_acceptor;
+    GSList*             command_threads;
+
+    gint                requests;
+    gint                errors;
+    gint                disconnects;
+    gint                touches;
+};
+
+void mock_daemon_options_init(MockDaemonOptions* t_options);
+
+MockDaemon* mock_daemon_new(const gchar* t_home, const MockDaemonOptions* t_options, GError** t_err);
+void mock_daemon_free(MockDaemon* t_daemon);
+
+gboolean mock_daemon_shell_touch(MockDaemon* t_daemon, const gchar* t_path);
+guint mock_daemon_shell_touch_storm(MockDaemon* t_daemon, const gchar* const* t_paths, guint t_count);
+void mock_daemon_disconnect(MockDaemon* t_daemon);
+
+G_END_DECLS
+
+#endif
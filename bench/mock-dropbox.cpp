@@ -0,0 +1,139 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <signal.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "mock-daemon.h"
+
+/*
+ * Runs the mock daemon on its own, for trying the extension or the benches
+ * against it. Start nautilus with the printed HOME to use it.
+ */
+
+static gchar* home = nullptr;
+static gchar* storm_dir = nullptr;
+static gint storm_count = 0;
+static gint storm_interval = 10;
+static MockDaemonOptions options;
+
+static GOptionEntry entries[] = {
+    { "home", 0, 0, G_OPTION_ARG_FILENAME, &home, "Serve under DIR/.dropbox instead of a new temporary directory", "DIR" },
+    { "latency", 0, 0, G_OPTION_ARG_INT64, &(options.latency_usec), "Wait USEC before every answer", "USEC" },
+    { "jitter", 0, 0, G_OPTION_ARG_INT64, &(options.jitter_usec), "Wait up to USEC more, at random", "USEC" },
+    { "error-rate", 0, 0, G_OPTION_ARG_DOUBLE, &(options.error_rate), "Fail this fraction of the requests", "RATE" },
+    { "disconnect-rate", 0, 0, G_OPTION_ARG_DOUBLE, &(options.disconnect_rate), "Hang up instead of answering this fraction of the requests", "RATE" },
+    { "emblems", 0, 0, G_OPTION_ARG_NONE, &(options.emblems), "Answer get_emblems, like newer versions of dropbox", nullptr },
+    { "menu-items", 0, 0, G_OPTION_ARG_INT, &(options.menu_items), "Offer N context menu options", "N" },
+    { "malformed-menu", 0, 0, G_OPTION_ARG_NONE, &(options.malformed_menu), "Offer context menu options that don't parse", nullptr },
+    { "seed", 0, 0, G_OPTION_ARG_INT, &(options.seed), "Seed for the injected errors", "N" },
+    { "storm", 0, 0, G_OPTION_ARG_INT, &storm_count, "Send N shell_touch events at a time", "N" },
+    { "storm-interval", 0, 0, G_OPTION_ARG_INT, &storm_interval, "Seconds between storms", "SECONDS" },
+    { "storm-dir", 0, 0, G_OPTION_ARG_FILENAME, &storm_dir, "Touch the files in DIR, HOME by default", "DIR" },
+    { nullptr }
+};
+
+static gboolean storm(MockDaemon* t_daemon)
+{
+    GPtrArray* paths = g_ptr_array_new_with_free_func(g_free);
+    GDir* dir = g_dir_open(storm_dir != nullptr ? storm_dir : home, 0, nullptr);
+    const gchar* name;
+
+    while (dir != nullptr && (name = g_dir_read_name(dir)) != nullptr)
+    {
+        g_ptr_array_add(paths, g_build_filename(storm_dir != nullptr ? storm_dir : home, name, nullptr));
+    }
+
+    g_ptr_array_add(paths, nullptr);
+
+    guint sent = mock_daemon_shell_touch_storm(t_daemon, (const gchar* const*) paths->pdata, storm_count);
+    g_print("sent %u shell_touch events\n", sent);
+
+    if (dir != nullptr)
+    {
+        g_dir_close(dir);
+    }
+
+    g_ptr_array_free(paths, true);
+
+    return true;
+}
+
+static gboolean quit(GMainLoop* t_loop)
+{
+    g_main_loop_quit(t_loop);
+
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    GError* error = nullptr;
+    GOptionContext* context = g_option_context_new("- stand in for the dropbox daemon");
+
+    mock_daemon_options_init(&options);
+    g_option_context_add_main_entries(context, entries, nullptr);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    if (home == nullptr && (home = g_dir_make_tmp("dna-mock-XXXXXX", &error)) == nullptr)
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    MockDaemon* daemon = mock_daemon_new(home, &options, &error);
+
+    if (daemon == nullptr)
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    g_print("serving on HOME=%s\n", home);
+
+    GMainLoop* loop = g_main_loop_new(nullptr, false);
+
+    if (storm_count > 0)
+    {
+        g_timeout_add_seconds(MAX(storm_interval, 1), (GSourceFunc) storm, daemon);
+    }
+
+    g_unix_signal_add(SIGINT, (GSourceFunc) quit, loop);
+    g_unix_signal_add(SIGTERM, (GSourceFunc) quit, loop);
+
+    g_main_loop_run(loop);
+
+    g_print("%d requests, %d errors, %d disconnects, %d shell touches\n",
+        g_atomic_int_get(&(daemon->requests)), g_atomic_int_get(&(daemon->errors)),
+        g_atomic_int_get(&(daemon->disconnects)), g_atomic_int_get(&(daemon->touches)));
+
+    mock_daemon_free(daemon);
+    g_main_loop_unref(loop);
+    g_option_context_free(context);
+
+    return 0;
+}
@@ -0,0 +1,283 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "dropbox-path-index.h"
+
+/*
+ * Checks of the path index on its own. The index only keeps qdata on the
+ * file objects, so plain GObjects stand in for nautilus' files.
+ */
+
+static NautilusFileInfo* file_new()
+{
+    return (NautilusFileInfo *) g_object_new(G_TYPE_OBJECT, nullptr);
+}
+
+/* How many children the node at t_path has, -1 if there is no such node */
+static gint children_of(DropboxPathIndex* t_index, const gchar* t_path)
+{
+    DropboxPathNode* node = &(t_index->root);
+    gchar** components = g_strsplit(t_path, "/", -1);
+
+    for (gchar** component = components; *component != nullptr && node != nullptr; component++)
+    {
+        if (**component != '\0')
+        {
+            node = node->children != nullptr ? (DropboxPathNode *) g_hash_table_lookup(node->children, *component) : nullptr;
+        }
+    }
+
+    g_strfreev(components);
+
+    if (node == nullptr)
+    {
+        return -1;
+    }
+
+    return node->children != nullptr ? (gint) g_hash_table_size(node->children) : 0;
+}
+
+static void test_insert()
+{
+    DropboxPathIndex index;
+    NautilusFileInfo* first = file_new();
+    NautilusFileInfo* second = file_new();
+
+    dropbox_path_index_init(&index);
+
+    g_assert(dropbox_path_index_insert(&index, "/home/user/Dropbox/a.txt", first) == nullptr);
+    g_assert(dropbox_path_index_insert(&index, "/home/user/Dropbox/b.txt", second) == nullptr);
+
+    g_assert_cmpuint(index.size, ==, 2);
+    g_assert(dropbox_path_index_lookup(&index, "/home/user/Dropbox/a.txt") == first);
+    g_assert(dropbox_path_index_lookup(&index, "/home/user/Dropbox/b.txt") == second);
+    g_assert(dropbox_path_index_contains(&index, first));
+
+    // Directories are only nodes on the way, they hold no file
+    g_assert(dropbox_path_index_lookup(&index, "/home/user/Dropbox") == nullptr);
+    g_assert(dropbox_path_index_lookup(&index, "/home/user/Dropbox/c.txt") == nullptr);
+    g_assert_cmpint(children_of(&index, "/home/user/Dropbox"), ==, 2);
+
+    // Inserting the same file at the same path again changes nothing
+    g_assert(dropbox_path_index_insert(&index, "/home/user/Dropbox/a.txt", first) == nullptr);
+    g_assert_cmpuint(index.size, ==, 2);
+
+    g_object_unref(first);
+    g_object_unref(second);
+}
+
+static void test_rename()
+{
+    DropboxPathIndex index;
+    NautilusFileInfo* file = file_new();
+
+    dropbox_path_index_init(&index);
+
+    dropbox_path_index_insert(&index, "/home/user/Dropbox/old/deep/a.txt", file);
+    dropbox_path_index_insert(&index, "/home/user/Dropbox/new/a.txt", file);
+
+    g_assert_cmpuint(index.size, ==, 1);
+    g_assert(dropbox_path_index_lookup(&index, "/home/user/Dropbox/old/deep/a.txt") == nullptr);
+    g_assert(dropbox_path_index_lookup(&index, "/home/user/Dropbox/new/a.txt") == file);
+    g_assert(dropbox_path_index_has_path(&index, file, "/home/user/Dropbox/new/a.txt"));
+
+    // The branch of the old path went with it
+    g_assert_cmpint(children_of(&index, "/home/user/Dropbox/old"), ==, -1);
+    g_assert_cmpint(children_of(&index, "/home/user/Dropbox"), ==, 1);
+
+    // Renaming into a directory of the old path must not prune the new node
+    dropbox_path_index_insert(&index, "/home/user/Dropbox/new", file);
+    g_assert(dropbox_path_index_lookup(&index, "/home/user/Dropbox/new") == file);
+    g_assert_cmpint(children_of(&index, "/home/user/Dropbox/new"), ==, 0);
+
+    g_object_unref(file);
+}
+
+static void test_evict()
+{
+    DropboxPathIndex index;
+    NautilusFileInfo* stale = file_new();
+    NautilusFileInfo* fresh = file_new();
+
+    dropbox_path_index_init(&index);
+
+    dropbox_path_index_insert(&index, "/home/user/Dropbox/a.txt", stale);
+
+    // Nautilus made a new object for the same file
+    g_assert(dropbox_path_index_insert(&index, "/home/user/Dropbox/a.txt", fresh) == stale);
+    g_assert_cmpuint(index.size, ==, 1);
+    g_assert(!dropbox_path_index_contains(&index, stale));
+    g_assert(dropbox_path_index_lookup(&index, "/home/user/Dropbox/a.txt") == fresh);
+
+    // The stale object no longer answers for the path, or gets it pruned when it dies
+    g_assert(!dropbox_path_index_has_path(&index, stale, "/home/user/Dropbox/a.txt"));
+    g_assert(dropbox_path_index_has_path(&index, fresh, "/home/user/Dropbox/a.txt"));
+
+    g_object_unref(stale);
+    g_assert(dropbox_path_index_lookup(&index, "/home/user/Dropbox/a.txt") == fresh);
+
+    // Once the file moves on, its old path is no longer its own
+    dropbox_path_index_insert(&index, "/home/user/Dropbox/b.txt", fresh);
+    g_assert(!dropbox_path_index_has_path(&index, fresh, "/home/user/Dropbox/a.txt"));
+
+    g_object_unref(fresh);
+}
+
+static void test_touch()
+{
+    DropboxPathIndex index;
+    NautilusFileInfo* files[3];
+
+    dropbox_path_index_init(&index);
+
+    for (int i = 0; i < 3; i++)
+    {
+        gchar* path = g_strdup_printf("/home/user/Dropbox/%d", i);
+
+        files[i] = file_new();
+        dropbox_path_index_insert(&index, path, files[i]);
+        g_free(path);
+    }
+
+    g_assert(index.newest->file == files[2]);
+    g_assert(index.oldest->file == files[0]);
+    g_assert(!dropbox_path_index_is_recent(&index, files[0], 2));
+
+    dropbox_path_index_touch(&index, files[0]);
+
+    g_assert(index.newest->file == files[0]);
+    g_assert(index.oldest->file == files[1]);
+    g_assert(dropbox_path_index_is_recent(&index, files[0], 1));
+    g_assert(!dropbox_path_index_is_recent(&index, files[1], 2));
+
+    // Touching the newest file keeps the list intact
+    dropbox_path_index_touch(&index, files[0]);
+    g_assert(index.newest->file == files[0]);
+    g_assert(index.newest->older->file == files[2]);
+    g_assert(index.oldest->newer->file == files[2]);
+
+    for (int i = 0; i < 3; i++)
+    {
+        g_object_unref(files[i]);
+    }
+}
+
+static void test_prune_on_death()
+{
+    DropboxPathIndex index;
+    NautilusFileInfo* deep = file_new();
+    NautilusFileInfo* sibling = file_new();
+
+    dropbox_path_index_init(&index);
+
+    dropbox_path_index_insert(&index, "/home/user/Dropbox/a/b/c.txt", deep);
+    dropbox_path_index_insert(&index, "/home/user/Dropbox/a/d.txt", sibling);
+
+    // Finalizing a file goes through when_file_dies
+    g_object_unref(deep);
+
+    g_assert_cmpuint(index.size, ==, 1);
+    g_assert_cmpint(children_of(&index, "/home/user/Dropbox/a/b"), ==, -1);
+    g_assert_cmpint(children_of(&index, "/home/user/Dropbox/a"), ==, 1);
+    g_assert(index.newest->file == sibling && index.oldest->file == sibling);
+
+    g_object_unref(sibling);
+
+    g_assert_cmpuint(index.size, ==, 0);
+    g_assert(index.root.children == nullptr);
+    g_assert(index.newest == nullptr && index.oldest == nullptr);
+}
+
+static void test_walk_while_unlinking()
+{
+    DropboxPathIndex index;
+    DropboxPathIndexWalk walk;
+    NautilusFileInfo* files[6];
+    NautilusFileInfo* file;
+    GPtrArray* seen = g_ptr_array_new();
+
+    dropbox_path_index_init(&index);
+
+    for (int i = 0; i < 6; i++)
+    {
+        gchar* path = g_strdup_printf("/home/user/Dropbox/dir-%d/file", i);
+
+        files[i] = file_new();
+        dropbox_path_index_insert(&index, path, files[i]);
+        g_free(path);
+    }
+
+    dropbox_path_index_walk_start(&index, &walk);
+
+    g_assert(dropbox_path_index_walk_next(&index, &walk) == files[5]);
+
+    // The file the walk was about to visit dies, and so does the one after it
+    g_object_unref(files[4]);
+    files[4] = nullptr;
+    dropbox_path_index_remove(&index, files[3]);
+
+    while ((file = dropbox_path_index_walk_next(&index, &walk)) != nullptr)
+    {
+        g_ptr_array_add(seen, file);
+
+        // Removing the current file in the middle of a step is fine too
+        if (file == files[2])
+        {
+            g_object_unref(files[2]);
+            files[2] = nullptr;
+        }
+    }
+
+    g_assert_cmpuint(seen->len, ==, 3);
+    g_assert(g_ptr_array_index(seen, 1) == files[1]);
+    g_assert(g_ptr_array_index(seen, 2) == files[0]);
+
+    // A finished walk stops itself
+    g_assert(index.walks == nullptr);
+    g_assert_cmpuint(index.size, ==, 3);
+
+    for (int i = 0; i < 6; i++)
+    {
+        if (files[i] != nullptr)
+        {
+            g_object_unref(files[i]);
+        }
+    }
+
+    g_assert(index.root.children == nullptr);
+    g_ptr_array_free(seen, true);
+}
+
+int main(int argc, char** argv)
+{
+    g_test_init(&argc, &argv, nullptr);
+
+    g_test_add_func("/path-index/insert", test_insert);
+    g_test_add_func("/path-index/rename", test_rename);
+    g_test_add_func("/path-index/evict", test_evict);
+    g_test_add_func("/path-index/touch", test_touch);
+    g_test_add_func("/path-index/prune-on-death", test_prune_on_death);
+    g_test_add_func("/path-index/walk-while-unlinking", test_walk_while_unlinking);
+
+    return g_test_run();
+}
@@ -0,0 +1,667 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/*
+ * Compares the JSON results of the bench suites with stored baselines and
+ * fails if throughput dropped, tail latency grew or memory use grew by
+ * more than the thresholds.
+ *
+ * Usage: perf-gate [--update] [thresholds] BASELINE_DIR RESULTS_DIR
+ *
+ * Every RESULTS_DIR/NAME.json is compared with BASELINE_DIR/NAME.json, which
+ * --update overwrites instead. The results map case names to objects of
+ * metrics, which is what the suites write.
+ */
+
+enum MetricKind
+{
+    METRIC_INFO,
+    METRIC_THROUGHPUT,
+    METRIC_COST,
+    METRIC_TAIL,
+    METRIC_MEMORY,
+    METRIC_REQUIRED
+};
+
+/* The first rule whose suffix matches a metric's name decides how it is judged */
+struct MetricRule
+{
+    const gchar*    suffix;
+    MetricKind      kind;
+
+    // Changes smaller than this are noise, whatever the percentage
+    gdouble         floor;
+};
+
+static const MetricRule rules[] = {
+    { "_per_sec", METRIC_THROUGHPUT, 0 },
+    { "ns_per_op", METRIC_COST, 1 },
+    { "p99_usec", METRIC_TAIL, 100 },
+    { "stall_max_usec", METRIC_TAIL, 1000 },
+    { "stall_total_usec", METRIC_TAIL, 10000 },
+    { "p50_usec", METRIC_INFO, 0 },
+    { "max_usec", METRIC_INFO, 0 },
+    { "seconds", METRIC_INFO, 0 },
+    { "bytes_per_tracked_file", METRIC_MEMORY, 16 },
+    { "leaked_bytes_per_file", METRIC_MEMORY, 16 },
+    { "allocations_per_file", METRIC_MEMORY, 0.5 },
+    { "_bytes", METRIC_MEMORY, 1048576 },
+    { "finished", METRIC_REQUIRED, 0 },
+};
+
+struct Metric
+{
+    gchar*          name;
+    gdouble         value;
+};
+
+struct BenchCase
+{
+    gchar*                  name;
+    std::vector<Metric>     metrics;
+};
+
+/* Aggregates for the summary, the geometric mean of the ratios over matching cases */
+struct SummaryRow
+{
+    const gchar*    label;
+    const gchar*    file;
+    const gchar*    case_prefix;
+    const gchar*    metric;
+    MetricKind      kind;
+};
+
+static const SummaryRow summary_rows[] = {
+    { "file-info throughput", "emblem-bench.json", "", "files_per_sec", METRIC_THROUGHPUT },
+    { "file-info p99 time to emblem", "emblem-bench.json", "", "p99_usec", METRIC_TAIL },
+    { "parser throughput", "micro-bench.json", "", "items_per_sec", METRIC_THROUGHPUT },
+    { "menu parser throughput", "micro-bench.json", "parse_menu/", "items_per_sec", METRIC_THROUGHPUT },
+    { "main-thread stall time", "emblem-bench.json", "", "stall_total_usec", METRIC_TAIL },
+    { "longest main-thread stall", "emblem-bench.json", "", "stall_max_usec", METRIC_TAIL },
+    { "memory per tracked file", "memory-bench.json", "", "bytes_per_tracked_file", METRIC_MEMORY },
+};
+
+static gdouble throughput_threshold = 10;
+static gdouble latency_threshold = 25;
+static gdouble memory_threshold = 10;
+static gboolean update = false;
+
+static GOptionEntry entries[] = {
+    { "throughput", 0, 0, G_OPTION_ARG_DOUBLE, &throughput_threshold, "Fail if throughput drops by more than PCT percent", "PCT" },
+    { "latency", 0, 0, G_OPTION_ARG_DOUBLE, &latency_threshold, "Fail if tail latency or stalls grow by more than PCT percent", "PCT" },
+    { "memory", 0, 0, G_OPTION_ARG_DOUBLE, &memory_threshold, "Fail if memory use grows by more than PCT percent", "PCT" },
+    { "update", 0, 0, G_OPTION_ARG_NONE, &update, "Store the results as the new baselines", nullptr },
+    { nullptr }
+};
+
+static void skip_space(const gchar** t_p)
+{
+    while (g_ascii_isspace(**t_p))
+    {
+        (*t_p)++;
+    }
+}
+
+static gboolean expect(const gchar** t_p, gchar t_c)
+{
+    skip_space(t_p);
+
+    if (**t_p != t_c)
+    {
+        return false;
+    }
+
+    (*t_p)++;
+
+    return true;
+}
+
+/* Names are written by the suites, so escapes are only skipped over */
+static gchar* parse_string(const gchar** t_p)
+{
+    if (!expect(t_p, '"'))
+    {
+        return nullptr;
+    }
+
+    const gchar* start = *t_p;
+
+    while (**t_p != '"' && **t_p != '\0')
+    {
+        if (**t_p == '\\' && (*t_p)[1] != '\0')
+        {
+            (*t_p)++;
+        }
+
+        (*t_p)++;
+    }
+
+    if (**t_p != '"')
+    {
+        return nullptr;
+    }
+
+    return g_strndup(start, (*t_p)++ - start);
+}
+
+static gboolean parse_value(const gchar** t_p, gdouble* t_value)
+{
+    gchar* end;
+
+    skip_space(t_p);
+
+    if (g_str_has_prefix(*t_p, "true") || g_str_has_prefix(*t_p, "false"))
+    {
+        *t_value = **t_p == 't' ? 1 : 0;
+        *t_p += **t_p == 't' ? 4 : 5;
+
+        return true;
+    }
+
+    *t_value = g_ascii_strtod(*t_p, &end);
+
+    if (end == *t_p)
+    {
+        return false;
+    }
+
+    *t_p = end;
+
+    return true;
+}
+
+/* Parses {"case": {"metric": value, ...}, ...} */
+static gboolean parse_results(const gchar* t_text, std::vector<BenchCase>* t_cases)
+{
+    const gchar* p = t_text;
+
+    if (!expect(&p, '{'))
+    {
+        return false;
+    }
+
+    skip_space(&p);
+
+    while (*p == '"')
+    {
+        BenchCase bench_case;
+
+        if ((bench_case.name = parse_string(&p)) == nullptr || !expect(&p, ':') || !expect(&p, '{'))
+        {
+            g_free(bench_case.name);
+            return false;
+        }
+
+        t_cases->push_back(bench_case);
+        skip_space(&p);
+
+        while (*p == '"')
+        {
+            Metric metric;
+
+            if ((metric.name = parse_string(&p)) == nullptr || !expect(&p, ':') || !parse_value(&p, &(metric.value)))
+            {
+                g_free(metric.name);
+                return false;
+            }
+
+            t_cases->back().metrics.push_back(metric);
+
+            expect(&p, ',');
+            skip_space(&p);
+        }
+
+        if (!expect(&p, '}'))
+        {
+            return false;
+        }
+
+        expect(&p, ',');
+        skip_space(&p);
+    }
+
+    return expect(&p, '}');
+}
+
+static void free_cases(std::vector<BenchCase>& t_cases)
+{
+    for (BenchCase& bench_case : t_cases)
+    {
+        for (Metric& metric : bench_case.metrics)
+        {
+            g_free(metric.name);
+        }
+
+        g_free(bench_case.name);
+    }
+
+    t_cases.clear();
+}
+
+static gboolean load(const gchar* t_path, std::vector<BenchCase>* t_cases, GError** t_err)
+{
+    gchar* text;
+
+    if (!g_file_get_contents(t_path, &text, nullptr, t_err))
+    {
+        return false;
+    }
+
+    gboolean parsed = parse_results(text, t_cases);
+
+    if (!parsed)
+    {
+        g_set_error(t_err, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s isn't a bench result", t_path);
+        free_cases(*t_cases);
+    }
+
+    g_free(text);
+
+    return parsed;
+}
+
+static BenchCase* find_case(std::vector<BenchCase>& t_cases, const gchar* t_case)
+{
+    for (BenchCase& bench_case : t_cases)
+    {
+        if (strcmp(bench_case.name, t_case) == 0)
+        {
+            return &bench_case;
+        }
+    }
+
+    return nullptr;
+}
+
+static const gdouble* find_metric(std::vector<BenchCase>& t_cases, const gchar* t_case, const gchar* t_metric)
+{
+    BenchCase* bench_case = find_case(t_cases, t_case);
+
+    if (bench_case == nullptr)
+    {
+        return nullptr;
+    }
+
+    for (Metric& metric : bench_case->metrics)
+    {
+        if (strcmp(metric.name, t_metric) == 0)
+        {
+            return &(metric.value);
+        }
+    }
+
+    return nullptr;
+}
+
+static const MetricRule* rule_for(const gchar* t_metric)
+{
+    for (const MetricRule& rule : rules)
+    {
+        if (g_str_has_suffix(t_metric, rule.suffix))
+        {
+            return &rule;
+        }
+    }
+
+    return nullptr;
+}
+
+/* Positive when the change is for the worse, in percent */
+static gdouble worsening(MetricKind t_kind, gdouble t_baseline, gdouble t_current)
+{
+    if (t_baseline == 0)
+    {
+        return 0;
+    }
+
+    gdouble delta = (t_current - t_baseline) * 100 / t_baseline;
+
+    return t_kind == METRIC_THROUGHPUT ? -delta : delta;
+}
+
+static gdouble threshold_for(MetricKind t_kind)
+{
+    switch (t_kind)
+    {
+        case METRIC_THROUGHPUT:
+        case METRIC_COST:
+            return throughput_threshold;
+        case METRIC_TAIL:
+            return latency_threshold;
+        case METRIC_MEMORY:
+            return memory_threshold;
+        default:
+            return 0;
+    }
+}
+
+/* Returns "ok", "improved" or "REGRESSED" */
+static const gchar* judge(const MetricRule* t_rule, gdouble t_baseline, gdouble t_current)
+{
+    if (t_rule == nullptr || t_rule->kind == METRIC_INFO)
+    {
+        return "";
+    }
+
+    if (t_rule->kind == METRIC_REQUIRED)
+    {
+        return t_current != 0 ? "ok" : "REGRESSED";
+    }
+
+    gdouble worse = worsening(t_rule->kind, t_baseline, t_current);
+
+    if (fabs(t_current - t_baseline) < t_rule->floor)
+    {
+        return "ok";
+    }
+
+    if (worse > threshold_for(t_rule->kind))
+    {
+        return "REGRESSED";
+    }
+
+    return worse < -threshold_for(t_rule->kind) ? "improved" : "ok";
+}
+
+static gdouble delta_percent(gdouble t_baseline, gdouble t_current)
+{
+    return t_baseline != 0 ? (t_current - t_baseline) * 100 / t_baseline : 0;
+}
+
+/* Returns the number of regressions, a case that went missing is one too */
+static int compare(const gchar* t_file, std::vector<BenchCase>& t_baseline, std::vector<BenchCase>& t_current)
+{
+    int regressions = 0;
+
+    g_print("%s\n", t_file);
+
+    for (BenchCase& bench_case : t_current)
+    {
+        for (Metric& metric : bench_case.metrics)
+        {
+            const MetricRule* rule = rule_for(metric.name);
+            const gdouble* baseline = find_metric(t_baseline, bench_case.name, metric.name);
+
+            if (rule == nullptr)
+            {
+                continue;
+            }
+
+            if (baseline == nullptr)
+            {
+                g_print("  %-28s %-24s %14s %14.1f %8s  new\n", bench_case.name, metric.name, "-", metric.value, "");
+                continue;
+            }
+
+            const gchar* verdict = judge(rule, *baseline, metric.value);
+
+            g_print("  %-28s %-24s %14.1f %14.1f %+7.1f%%  %s\n", bench_case.name, metric.name,
+                *baseline, metric.value, delta_percent(*baseline, metric.value), verdict);
+
+            if (strcmp(verdict, "REGRESSED") == 0)
+            {
+                regressions++;
+            }
+        }
+    }
+
+    for (BenchCase& bench_case : t_baseline)
+    {
+        if (find_case(t_current, bench_case.name) == nullptr)
+        {
+            g_print("  %-28s missing from the results  REGRESSED\n", bench_case.name);
+            regressions++;
+        }
+    }
+
+    g_print("\n");
+
+    return regressions;
+}
+
+struct LoadedResults
+{
+    gchar*                  file;
+    std::vector<BenchCase>  baseline;
+    std::vector<BenchCase>  current;
+};
+
+/*
+ * Judges the geometric mean of each summary row, which catches a small
+ * slowdown across many cases that no single case shows.
+ *
+ * Returns:
+ * The number of rows that regressed.
+ */
+static int summarize(std::vector<LoadedResults>& t_results)
+{
+    int regressions = 0;
+
+    g_print("%-30s %8s %10s\n", "summary", "cases", "delta");
+
+    for (const SummaryRow& row : summary_rows)
+    {
+        gdouble log_sum = 0;
+        int count = 0;
+
+        for (LoadedResults& results : t_results)
+        {
+            if (strcmp(results.file, row.file) != 0)
+            {
+                continue;
+            }
+
+            for (BenchCase& bench_case : results.current)
+            {
+                const gdouble* current = find_metric(results.current, bench_case.name, row.metric);
+                const gdouble* baseline = find_metric(results.baseline, bench_case.name, row.metric);
+
+                if (!g_str_has_prefix(bench_case.name, row.case_prefix) || current == nullptr || baseline == nullptr || *current <= 0 || *baseline <= 0)
+                {
+                    continue;
+                }
+
+                log_sum += log(*current / *baseline);
+                count++;
+            }
+        }
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        gdouble delta = (exp(log_sum / count) - 1) * 100;
+        gdouble worse = row.kind == METRIC_THROUGHPUT ? -delta : delta;
+
+        g_print("%-30s %8d %+9.1f%%  %s\n", row.label, count, delta, worse > threshold_for(row.kind) ? "REGRESSED" : "");
+
+        if (worse > threshold_for(row.kind))
+        {
+            regressions++;
+        }
+    }
+
+    return regressions;
+}
+
+/* A suite that stopped writing results shouldn't pass for one without regressions */
+static int count_missing_results(const gchar* t_baseline_dir, std::vector<LoadedResults>& t_loaded)
+{
+    GDir* dir = g_dir_open(t_baseline_dir, 0, nullptr);
+    const gchar* name;
+    int missing = 0;
+
+    // No baselines at all, nothing can be missing
+    if (dir == nullptr)
+    {
+        return 0;
+    }
+
+    while ((name = g_dir_read_name(dir)) != nullptr)
+    {
+        gboolean found = false;
+
+        if (!g_str_has_suffix(name, ".json"))
+        {
+            continue;
+        }
+
+        for (LoadedResults& results : t_loaded)
+        {
+            found = found || strcmp(results.file, name) == 0;
+        }
+
+        if (!found)
+        {
+            g_print("%s\n  has a baseline but no results  REGRESSED\n\n", name);
+            missing++;
+        }
+    }
+
+    g_dir_close(dir);
+
+    return missing;
+}
+
+int main(int argc, char** argv)
+{
+    GError* error = nullptr;
+    GOptionContext* context = g_option_context_new("BASELINE_DIR RESULTS_DIR - compare bench results with baselines");
+
+    g_option_context_add_main_entries(context, entries, nullptr);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error) || argc != 3)
+    {
+        g_printerr("%s\n", error != nullptr ? error->message : "expected a baseline and a results directory");
+        return 2;
+    }
+
+    const gchar* baseline_dir = argv[1];
+    const gchar* results_dir = argv[2];
+    GDir* dir = g_dir_open(results_dir, 0, &error);
+    std::vector<LoadedResults> loaded;
+    const gchar* name;
+    int regressions = 0;
+    int summary_regressions = 0;
+    gboolean broken = false;
+
+    if (dir == nullptr)
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    if (update && g_mkdir_with_parents(baseline_dir, 0755) != 0)
+    {
+        g_printerr("can't create %s\n", baseline_dir);
+        return 2;
+    }
+
+    while ((name = g_dir_read_name(dir)) != nullptr)
+    {
+        if (!g_str_has_suffix(name, ".json"))
+        {
+            continue;
+        }
+
+        gchar* results_path = g_build_filename(results_dir, name, nullptr);
+        gchar* baseline_path = g_build_filename(baseline_dir, name, nullptr);
+        LoadedResults results;
+
+        results.file = g_strdup(name);
+
+        if (!load(results_path, &(results.current), &error))
+        {
+            g_printerr("%s\n", error->message);
+            g_clear_error(&error);
+            broken = true;
+        }
+        else if (update)
+        {
+            gchar* text;
+
+            if (!g_file_get_contents(results_path, &text, nullptr, &error) || !g_file_set_contents(baseline_path, text, -1, &error))
+            {
+                g_printerr("%s\n", error->message);
+                g_clear_error(&error);
+                broken = true;
+            }
+            else
+            {
+                g_print("stored %s\n", baseline_path);
+                g_free(text);
+            }
+        }
+        else if (!g_file_test(baseline_path, G_FILE_TEST_EXISTS))
+        {
+            g_print("%s\n  no baseline, store one with --update\n\n", name);
+        }
+        else if (!load(baseline_path, &(results.baseline), &error))
+        {
+            g_printerr("%s\n", error->message);
+            g_clear_error(&error);
+            broken = true;
+        }
+        else
+        {
+            regressions += compare(name, results.baseline, results.current);
+        }
+
+        loaded.push_back(results);
+
+        g_free(baseline_path);
+        g_free(results_path);
+    }
+
+    g_dir_close(dir);
+
+    if (!update)
+    {
+        regressions += count_missing_results(baseline_dir, loaded);
+        summary_regressions = summarize(loaded);
+
+        g_print("\n%d regressions, %d in the summary (throughput %.0f%%, latency %.0f%%, memory %.0f%%)\n",
+            regressions, summary_regressions, throughput_threshold, latency_threshold, memory_threshold);
+    }
+
+    for (LoadedResults& results : loaded)
+    {
+        free_cases(results.baseline);
+        free_cases(results.current);
+        g_free(results.file);
+    }
+
+    g_option_context_free(context);
+
+    if (broken)
+    {
+        return 2;
+    }
+
+    return regressions + summary_regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,635 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "bench-util.h"
+#include "dropbox-capture.h"
+#include "dropbox-client-util.h"
+#include "dropbox-command-client.h"
+#include "dropbox-metrics.h"
+#include "nautilus-dropbox-hooks.h"
+
+/*
+ * Plays back a capture made with DNA_CAPTURE_FILE against the real client.
+ *
+ * This program stands in for dropbox on sockets under a temporary HOME. It
+ * sends the requests of the capture through the command client and answers
+ * each with the recorded response, and pushes the recorded hook traffic to
+ * the hook client. Connections are replayed as one, so reconnects in the
+ * capture don't show up here.
+ *
+ * Usage: replay [--fast] capture-file
+ */
+
+/* Gives up when nothing was answered for this long after everything was due */
+static const gint64 STALL_TIMEOUT_USEC = 10 * G_USEC_PER_SEC;
+
+struct Replay;
+
+struct ReplayExchange
+{
+    Replay*         replay;
+    gint64          timestamp;
+    gint64          delay;
+    GString*        request;
+    GString*        response;
+    gchar*          command_name;
+    GHashTable*     command_args;
+    gint64          issued;
+    gint64          answered;
+    gboolean        failed;
+};
+
+struct ReplayChunk
+{
+    gint64          timestamp;
+    GString*        data;
+};
+
+struct Replay
+{
+    gboolean                        fast;
+    std::vector<ReplayExchange*>    exchanges;
+    std::vector<ReplayChunk>        hook_chunks;
+    GPtrArray*                      hook_names;
+    gint                            hook_events_expected;
+    gint64                          duration;
+
+    int                             command_listener;
+    int                             hook_listener;
+    DropboxCommandClient            dcc;
+    NautilusDropboxHookserv         hookserv;
+    GMainLoop*                      loop;
+
+    gint64                          start;
+    guint                           next_issue;
+    gint                            remaining;
+    gint                            hook_events;
+    gint                            out_of_order;
+    gint                            last_progress;
+    gint64                          last_progress_time;
+    gboolean                        stalled;
+};
+
+/* Splits a request as the client wrote it back into a command name and its arguments */
+static gboolean parse_request(ReplayExchange* t_exchange)
+{
+    gchar** lines = g_strsplit(t_exchange->request->str, "\n", 0);
+    guint count = g_strv_length(lines);
+
+    // The name, the arguments, "done" and what follows the last newline
+    gboolean parsed = count >= 3 && strcmp(lines[count - 2], "done") == 0 && lines[count - 1][0] == '\0';
+
+    if (parsed)
+    {
+        t_exchange->command_name = dropbox_client_util_desanitize(lines[0]);
+        t_exchange->command_args = g_hash_table_new_full((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal, (GDestroyNotify) g_free, (GDestroyNotify) g_strfreev);
+
+        for (guint i = 1; i < count - 2 && parsed; i++)
+        {
+            parsed = dropbox_client_util_command_parse_arg(lines[i], t_exchange->command_args);
+        }
+    }
+
+    g_strfreev(lines);
+
+    return parsed;
+}
+
+static gboolean is_complete(ReplayExchange* t_exchange)
+{
+    GString* response = t_exchange->response;
+
+    return response->len >= 5 && strcmp(response->str + response->len - 5, "done\n") == 0 && parse_request(t_exchange);
+}
+
+/* Counts the hook messages in the capture and the names they go to */
+static void parse_hooks(Replay* t_replay)
+{
+    GString* stream = g_string_new(nullptr);
+
+    for (const ReplayChunk& chunk : t_replay->hook_chunks)
+    {
+        g_string_append_len(stream, chunk.data->str, chunk.data->len);
+    }
+
+    gchar** lines = g_strsplit(stream->str, "\n", 0);
+    gboolean expect_name = true;
+
+    // The last line was either empty or cut short
+    for (guint i = 0; lines[i] != nullptr && lines[i + 1] != nullptr; i++)
+    {
+        if (expect_name)
+        {
+            gchar* name = dropbox_client_util_desanitize(lines[i]);
+            gboolean known = false;
+
+            for (guint n = 0; n < t_replay->hook_names->len; n++)
+            {
+                known |= strcmp((gchar *) g_ptr_array_index(t_replay->hook_names, n), name) == 0;
+            }
+
+            if (known)
+            {
+                g_free(name);
+            }
+            else
+            {
+                g_ptr_array_add(t_replay->hook_names, name);
+            }
+
+            expect_name = false;
+        }
+        else if (strcmp(lines[i], "done") == 0)
+        {
+            t_replay->hook_events_expected++;
+            expect_name = true;
+        }
+    }
+
+    g_strfreev(lines);
+    g_string_free(stream, true);
+}
+
+static gboolean load_capture(Replay* t_replay, const gchar* t_filename, GError** t_err)
+{
+    gchar* contents;
+    gsize length;
+    gsize magic = strlen(DROPBOX_CAPTURE_MAGIC);
+
+    if (!g_file_get_contents(t_filename, &contents, &length, t_err))
+    {
+        return false;
+    }
+
+    if (length < magic || memcmp(contents, DROPBOX_CAPTURE_MAGIC, magic) != 0)
+    {
+        g_set_error(t_err, g_quark_from_static_string("replay"), 0, "%s is not a capture file", t_filename);
+        g_free(contents);
+
+        return false;
+    }
+
+    std::vector<ReplayExchange*> recorded;
+    ReplayExchange* current = nullptr;
+    gint64 last_write = 0;
+    gsize pos = magic;
+
+    while (pos + sizeof(DropboxCaptureRecord) <= length)
+    {
+        DropboxCaptureRecord header;
+
+        memcpy(&header, contents + pos, sizeof(header));
+        pos += sizeof(header);
+
+        // Nautilus went away while writing this one
+        if (pos + header.length > length)
+        {
+            break;
+        }
+
+        const gchar* data = contents + pos;
+        pos += header.length;
+
+        if (header.stream == DROPBOX_CAPTURE_HOOK)
+        {
+            if (header.kind == DROPBOX_CAPTURE_READ)
+            {
+                ReplayChunk chunk = { header.timestamp, g_string_new_len(data, header.length) };
+                t_replay->hook_chunks.push_back(chunk);
+            }
+
+            continue;
+        }
+
+        switch (header.kind)
+        {
+            case DROPBOX_CAPTURE_WRITE:
+                // A write after a response starts the next request
+                if (current == nullptr || current->response->len > 0)
+                {
+                    current = g_new0(ReplayExchange, 1);
+                    current->replay = t_replay;
+                    current->timestamp = header.timestamp;
+                    current->request = g_string_new(nullptr);
+                    current->response = g_string_new(nullptr);
+                    recorded.push_back(current);
+                }
+
+                g_string_append_len(current->request, data, header.length);
+                last_write = header.timestamp;
+                break;
+
+            case DROPBOX_CAPTURE_READ:
+                if (current != nullptr)
+                {
+                    if (current->response->len == 0)
+                    {
+                        current->delay = header.timestamp - last_write;
+                    }
+
+                    g_string_append_len(current->response, data, header.length);
+                }
+                break;
+
+            default:
+                // Whatever was half done when a connection went away stays incomplete
+                current = nullptr;
+                break;
+        }
+    }
+
+    g_free(contents);
+
+    for (ReplayExchange* exchange : recorded)
+    {
+        if (is_complete(exchange))
+        {
+            t_replay->exchanges.push_back(exchange);
+        }
+        else
+        {
+            g_string_free(exchange->request, true);
+            g_string_free(exchange->response, true);
+            g_free(exchange->command_name);
+
+            if (exchange->command_args != nullptr)
+            {
+                g_hash_table_unref(exchange->command_args);
+            }
+
+            g_free(exchange);
+        }
+    }
+
+    // Both streams start together at zero
+    gint64 origin = G_MAXINT64;
+
+    if (!t_replay->exchanges.empty())
+    {
+        origin = t_replay->exchanges.front()->timestamp;
+    }
+
+    if (!t_replay->hook_chunks.empty())
+    {
+        origin = MIN(origin, t_replay->hook_chunks.front().timestamp);
+    }
+
+    for (ReplayExchange* exchange : t_replay->exchanges)
+    {
+        exchange->timestamp -= origin;
+        t_replay->duration = MAX(t_replay->duration, exchange->timestamp + exchange->delay);
+    }
+
+    for (ReplayChunk& chunk : t_replay->hook_chunks)
+    {
+        chunk.timestamp -= origin;
+        t_replay->duration = MAX(t_replay->duration, chunk.timestamp);
+    }
+
+    parse_hooks(t_replay);
+
+    return true;
+}
+
+/* Plays dropbox on the command socket, answering requests in the order they were recorded */
+static gpointer command_daemon(Replay* t_replay)
+{
+    int sock = accept(t_replay->command_listener, nullptr, nullptr);
+    GString* pending = g_string_new(nullptr);
+    gchar buf[4096];
+
+    for (ReplayExchange* exchange : t_replay->exchanges)
+    {
+        gsize length;
+
+        while ((length = bench_message_length(pending)) == 0)
+        {
+            ssize_t n = read(sock, buf, sizeof(buf));
+
+            if (n <= 0)
+            {
+                g_string_free(pending, true);
+                return nullptr;
+            }
+
+            g_string_append_len(pending, buf, n);
+        }
+
+        // The arguments may come in another order, the command name may not
+        gsize name_length = strchr(exchange->request->str, '\n') - exchange->request->str + 1;
+
+        if (length < name_length || strncmp(pending->str, exchange->request->str, name_length) != 0)
+        {
+            g_atomic_int_inc(&(t_replay->out_of_order));
+        }
+
+        g_string_erase(pending, 0, length);
+
+        if (!t_replay->fast)
+        {
+            g_usleep(exchange->delay);
+        }
+
+        bench_write_all(sock, exchange->response->str, exchange->response->len);
+    }
+
+    // Stay connected, the client would go back to retrying otherwise
+    g_string_free(pending, true);
+
+    return nullptr;
+}
+
+/* Plays dropbox on the hook socket */
+static gpointer hook_daemon(Replay* t_replay)
+{
+    int sock = accept(t_replay->hook_listener, nullptr, nullptr);
+
+    for (const ReplayChunk& chunk : t_replay->hook_chunks)
+    {
+        if (!t_replay->fast)
+        {
+            bench_sleep_until(t_replay->start + chunk.timestamp);
+        }
+
+        if (!bench_write_all(sock, chunk.data->str, chunk.data->len))
+        {
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+static gboolean check_done(Replay* t_replay)
+{
+    if (g_atomic_int_get(&(t_replay->remaining)) == 0 && t_replay->hook_events >= t_replay->hook_events_expected)
+    {
+        g_main_loop_quit(t_replay->loop);
+    }
+
+    return false;
+}
+
+/* Runs on the command thread */
+static void exchange_answered(GHashTable* t_response, ReplayExchange* t_exchange)
+{
+    gboolean expected_ok = strncmp(t_exchange->response->str, "ok\n", 3) == 0;
+
+    t_exchange->answered = g_get_monotonic_time();
+    t_exchange->failed = (t_response != nullptr) != expected_ok;
+
+    if (g_atomic_int_dec_and_test(&(t_exchange->replay->remaining)))
+    {
+        g_idle_add((GSourceFunc) check_done, t_exchange->replay);
+    }
+}
+
+static void hook_event(GHashTable* t_args, Replay* t_replay)
+{
+    t_replay->hook_events++;
+    check_done(t_replay);
+}
+
+static void issue(Replay* t_replay, ReplayExchange* t_exchange)
+{
+    DropboxGeneralCommand* dgc = g_new0(DropboxGeneralCommand, 1);
+
+    dgc->dc.request_type = GENERAL_COMMAND;
+    dgc->command_name = g_strdup(t_exchange->command_name);
+    dgc->metric = dropbox_metrics_command_for(t_exchange->command_name);
+    dgc->command_args = g_hash_table_ref(t_exchange->command_args);
+    dgc->handler = (NautilusDropboxCommandResponseHandler) exchange_answered;
+    dgc->handler_ud = t_exchange;
+    dgc->dispatch = DISPATCH_INLINE;
+
+    t_exchange->issued = g_get_monotonic_time();
+    dropbox_command_client_request(&(t_replay->dcc), (DropboxCommand *) dgc);
+}
+
+/* Sends the requests that are due, like nautilus did when it was recorded */
+static gboolean issue_due(Replay* t_replay)
+{
+    gint64 now = g_get_monotonic_time();
+
+    while (t_replay->next_issue < t_replay->exchanges.size())
+    {
+        ReplayExchange* exchange = t_replay->exchanges[t_replay->next_issue];
+        gint64 due = t_replay->start + exchange->timestamp;
+
+        if (!t_replay->fast && due > now)
+        {
+            g_timeout_add((guint) ((due - now) / 1000), (GSourceFunc) issue_due, t_replay);
+            return false;
+        }
+
+        issue(t_replay, exchange);
+        t_replay->next_issue++;
+    }
+
+    return false;
+}
+
+static gboolean watchdog(Replay* t_replay)
+{
+    gint64 now = g_get_monotonic_time();
+    gint progress = t_replay->hook_events - g_atomic_int_get(&(t_replay->remaining));
+
+    if (progress != t_replay->last_progress)
+    {
+        t_replay->last_progress = progress;
+        t_replay->last_progress_time = now;
+    }
+
+    gint64 due = t_replay->start + (t_replay->fast ? 0 : t_replay->duration);
+
+    if (now - MAX(due, t_replay->last_progress_time) > STALL_TIMEOUT_USEC)
+    {
+        t_replay->stalled = true;
+        g_main_loop_quit(t_replay->loop);
+
+        return false;
+    }
+
+    return true;
+}
+
+static gint64 percentile(std::vector<gint64>& t_samples, gdouble t_p)
+{
+    return t_samples.empty() ? 0 : t_samples[(gsize) (t_p * (t_samples.size() - 1))];
+}
+
+/* Returns false if the replay went differently than the recording */
+static gboolean report(Replay* t_replay, gint64 t_elapsed)
+{
+    std::vector<gint64> latencies;
+    gint failed = 0;
+    gdouble seconds = (gdouble) t_elapsed / G_USEC_PER_SEC;
+
+    for (ReplayExchange* exchange : t_replay->exchanges)
+    {
+        if (exchange->answered > 0)
+        {
+            latencies.push_back(exchange->answered - exchange->issued);
+        }
+
+        failed += exchange->failed ? 1 : 0;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    g_print("%-22s %10.3f s\n", "wall time", seconds);
+    g_print("%-22s %10u\n", "exchanges", (guint) t_replay->exchanges.size());
+    g_print("%-22s %10u\n", "answered", (guint) latencies.size());
+    g_print("%-22s %10d\n", "failed", failed);
+    g_print("%-22s %10d\n", "out of order", t_replay->out_of_order);
+    g_print("%-22s %10.1f\n", "exchanges/s", latencies.size() / seconds);
+    g_print("%-22s %10" G_GINT64_FORMAT "\n", "p50 usec", percentile(latencies, 0.5));
+    g_print("%-22s %10" G_GINT64_FORMAT "\n", "p99 usec", percentile(latencies, 0.99));
+    g_print("%-22s %10" G_GINT64_FORMAT "\n", "max usec", latencies.empty() ? 0 : latencies.back());
+    g_print("%-22s %6d/%-6d\n", "hook events", t_replay->hook_events, t_replay->hook_events_expected);
+    g_print("%-22s %10.1f\n", "hook events/s", t_replay->hook_events / seconds);
+
+    GString* metrics = g_string_new(nullptr);
+    dropbox_metrics_dump(metrics);
+    g_print("\n%s", metrics->str);
+    g_string_free(metrics, true);
+
+    if (t_replay->stalled)
+    {
+        g_printerr("replay stalled\n");
+    }
+
+    return !t_replay->stalled && failed == 0 && t_replay->out_of_order == 0 && latencies.size() == t_replay->exchanges.size();
+}
+
+int main(int argc, char** argv)
+{
+    Replay replay;
+    GError* error = nullptr;
+    const gchar* filename = nullptr;
+
+    replay.fast = false;
+    replay.hook_names = g_ptr_array_new_with_free_func(g_free);
+    replay.hook_events_expected = 0;
+    replay.duration = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--fast") == 0)
+        {
+            replay.fast = true;
+        }
+        else
+        {
+            filename = argv[i];
+        }
+    }
+
+    if (filename == nullptr)
+    {
+        g_printerr("usage: %s [--fast] capture-file\n", argv[0]);
+        return 2;
+    }
+
+    if (!load_capture(&replay, filename, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    // The client finds its sockets under HOME, this has to happen before anything asks for it
+    gchar* home = g_dir_make_tmp("dna-replay-XXXXXX", &error);
+
+    if (home == nullptr)
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+
+    gchar* dropbox_dir = g_build_filename(home, ".dropbox", nullptr);
+    gchar* command_path = g_build_filename(dropbox_dir, "command_socket", nullptr);
+    gchar* hook_path = g_build_filename(dropbox_dir, "iface_socket", nullptr);
+
+    g_setenv("HOME", home, true);
+    g_mkdir_with_parents(dropbox_dir, 0700);
+
+    replay.command_listener = bench_listen_unix(command_path);
+    replay.hook_listener = bench_listen_unix(hook_path);
+
+    if (replay.command_listener < 0 || replay.hook_listener < 0)
+    {
+        g_printerr("couldn't listen under %s\n", dropbox_dir);
+        return 2;
+    }
+
+    g_print("replaying %u exchanges and %d hook events from %s%s\n\n", (guint) replay.exchanges.size(),
+        replay.hook_events_expected, filename, replay.fast ? " as fast as possible" : "");
+
+    dropbox_metrics_init();
+
+    replay.loop = g_main_loop_new(nullptr, false);
+    replay.next_issue = 0;
+    replay.remaining = (gint) replay.exchanges.size();
+    replay.hook_events = 0;
+    replay.out_of_order = 0;
+    replay.last_progress = 0;
+    replay.stalled = false;
+
+    dropbox_command_client_setup(&(replay.dcc));
+    nautilus_dropbox_hooks_setup(&(replay.hookserv));
+
+    for (guint i = 0; i < replay.hook_names->len; i++)
+    {
+        nautilus_dropbox_hooks_add(&(replay.hookserv), (gchar *) g_ptr_array_index(replay.hook_names, i), (DropboxUpdateHook) hook_event, &replay);
+    }
+
+    replay.start = replay.last_progress_time = g_get_monotonic_time();
+
+    g_thread_unref(g_thread_new("command-daemon", (GThreadFunc) command_daemon, &replay));
+    g_thread_unref(g_thread_new("hook-daemon", (GThreadFunc) hook_daemon, &replay));
+
+    dropbox_command_client_start(&(replay.dcc));
+    nautilus_dropbox_hooks_start(&(replay.hookserv));
+
+    g_idle_add((GSourceFunc) issue_due, &replay);
+    g_idle_add((GSourceFunc) check_done, &replay);
+    g_timeout_add_seconds(1, (GSourceFunc) watchdog, &replay);
+
+    g_main_loop_run(replay.loop);
+
+    gboolean matched = report(&replay, g_get_monotonic_time() - replay.start);
+
+    g_unlink(command_path);
+    g_unlink(hook_path);
+    g_rmdir(dropbox_dir);
+    g_rmdir(home);
+
+    return matched ? 0 : 1;
+}
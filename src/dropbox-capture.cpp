@@ -0,0 +1,163 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <glib.h>
+
+#include "dropbox-capture.h"
+#include "dropbox-log.h"
+
+static FILE* capture_file = nullptr;
+static GMutex capture_mutex;
+static gint64 capture_start = 0;
+
+/* What unix channels normally do, and the same with recording, per stream */
+static GIOFuncs* unix_funcs = nullptr;
+static GIOFuncs capture_funcs[DROPBOX_CAPTURE_STREAMS];
+
+static void record(GIOChannel* t_chan, DropboxCaptureKind t_kind, const gchar* t_data, gsize t_length)
+{
+    DropboxCaptureRecord header;
+
+    header.timestamp = g_get_monotonic_time() - capture_start;
+    header.length = (guint32) t_length;
+    header.stream = (guint8) (t_chan->funcs - capture_funcs);
+    header.kind = (guint8) t_kind;
+    header.reserved = 0;
+
+    g_mutex_lock(&capture_mutex);
+
+    if (capture_file != nullptr)
+    {
+        fwrite(&header, sizeof(header), 1, capture_file);
+        fwrite(t_data, 1, t_length, capture_file);
+
+        // Keep what we have in case nautilus doesn't get to shut down
+        if (t_kind == DROPBOX_CAPTURE_CLOSE)
+        {
+            fflush(capture_file);
+        }
+    }
+
+    g_mutex_unlock(&capture_mutex);
+}
+
+static GIOStatus capture_read(GIOChannel* t_chan, gchar* t_buf, gsize t_count, gsize* t_bytes_read, GError** t_err)
+{
+    GIOStatus status = unix_funcs->io_read(t_chan, t_buf, t_count, t_bytes_read, t_err);
+
+    if (*t_bytes_read > 0)
+    {
+        record(t_chan, DROPBOX_CAPTURE_READ, t_buf, *t_bytes_read);
+    }
+
+    return status;
+}
+
+static GIOStatus capture_write(GIOChannel* t_chan, const gchar* t_buf, gsize t_count, gsize* t_bytes_written, GError** t_err)
+{
+    GIOStatus status = unix_funcs->io_write(t_chan, t_buf, t_count, t_bytes_written, t_err);
+
+    if (*t_bytes_written > 0)
+    {
+        record(t_chan, DROPBOX_CAPTURE_WRITE, t_buf, *t_bytes_written);
+    }
+
+    return status;
+}
+
+static void capture_free(GIOChannel* t_chan)
+{
+    record(t_chan, DROPBOX_CAPTURE_CLOSE, nullptr, 0);
+
+    unix_funcs->io_free(t_chan);
+}
+
+/**
+ * Opens DNA_CAPTURE_FILE if it is set.
+ *
+ * @note Only call this on the main loop, once on initialization
+ */
+void dropbox_capture_init()
+{
+    const gchar* filename = g_getenv("DNA_CAPTURE_FILE");
+
+    if (filename == nullptr || filename[0] == '\0')
+    {
+        return;
+    }
+
+    if ((capture_file = fopen(filename, "wb")) == nullptr)
+    {
+        dropbox_log_error("couldn't open capture file %s", filename);
+        return;
+    }
+
+    fwrite(DROPBOX_CAPTURE_MAGIC, 1, strlen(DROPBOX_CAPTURE_MAGIC), capture_file);
+    capture_start = g_get_monotonic_time();
+
+    // Borrow the functions of a unix channel that owns nothing, before any thread needs them
+    GIOChannel* probe = g_io_channel_unix_new(fileno(capture_file));
+    unix_funcs = probe->funcs;
+    g_io_channel_unref(probe);
+
+    for (gint i = 0; i < DROPBOX_CAPTURE_STREAMS; i++)
+    {
+        capture_funcs[i] = *unix_funcs;
+        capture_funcs[i].io_read = capture_read;
+        capture_funcs[i].io_write = capture_write;
+        capture_funcs[i].io_free = capture_free;
+    }
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void dropbox_capture_close()
+{
+    g_mutex_lock(&capture_mutex);
+
+    if (capture_file != nullptr)
+    {
+        fclose(capture_file);
+        capture_file = nullptr;
+    }
+
+    g_mutex_unlock(&capture_mutex);
+}
+
+/**
+ * Records what goes over t_chan from now on, as part of t_stream. Does
+ * nothing unless capturing.
+ *
+ * @note This function is threadsafe
+ */
+void dropbox_capture_channel(GIOChannel* t_chan, DropboxCaptureStream t_stream)
+{
+    if (unix_funcs == nullptr)
+    {
+        return;
+    }
+
+    t_chan->funcs = &(capture_funcs[t_stream]);
+    record(t_chan, DROPBOX_CAPTURE_OPEN, nullptr, 0);
+}
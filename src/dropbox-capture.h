@@ -0,0 +1,63 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_CAPTURE_H
+#define DROPBOX_CAPTURE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Records everything that goes over the command and hook sockets, so a
+ * session can be replayed offline with bench/replay.
+ *
+ * Setting DNA_CAPTURE_FILE turns it on. The file starts with
+ * DROPBOX_CAPTURE_MAGIC, followed by records in host byte order, each
+ * followed by length bytes of data. Reads are what dropbox sent, writes
+ * what we sent, exactly as they were passed to the socket.
+ */
+#define DROPBOX_CAPTURE_MAGIC "DNACAPT1"
+
+enum DropboxCaptureStream {
+    DROPBOX_CAPTURE_COMMAND, DROPBOX_CAPTURE_HOOK, DROPBOX_CAPTURE_STREAMS
+};
+
+enum DropboxCaptureKind {
+    DROPBOX_CAPTURE_OPEN, DROPBOX_CAPTURE_CLOSE, DROPBOX_CAPTURE_READ, DROPBOX_CAPTURE_WRITE
+};
+
+struct DropboxCaptureRecord
+{
+    gint64      timestamp;
+    guint32     length;
+    guint8      stream;
+    guint8      kind;
+    guint16     reserved;
+};
+
+void dropbox_capture_init();
+void dropbox_capture_close();
+
+void dropbox_capture_channel(GIOChannel* t_chan, DropboxCaptureStream t_stream);
+
+G_END_DECLS
+
+#endif
@@ -103,4 +103,32 @@ gboolean dropbox_client_util_command_parse_arg(const gchar* t_line, GHashTable*
 
     g_strfreev(argval);
     return return_value;
-}
\ No newline at end of file
+}
+
+/**
+ * Decodes the %XX escapes of the context menu options in place, malformed
+ * ones are left alone.
+ */
+gchar* dropbox_client_util_url_decode_in_place(gchar* t_s)
+{
+    gchar* out = t_s;
+
+    for (const gchar* in = t_s; *in != '\0'; in++)
+    {
+        gint high, low;
+
+        if (*in == '%' && (high = g_ascii_xdigit_value(in[1])) >= 0 && (low = g_ascii_xdigit_value(in[2])) >= 0)
+        {
+            *out++ = (gchar) (high << 4 | low);
+            in += 2;
+        }
+        else
+        {
+            *out++ = *in;
+        }
+    }
+
+    *out = '\0';
+
+    return t_s;
+}
@@ -54,6 +54,8 @@ gchar *dropbox_client_util_desanitize(const gchar *a);
 gboolean
 dropbox_client_util_command_parse_arg(const gchar *line, GHashTable *return_table);
 
+gchar *dropbox_client_util_url_decode_in_place(gchar *s);
+
 G_END_DECLS
 
 #endif
@@ -54,7 +54,7 @@ static void hook_on_connect(DropboxClient* t_dc)
 
     if (t_dc->command_connect_called)
     {
-        debug("client connection");
+        dropbox_log_info("connected to dropbox");
         g_hook_list_invoke(&(t_dc->onconnect_hooklist), false);
         
         // Reset flags
@@ -68,7 +68,7 @@ static void command_on_connect(DropboxClient* t_dc)
 
     if (t_dc->hook_connect_called)
     {
-        debug("client connection");
+        dropbox_log_info("connected to dropbox");
         g_hook_list_invoke(&(t_dc->onconnect_hooklist), false);
         
         // Reset flags
@@ -82,7 +82,7 @@ static void command_on_disconnect(DropboxClient* t_dc)
 
     if (t_dc->hook_disconnect_called)
     {
-        debug("client disconnect");
+        dropbox_log_info("disconnected from dropbox");
         g_hook_list_invoke(&(t_dc->ondisconnect_hooklist), false);
         
         // Reset flags
@@ -100,7 +100,7 @@ static void hook_on_disconnect(DropboxClient* t_dc)
 
     if (t_dc->command_disconnect_called)
     {
-        debug("client disconnect");
+        dropbox_log_info("disconnected from dropbox");
         g_hook_list_invoke(&(t_dc->ondisconnect_hooklist), false);
         
         // Reset flags
@@ -58,6 +58,9 @@
 #include "dropbox-command-client.h"
 #include "nautilus-dropbox.h"
 #include "nautilus-dropbox-hooks.h"
+#include "dropbox-metrics.h"
+#include "dropbox-trace.h"
+#include "dropbox-capture.h"
 
 /* TODO: make this asynchronous ;) */
 
@@ -69,6 +72,11 @@
   */
 gboolean nautilus_dropbox_finish_file_info_command(DropboxFileInfoCommandResponse *);
 
+static void finish_file_info_completion(DropboxCompletion* t_completion, gpointer t_ud)
+{
+    nautilus_dropbox_finish_file_info_command((DropboxFileInfoCommandResponse *) t_completion);
+}
+
 struct ConnectionAttempt {
     DropboxCommandClient*   dcc;
     guint                   connect_attempt;
@@ -203,7 +211,7 @@ static GList *my_g_hash_table_get_keys(GHashTable* t_ght)
   but it doesn't matter right now, any error is a sufficient
   condition to disconnect
 */
-static GHashTable* send_command_to_db(GIOChannel* t_chan, const gchar* t_command_name, GHashTable* t_args, GError** t_err)
+static GHashTable* exchange_command(GIOChannel* t_chan, const gchar* t_command_name, GHashTable* t_args, GError** t_err)
 {
     GError* tmp_error = nullptr;
     GIOStatus iostat;
@@ -336,30 +344,30 @@ static GHashTable* send_command_to_db(GIOChannel* t_chan, const gchar* t_command
     }
 }
 
-static void do_file_info_command(GIOChannel* t_chan, DropboxFileInfoCommand* t_dfic, GError** t_gerr)
+/* Like exchange_command, keeping track of how long dropbox took to answer */
+static GHashTable* send_command_to_db(GIOChannel* t_chan, const gchar* t_command_name, DropboxMetricsCommand t_metric, GHashTable* t_args, GError** t_err)
+{
+    gint64 start = g_get_monotonic_time();
+    GHashTable* response = exchange_command(t_chan, t_command_name, t_args, t_err);
+
+    dropbox_metrics_record(t_metric, g_get_monotonic_time() - start);
+    dropbox_trace_complete(t_command_name, start, 0);
+
+    return response;
+}
+
+static void do_file_info_command(DropboxCommandClient* t_dcc, GIOChannel* t_chan, DropboxFileInfoCommand* t_dfic, GError** t_gerr)
 {
     // We need to send two requests to dropbox: file status and folder_tags
     GError* tmp_gerr = nullptr;
     DropboxFileInfoCommandResponse* dficr;
-    GHashTable* file_status_response = nullptr, args, folder_tag_response = nullptr, emblems_response = nullptr;
-    gchar* filename = nullptr;
-
-    gchar* filename_un, uri;
-    uri = nautilus_file_info_get_uri(t_dfic->file);
-    filename_un = uri ? g_filename_from_uri(uri, nullptr, nullptr) : nullptr;
-    g_free(uri);
-    
-    if (filename_un)
-    {
-        filename = g_filename_to_utf8(filename_un, -1, nullptr, nullptr, nullptr);
-        g_free(filename_un);
+    GHashTable* file_status_response = nullptr;
+    GHashTable* folder_tag_response = nullptr;
+    GHashTable* emblems_response = nullptr;
+    GHashTable* args;
 
-        if (filename == nullptr)
-        {
-            // Oooh, filename wasn't correctly encoded
-            debug("file wasn't correctly encoded %s", filename_un);
-        }
-    }
+    // The path was decoded on the main thread when the request was made
+    const gchar* filename = t_dfic->path->path;
 
     // We couldn't get the filename.  Just return empty.
     if (filename == nullptr)
@@ -375,7 +383,7 @@ static void do_file_info_command(GIOChannel* t_chan, DropboxFileInfoCommand* t_d
     path_arg[1] = nullptr;
     g_hash_table_insert(args, g_strdup("path"), path_arg);
 
-    emblems_response = send_command_to_db(chan, "get_emblems", args, nullptr);
+    emblems_response = send_command_to_db(chan, "get_emblems", METRIC_CMD_GET_EMBLEMS, args, nullptr);
     if (emblems_response)
     {
         // Don't need to do the other calls.
@@ -384,13 +392,12 @@ static void do_file_info_command(GIOChannel* t_chan, DropboxFileInfoCommand* t_d
     }
 
     // Send status command to the server
-    file_status_response = send_command_to_db(t_chan, "icon_overlay_file_status", args, &tmp_gerr);
+    file_status_response = send_command_to_db(t_chan, "icon_overlay_file_status", METRIC_CMD_FILE_STATUS, args, &tmp_gerr);
     g_hash_table_unref(args);
     args = nullptr;
 
     if (tmp_gerr != nullptr)
     {
-        g_free(filename);
         g_assert(file_status_response == nullptr);
         g_propagate_error(gerr, tmp_gerr);
 
@@ -407,7 +414,7 @@ static void do_file_info_command(GIOChannel* t_chan, DropboxFileInfoCommand* t_d
         paths_arg[1] = nullptr;
         g_hash_table_insert(args, g_strdup("path"), paths_arg);
 
-        folder_tag_response = send_command_to_db(t_chan, "get_folder_tag", args, &tmp_gerr);
+        folder_tag_response = send_command_to_db(t_chan, "get_folder_tag", METRIC_CMD_FOLDER_TAG, args, &tmp_gerr);
         g_hash_table_unref(args);
         args = nullptr;
 
@@ -432,9 +439,8 @@ static void do_file_info_command(GIOChannel* t_chan, DropboxFileInfoCommand* t_d
         dficr->folder_tag_response = folder_tag_response;
         dficr->file_status_response = file_status_response;
         dficr->emblems_response = emblems_response;
-        g_idle_add((GSourceFunc) nautilus_dropbox_finish_file_info_command, dficr);
-
-        g_free(filename);
+        dropbox_trace_async_begin("delivery", t_dfic->dc.trace_id);
+        dropbox_completion_queue_push(&(t_dcc->completions), &(dficr->completion));
 
         return;
 }
@@ -457,19 +463,48 @@ static gboolean finish_general_command(DropboxGeneralCommandResponse* t_dgcr)
         g_hash_table_unref(t_dgcr->dgc->command_args);
     }
 
+    if (t_dgcr->dgc->args_data_destroy != nullptr)
+    {
+        t_dgcr->dgc->args_data_destroy(t_dgcr->dgc->args_data);
+    }
+
     g_free(t_dgcr->dgc);
     g_free(t_dgcr);
 
     return false;
 }
 
-static void do_general_command(GIOChannel* t_chan, DropboxGeneralCommand* t_dcac, GError** t_gerr)
+static void pool_finish_general_command(DropboxGeneralCommandResponse* t_dgcr, gpointer t_ud)
+{
+    finish_general_command(t_dgcr);
+}
+
+/* Hands the response to the handler wherever the command wants it handled */
+static void dispatch_general_command(DropboxCommandClient* t_dcc, DropboxGeneralCommandResponse* t_dgcr)
+{
+    switch (t_dgcr->dgc->dispatch)
+    {
+        case DISPATCH_MAIN_LOOP:
+            g_idle_add((GSourceFunc) finish_general_command, t_dgcr);
+            break;
+
+        case DISPATCH_POOL:
+            g_thread_pool_push(t_dcc->callback_pool, t_dgcr, nullptr);
+            break;
+
+        default:
+            finish_general_command(t_dgcr);
+            break;
+    }
+}
+
+static void do_general_command(DropboxCommandClient* t_dcc, GIOChannel* t_chan, DropboxGeneralCommand* t_dcac, GError** t_gerr)
 {
     GError* tmp_gerr = nullptr;
     GHashTable* response;
 
     // Send status command to server
-    response = send_command_to_db(t_chan, t_dcac->command_name, t_dcac->command_args, &tmp_gerr);
+    response = send_command_to_db(t_chan, t_dcac->command_name, t_dcac->metric, t_dcac->command_args, &tmp_gerr);
 
     if (tmp_gerr != nullptr)
     {
@@ -483,7 +518,7 @@ static void do_general_command(GIOChannel* t_chan, DropboxGeneralCommand* t_dcac
     DropboxGeneralCommandResponse* dgcr = g_new0(DropboxGeneralCommandResponse, 1);
     dgcr->dgc = t_dcac;
     dgcr->response = response;
-    finish_general_command(dgcr);
+    dispatch_general_command(t_dcc, dgcr);
 
     return;
 }
@@ -518,7 +553,16 @@ static gboolean check_connection(GIOChannel* t_chan)
     return iostat == G_IO_STATUS_AGAIN;
 }
 
-static void end_request(DropboxCommand* t_dc)
+/* The reset request is only a marker, it has no trace id to end */
+static void trace_dequeued(DropboxCommand* t_dc)
+{
+    if ((gpointer (*)(DropboxCommandClient *data)) t_dc != &dropbox_command_client_thread)
+    {
+        dropbox_trace_async_end("queued", t_dc->trace_id);
+    }
+}
+
+static void end_request(DropboxCommandClient* t_dcc, DropboxCommand* t_dc)
 {
     if ((gpointer (*)(DropboxCommandClient *data)) t_dc != &dropbox_command_client_thread)
     {
@@ -530,7 +574,8 @@ static void end_request(DropboxCommand* t_dc)
                 dficr->dfic = dfic;
                 dficr->file_status_response = nullptr;
                 dficr->emblems_response = nullptr;
-                g_idle_add((GSourceFunc) nautilus_dropbox_finish_file_info_command, dficr);
+                dropbox_trace_async_begin("delivery", dfic->dc.trace_id);
+                dropbox_completion_queue_push(&(t_dcc->completions), &(dficr->completion));
                 break;
 
             case GENERAL_COMMAND:
@@ -538,7 +583,7 @@ static void end_request(DropboxCommand* t_dc)
                 DropboxGeneralCommandResponse *dgcr = g_new0(DropboxGeneralCommandResponse, 1);
                 dgcr->dgc = dgc;
                 dgcr->response = nullptr;
-                finish_general_command(dgcr);
+                dispatch_general_command(t_dcc, dgcr);
                 break;
 
             default: 
@@ -552,6 +597,7 @@ static gpointer dropbox_command_client_thread(DropboxCommandClient* t_dcc)
     struct sockaddr_un addr;
     socklen_t addr_len;
     int connection_attempts = 1;
+    bool connected_before = false;
 
     // Initialize address structure
     addr.sun_family = AF_UNIX;
@@ -643,13 +689,22 @@ static gpointer dropbox_command_client_thread(DropboxCommandClient* t_dcc)
         }
 
         // Connected
-        debug("command client connected");
+        dropbox_log_info("command client connected");
 
         chan = g_io_channel_unix_new(sock);
+        dropbox_capture_channel(chan, DROPBOX_CAPTURE_COMMAND);
         g_io_channel_set_close_on_unref(chan, true);
         g_io_channel_set_line_term(chan, "\n", -1);
 
         SET_CONNECTED_STATE(true);
+        dropbox_metrics_count(METRIC_CONNECTIONS);
+
+        if (connected_before)
+        {
+            dropbox_metrics_count(METRIC_RECONNECTIONS);
+        }
+
+        connected_before = true;
 
         g_idle_add((GSourceFunc) on_connect, dcc);
 
@@ -659,13 +714,14 @@ static gpointer dropbox_command_client_thread(DropboxCommandClient* t_dcc)
 
             while (true)
             {
-                GTimeVal gtv;
+                // Requests from nautilus go first, prefetches only run when there is nothing else to do
+                if ((dc = (DropboxCommand *) dropbox_command_queue_try_pop(&(t_dcc->command_queue))) != nullptr || (dc = (DropboxCommand *) g_async_queue_try_pop(t_dcc->prefetch_queue)) != nullptr)
+                {
+                    break;
+                }
 
-                g_get_current_time(&gtv);
-                g_time_val_add(&gtv, G_USEC_PER_SEC / 10);
-                
                 // Get a request from nautilus
-                dc = g_async_queue_timed_pop(dcc->command_queue, &gtv);
+                dc = (DropboxCommand *) dropbox_command_queue_timeout_pop(&(t_dcc->command_queue), G_USEC_PER_SEC / 10);
 
                 if (dc != nullptr)
                 {
@@ -687,16 +743,18 @@ static gpointer dropbox_command_client_thread(DropboxCommandClient* t_dcc)
                 goto BADCONNECTION;
             }
 
+            trace_dequeued(dc);
+
             switch (dc->request_type)
             {
                 case GET_FILE_INFO:
                     debug("doing file info command");
-                    do_file_info_command(chan, (DropboxFileInfoCommand *) dc, &gerr);
+                    do_file_info_command(t_dcc, chan, (DropboxFileInfoCommand *) dc, &gerr);
                     break;
 
                 case GENERAL_COMMAND:
                     debug("doing general command");
-                    do_general_command(chan, (DropboxGeneralCommand *) dc, &gerr);
+                    do_general_command(t_dcc, chan, (DropboxGeneralCommand *) dc, &gerr);
                     break;
 
                 default: 
@@ -708,18 +766,25 @@ static gpointer dropbox_command_client_thread(DropboxCommandClient* t_dcc)
             if (gerr != nullptr)
             {
                 // Mark this request as never to be completed
-                end_request(dc);
+                end_request(t_dcc, dc);
 
-                debug("command error: %s", gerr->message);
+                dropbox_log_warning("command error: %s", gerr->message);
 
                 g_error_free(gerr);
                 BADCONNECTION:
 
                 /* Grab all the rest of the data off the async queue and mark it
                  * never to be completed, who knows how long we'll be disconnected */
-                while ((dc = g_async_queue_try_pop(t_dcc->command_queue)) != nullptr)
+                while ((dc = (DropboxCommand *) dropbox_command_queue_try_pop(&(t_dcc->command_queue))) != nullptr)
                 {
-                    end_request(dc);
+                    trace_dequeued(dc);
+                    end_request(t_dcc, dc);
+                }
+
+                while ((dc = (DropboxCommand *) g_async_queue_try_pop(t_dcc->prefetch_queue)) != nullptr)
+                {
+                    trace_dequeued(dc);
+                    end_request(t_dcc, dc);
                 }
 
                 g_io_channel_unref(chan);
@@ -742,13 +807,7 @@ static gpointer dropbox_command_client_thread(DropboxCommandClient* t_dcc)
  */
 gboolean dropbox_command_client_is_connected(DropboxCommandClient* t_dcc)
 {
-    gboolean command_connected;
-
-    g_mutex_lock(t_dcc->command_connected_mutex);
-    command_connected = t_dcc->command_connected;
-    g_mutex_unlock(t_dcc->command_connected_mutex);
-
-    return command_connected;
+    return g_atomic_int_get(&(t_dcc->command_connected));
 }
 
 /**
@@ -759,7 +818,7 @@ void dropbox_command_client_force_reconnect(DropboxCommandClient* t_dcc)
     if (dropbox_command_client_is_connected(t_dcc))
     {
         debug("forcing command to reconnect");
-        dropbox_command_client_request(t_dcc, (DropboxCommand *) &dropbox_command_client_thread);
+        dropbox_command_queue_push(&(t_dcc->command_queue), (DropboxCommand *) &dropbox_command_client_thread);
     }
 }
 
@@ -768,7 +827,72 @@ void dropbox_command_client_force_reconnect(DropboxCommandClient* t_dcc)
  */
 void dropbox_command_client_request(DropboxCommandClient* t_dcc, DropboxCommand* t_dc)
 {
-    g_async_queue_push(t_dcc->command_queue, t_dc);
+    if (t_dc->trace_id == 0)
+    {
+        t_dc->trace_id = dropbox_trace_next_id();
+    }
+
+    dropbox_trace_async_begin("queued", t_dc->trace_id);
+    dropbox_command_queue_push(&(t_dcc->command_queue), t_dc);
+}
+
+/* Prefetches beyond this are dropped, they'd be stale by the time they run */
+static const gint MAX_PENDING_PREFETCHES = 64;
+
+/**
+ * Queues a request that nobody is waiting for yet. It only runs when
+ * there are no regular requests left.
+ *
+ * @note This function is threadsafe
+ */
+void dropbox_command_client_prefetch(DropboxCommandClient* t_dcc, DropboxCommand* t_dc)
+{
+    if (t_dc->trace_id == 0)
+    {
+        t_dc->trace_id = dropbox_trace_next_id();
+    }
+
+    dropbox_trace_async_begin("queued", t_dc->trace_id);
+    g_async_queue_push(t_dcc->prefetch_queue, t_dc);
+}
+
+/**
+ * @note This function is threadsafe
+ */
+gboolean dropbox_command_client_is_prefetch_full(DropboxCommandClient* t_dcc)
+{
+    return g_async_queue_length(t_dcc->prefetch_queue) >= MAX_PENDING_PREFETCHES;
+}
+
+/* Threads handling responses off both the command thread and the main loop */
+static const gint CALLBACK_POOL_THREADS = 2;
+
+/* Room for a full directory of emblem requests before pushes take the overflow lock */
+static const guint COMMAND_QUEUE_SIZE = 4096;
+
+static gint64 command_queue_gauge(DropboxCommandClient* t_dcc)
+{
+    return dropbox_command_queue_length(&(t_dcc->command_queue));
+}
+
+static gint64 prefetch_queue_gauge(DropboxCommandClient* t_dcc)
+{
+    return MAX(g_async_queue_length(t_dcc->prefetch_queue), 0);
+}
+
+static gint64 completion_batches_gauge(DropboxCommandClient* t_dcc)
+{
+    return t_dcc->completions.batches;
+}
+
+static gint64 completion_over_budget_gauge(DropboxCommandClient* t_dcc)
+{
+    return t_dcc->completions.over_budget;
+}
+
+static gint64 completion_deferred_gauge(DropboxCommandClient* t_dcc)
+{
+    return t_dcc->completions.deferred;
 }
 
 /**
@@ -776,8 +900,16 @@ void dropbox_command_client_request(DropboxCommandClient* t_dcc, DropboxCommand*
  */
 void dropbox_command_client_setup(DropboxCommandClient* t_dcc)
 {
-    t_dcc->command_queue = g_async_queue_new();
-    t_dcc->command_connected_mutex = g_mutex_new();
+    dropbox_command_queue_init(&(t_dcc->command_queue), COMMAND_QUEUE_SIZE);
+    t_dcc->prefetch_queue = g_async_queue_new();
+    dropbox_completion_queue_init(&(t_dcc->completions), finish_file_info_completion, nullptr);
+    t_dcc->callback_pool = g_thread_pool_new((GFunc) pool_finish_general_command, nullptr, CALLBACK_POOL_THREADS, false, nullptr);
+
+    dropbox_metrics_add_gauge("command_queue_length", (DropboxMetricsGaugeFunc) command_queue_gauge, t_dcc);
+    dropbox_metrics_add_gauge("prefetch_queue_length", (DropboxMetricsGaugeFunc) prefetch_queue_gauge, t_dcc);
+    dropbox_metrics_add_gauge("completion_batches", (DropboxMetricsGaugeFunc) completion_batches_gauge, t_dcc);
+    dropbox_metrics_add_gauge("completion_batches_over_budget", (DropboxMetricsGaugeFunc) completion_over_budget_gauge, t_dcc);
+    dropbox_metrics_add_gauge("completion_batches_deferred", (DropboxMetricsGaugeFunc) completion_deferred_gauge, t_dcc);
     t_dcc->command_connected = false;
     t_dcc->ca_hooklist = nullptr;
 
@@ -827,7 +959,7 @@ void dropbox_command_client_start(DropboxCommandClient* t_dcc)
 {
     // Setup the connection to the command server
     debug("starting command thread");
-    g_thread_create((gpointer (*)(gpointer data)) dropbox_command_client_thread, t_dcc, false, nullptr);
+    g_thread_unref(g_thread_new("dropbox-command", (GThreadFunc) dropbox_command_client_thread, t_dcc));
 }
 
 /**
@@ -840,36 +972,36 @@ void dropbox_command_client_send_simple_command(DropboxCommandClient* t_dcc, con
     dgc = g_new(DropboxGeneralCommand, 1);
 
     dgc->dc.request_type = GENERAL_COMMAND;
+    dgc->dc.trace_id = 0;
     dgc->command_name = g_strdup(command);
+    dgc->metric = dropbox_metrics_command_for(command);
     dgc->command_args = nullptr;
+    dgc->args_data = nullptr;
+    dgc->args_data_destroy = nullptr;
     dgc->handler = nullptr;
     dgc->handler_ud = nullptr;
+    dgc->dispatch = DISPATCH_INLINE;
 
     dropbox_command_client_request(t_dcc, (DropboxCommand *) dgc);
 }
 
-/**
- * This function is threadsafe. This is the C API, there is another send_command_to_db
- * that is more the actual over the wire command
- */
-void dropbox_command_client_send_command(DropboxCommandClient* t_dcc, NautilusDropboxCommandResponseHandler t_h, gpointer t_ud, const char* t_command, ...)
+static void send_command_valist(DropboxCommandClient* t_dcc, DropboxDispatchPolicy t_dispatch, NautilusDropboxCommandResponseHandler t_h, gpointer t_ud, const char* t_command, va_list ap)
 {
-    va_list ap;
     DropboxGeneralCommand* dgc;
     gchar* na;
-    va_start(ap, t_command);
 
     dgc = g_new(DropboxGeneralCommand, 1);
     dgc->dc.request_type = GENERAL_COMMAND;
+    dgc->dc.trace_id = 0;
     dgc->command_name = g_strdup(t_command);
+    dgc->metric = dropbox_metrics_command_for(t_command);
     dgc->command_args = g_hash_table_new_full((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal, (GDestroyNotify) g_free, (GDestroyNotify) g_strfreev);
+    dgc->args_data = nullptr;
+    dgc->args_data_destroy = nullptr;
 
-    /*
-     * NB: The handler is called in the DropboxCommandClient Thread.  If you need
-     * it in the main thread you must call g_idle_add in the callback.
-     */
     dgc->handler = t_h;
     dgc->handler_ud = t_ud;
+    dgc->dispatch = t_dispatch;
 
     while ((na = va_arg(ap, char *)) != nullptr)
     {
@@ -884,7 +1016,35 @@ void dropbox_command_client_send_command(DropboxCommandClient* t_dcc, NautilusDr
         is_active_arg[1] = nullptr;
     }
 
+    dropbox_command_client_request(t_dcc, (DropboxCommand *) dgc);
+}
+
+/**
+ * This function is threadsafe. This is the C API, there is another send_command_to_db
+ * that is more the actual over the wire command
+ *
+ * NB: The handler is called in the DropboxCommandClient Thread. If you need
+ * it anywhere else, use dropbox_command_client_send_command_full.
+ */
+void dropbox_command_client_send_command(DropboxCommandClient* t_dcc, NautilusDropboxCommandResponseHandler t_h, gpointer t_ud, const char* t_command, ...)
+{
+    va_list ap;
+
+    va_start(ap, t_command);
+    send_command_valist(t_dcc, DISPATCH_INLINE, t_h, t_ud, t_command, ap);
     va_end(ap);
+}
 
-    dropbox_command_client_request(t_dcc, (DropboxCommand *) dgc);
+/**
+ * Like send_command, but the handler runs where t_dispatch says.
+ *
+ * @note This function is threadsafe
+ */
+void dropbox_command_client_send_command_full(DropboxCommandClient* t_dcc, DropboxDispatchPolicy t_dispatch, NautilusDropboxCommandResponseHandler t_h, gpointer t_ud, const char* t_command, ...)
+{
+    va_list ap;
+
+    va_start(ap, t_command);
+    send_command_valist(t_dcc, t_dispatch, t_h, t_ud, t_command, ap);
+    va_end(ap);
 }
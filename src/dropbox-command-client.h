@@ -47,6 +47,11 @@
 #include <libnautilus-extension/nautilus-info-provider.h>
 #include <libnautilus-extension/nautilus-file-info.h>
 
+#include "dropbox-command-queue.h"
+#include "dropbox-completion-queue.h"
+#include "dropbox-file-path.h"
+#include "dropbox-metrics.h"
+
 G_BEGIN_DECLS
 
 /* command structs */
@@ -56,6 +61,7 @@ enum NautilusDropboxRequestType {
 
 struct DropboxCommand {
     NautilusDropboxRequestType  request_type;
+    guint64                     trace_id;
 };
 
 struct DropboxFileInfoCommand {
@@ -63,10 +69,12 @@ struct DropboxFileInfoCommand {
     NautilusInfoProvider*   provider;
     GClosure*               update_complete;
     NautilusFileInfo*       file;
+    DropboxFilePath*        path;
     gboolean                cancelled;
 };
 
 struct DropboxFileInfoCommandResponse {
+    DropboxCompletion           completion;
     DropboxFileInfoCommand*     dfic;
     GHashTable*                 file_status_response;
     GHashTable*                 folder_tag_response;
@@ -75,35 +83,53 @@ struct DropboxFileInfoCommandResponse {
 
 typedef void (*NautilusDropboxCommandResponseHandler)(GHashTable *, gpointer);
 
+/* Where the handler of a general command runs. Inline handlers run on the
+ * command thread and hold up the next request, so they should be quick.
+ * Handlers on the callback pool may run in any order. */
+enum DropboxDispatchPolicy {
+    DISPATCH_INLINE, DISPATCH_MAIN_LOOP, DISPATCH_POOL
+};
+
+/* args_data can hold whatever the values of command_args point into, it
+ * is destroyed along with the command */
 struct DropboxGeneralCommand {
     DropboxCommand                          dc;
     gchar*                                  command_name;
+    DropboxMetricsCommand                   metric;
     GHashTable*                             command_args;
+    gpointer                                args_data;
+    GDestroyNotify                          args_data_destroy;
     NautilusDropboxCommandResponseHandler   handler;
     gpointer                                handler_ud;
+    DropboxDispatchPolicy                   dispatch;
 };
 
 typedef void (*DropboxCommandClientConnectionAttemptHook)(guint, gpointer);
 typedef GHookFunc DropboxCommandClientConnectHook;
 
 struct DropboxCommandClient {
-    GMutex*         command_connected_mutex;
-    gboolean        command_connected;
-    GAsyncQueue*    command_queue; 
-    GList*          ca_hooklist;
-    GHookList       onconnect_hooklist;
-    GHookList       ondisconnect_hooklist;
+    gint                    command_connected;
+    DropboxCommandQueue     command_queue;
+    GAsyncQueue*            prefetch_queue;
+    DropboxCompletionQueue  completions;
+    GThreadPool*            callback_pool;
+    GList*                  ca_hooklist;
+    GHookList               onconnect_hooklist;
+    GHookList               ondisconnect_hooklist;
 };
 
 gboolean dropbox_command_client_is_connected(DropboxCommandClient* t_dcc);
 
 void dropbox_command_client_force_reconnect(DropboxCommandClient* t_dcc);
 void dropbox_command_client_request(DropboxCommandClient* t_dcc, DropboxCommand* t_dc);
+void dropbox_command_client_prefetch(DropboxCommandClient* t_dcc, DropboxCommand* t_dc);
+gboolean dropbox_command_client_is_prefetch_full(DropboxCommandClient* t_dcc);
 void dropbox_command_client_setup(DropboxCommandClient* t_dcc);
 void dropbox_command_client_start(DropboxCommandClient* t_dcc);
 
 void dropbox_command_client_send_simple_command(DropboxCommandClient* t_dcc, const char* t_command);
 void dropbox_command_client_send_command(DropboxCommandClient* t_dcc, NautilusDropboxCommandResponseHandler t_h, gpointer t_ud, const char* t_command, ...);
+void dropbox_command_client_send_command_full(DropboxCommandClient* t_dcc, DropboxDispatchPolicy t_dispatch, NautilusDropboxCommandResponseHandler t_h, gpointer t_ud, const char* t_command, ...);
 
 void dropbox_command_client_add_on_connect_hook(DropboxCommandClient* t_dcc, DropboxCommandClientConnectHook t_dhcch, gpointer t_ud);
 void dropbox_command_client_add_on_disconnect_hook(DropboxCommandClient* t_dcc, DropboxCommandClientConnectHook t_dhcch, gpointer t_ud);
@@ -142,9 +168,7 @@ static gpointer dropbox_command_client_thread(DropboxCommandClient* t_data);
   }
 
 #define SET_CONNECTED_STATE(s)     {      \
-      g_mutex_lock(dcc->command_connected_mutex); \
-      dcc->command_connected = s;     \
-      g_mutex_unlock(dcc->command_connected_mutex); \
+      g_atomic_int_set(&(dcc->command_connected), s); \
     }
 
 G_END_DECLS
@@ -0,0 +1,263 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <atomic>
+
+#include <glib.h>
+
+#include "dropbox-command-queue.h"
+
+/**
+ * t_capacity is rounded up to a power of two.
+ *
+ * @note This function should only be called once on initialization
+ */
+void dropbox_command_queue_init(DropboxCommandQueue* t_queue, guint t_capacity)
+{
+    gsize capacity = 2;
+
+    while (capacity < t_capacity)
+    {
+        capacity <<= 1;
+    }
+
+    t_queue->slots = g_new(DropboxCommandQueueSlot, capacity);
+    t_queue->mask = capacity - 1;
+
+    // Slot i is free for the producer that gets position i
+    for (gsize i = 0; i < capacity; i++)
+    {
+        t_queue->slots[i].sequence.store(i, std::memory_order_relaxed);
+        t_queue->slots[i].item = nullptr;
+    }
+
+    t_queue->enqueue_pos.store(0, std::memory_order_relaxed);
+    t_queue->dequeue_pos.store(0, std::memory_order_relaxed);
+
+    t_queue->overflowing.store(false, std::memory_order_relaxed);
+    g_mutex_init(&(t_queue->overflow_mutex));
+    g_queue_init(&(t_queue->overflow));
+    g_queue_init(&(t_queue->drained));
+
+    t_queue->sleeping.store(false, std::memory_order_relaxed);
+    g_mutex_init(&(t_queue->wait_mutex));
+    g_cond_init(&(t_queue->wait_cond));
+}
+
+/**
+ * Frees the queue, anything still in it is dropped.
+ */
+void dropbox_command_queue_clear(DropboxCommandQueue* t_queue)
+{
+    g_free(t_queue->slots);
+    t_queue->slots = nullptr;
+
+    g_queue_clear(&(t_queue->overflow));
+    g_queue_clear(&(t_queue->drained));
+    g_mutex_clear(&(t_queue->overflow_mutex));
+    g_mutex_clear(&(t_queue->wait_mutex));
+    g_cond_clear(&(t_queue->wait_cond));
+}
+
+static gboolean ring_try_push(DropboxCommandQueue* t_queue, gpointer t_item)
+{
+    gsize pos = t_queue->enqueue_pos.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        DropboxCommandQueueSlot* slot = &(t_queue->slots[pos & t_queue->mask]);
+        gsize sequence = slot->sequence.load(std::memory_order_acquire);
+        gssize diff = (gssize) sequence - (gssize) pos;
+
+        if (diff == 0)
+        {
+            // The slot is free, claim the position unless another producer beat us to it
+            if (t_queue->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                slot->item = t_item;
+                slot->sequence.store(pos + 1, std::memory_order_release);
+
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            // The consumer hasn't taken the item a full lap ago yet, we're full
+            return false;
+        }
+        else
+        {
+            pos = t_queue->enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/*
+ * Only called by the consumer.
+ * Sets t_empty when there's nothing in the ring, as opposed to a producer
+ * having claimed the next slot without filling it yet.
+ */
+static gpointer ring_try_pop(DropboxCommandQueue* t_queue, gboolean* t_empty)
+{
+    gsize pos = t_queue->dequeue_pos.load(std::memory_order_relaxed);
+    DropboxCommandQueueSlot* slot = &(t_queue->slots[pos & t_queue->mask]);
+    gsize sequence = slot->sequence.load(std::memory_order_acquire);
+
+    if (sequence != pos + 1)
+    {
+        *t_empty = t_queue->enqueue_pos.load(std::memory_order_relaxed) == pos;
+        return nullptr;
+    }
+
+    gpointer item = slot->item;
+
+    // Hand the slot to the producer one lap ahead
+    slot->sequence.store(pos + t_queue->mask + 1, std::memory_order_release);
+    t_queue->dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+
+    return item;
+}
+
+static void wake_consumer(DropboxCommandQueue* t_queue)
+{
+    // Pairs with the fence in timeout_pop, either we see it sleeping or it sees our item
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (t_queue->sleeping.load(std::memory_order_relaxed))
+    {
+        g_mutex_lock(&(t_queue->wait_mutex));
+        g_cond_signal(&(t_queue->wait_cond));
+        g_mutex_unlock(&(t_queue->wait_mutex));
+    }
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void dropbox_command_queue_push(DropboxCommandQueue* t_queue, gpointer t_item)
+{
+    // While there is an overflow, new items have to queue up behind it
+    if (!t_queue->overflowing.load(std::memory_order_acquire) && ring_try_push(t_queue, t_item))
+    {
+        wake_consumer(t_queue);
+        return;
+    }
+
+    g_mutex_lock(&(t_queue->overflow_mutex));
+
+    // The consumer may have emptied the overflow in the meantime
+    if (t_queue->overflowing.load(std::memory_order_relaxed) || !ring_try_push(t_queue, t_item))
+    {
+        g_queue_push_tail(&(t_queue->overflow), t_item);
+        t_queue->overflowing.store(true, std::memory_order_release);
+    }
+
+    g_mutex_unlock(&(t_queue->overflow_mutex));
+
+    wake_consumer(t_queue);
+}
+
+/**
+ * Returns:
+ * The oldest item, or NULL if the queue is empty.
+ *
+ * @note Only call this from the consumer thread
+ */
+gpointer dropbox_command_queue_try_pop(DropboxCommandQueue* t_queue)
+{
+    gboolean empty = false;
+
+    // What was taken from the overflow is older than anything pushed since
+    if (!g_queue_is_empty(&(t_queue->drained)))
+    {
+        return g_queue_pop_head(&(t_queue->drained));
+    }
+
+    gpointer item = ring_try_pop(t_queue, &empty);
+
+    if (item != nullptr || !empty || !t_queue->overflowing.load(std::memory_order_acquire))
+    {
+        return item;
+    }
+
+    // The ring is empty, so everything that is older than the overflow has been taken
+    g_mutex_lock(&(t_queue->overflow_mutex));
+    t_queue->drained = t_queue->overflow;
+    g_queue_init(&(t_queue->overflow));
+    t_queue->overflowing.store(false, std::memory_order_release);
+    g_mutex_unlock(&(t_queue->overflow_mutex));
+
+    return g_queue_pop_head(&(t_queue->drained));
+}
+
+/**
+ * Like try_pop, but waits up to t_timeout microseconds for an item.
+ *
+ * @note Only call this from the consumer thread
+ */
+gpointer dropbox_command_queue_timeout_pop(DropboxCommandQueue* t_queue, guint64 t_timeout)
+{
+    gpointer item = dropbox_command_queue_try_pop(t_queue);
+
+    if (item != nullptr)
+    {
+        return item;
+    }
+
+    gint64 end_time = g_get_monotonic_time() + t_timeout;
+
+    g_mutex_lock(&(t_queue->wait_mutex));
+    t_queue->sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Look again, a push that didn't see us sleeping must be visible by now
+    while ((item = dropbox_command_queue_try_pop(t_queue)) == nullptr)
+    {
+        if (!g_cond_wait_until(&(t_queue->wait_cond), &(t_queue->wait_mutex), end_time))
+        {
+            item = dropbox_command_queue_try_pop(t_queue);
+            break;
+        }
+    }
+
+    t_queue->sleeping.store(false, std::memory_order_relaxed);
+    g_mutex_unlock(&(t_queue->wait_mutex));
+
+    return item;
+}
+
+/**
+ * Returns:
+ * Roughly the number of queued items, pushes and pops may be going on meanwhile.
+ *
+ * @note This function is threadsafe
+ */
+guint dropbox_command_queue_length(DropboxCommandQueue* t_queue)
+{
+    gsize dequeued = t_queue->dequeue_pos.load(std::memory_order_relaxed);
+    gsize enqueued = t_queue->enqueue_pos.load(std::memory_order_relaxed);
+    guint length = enqueued > dequeued ? (guint) (enqueued - dequeued) : 0;
+
+    g_mutex_lock(&(t_queue->overflow_mutex));
+    length += g_queue_get_length(&(t_queue->overflow));
+    g_mutex_unlock(&(t_queue->overflow_mutex));
+
+    return length;
+}
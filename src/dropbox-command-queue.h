@@ -0,0 +1,82 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_COMMAND_QUEUE_H
+#define DROPBOX_COMMAND_QUEUE_H
+
+#include <atomic>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Queue of requests from any number of threads to the single command thread.
+ *
+ * Requests go into a bounded ring without taking a lock, every slot carries a
+ * sequence number that tells producers and the consumer whose turn it is.
+ * Should the ring ever fill up, requests spill into a locked overflow list
+ * until the consumer takes it over in one go, so pushing never blocks.
+ *
+ * The consumer only sleeps when the queue is empty, producers only touch the
+ * condition when they see it sleeping.
+ */
+struct DropboxCommandQueueSlot
+{
+    std::atomic<gsize>      sequence;
+    gpointer                item;
+};
+
+struct DropboxCommandQueue
+{
+    DropboxCommandQueueSlot*    slots;
+    gsize                       mask;
+
+    /* Kept apart so producers and the consumer don't share a cache line. This is
+     * padding rather than alignas, the queue lives inside a GObject instance
+     * which makes no promises about alignment. */
+    std::atomic<gsize>          enqueue_pos;
+    gchar                       enqueue_pad[64];
+    std::atomic<gsize>          dequeue_pos;
+    gchar                       dequeue_pad[64];
+
+    std::atomic<gboolean>       overflowing;
+    GMutex                      overflow_mutex;
+    GQueue                      overflow;
+
+    // Only touched by the consumer
+    GQueue                      drained;
+
+    std::atomic<gboolean>       sleeping;
+    GMutex                      wait_mutex;
+    GCond                       wait_cond;
+};
+
+void dropbox_command_queue_init(DropboxCommandQueue* t_queue, guint t_capacity);
+void dropbox_command_queue_clear(DropboxCommandQueue* t_queue);
+
+void dropbox_command_queue_push(DropboxCommandQueue* t_queue, gpointer t_item);
+gpointer dropbox_command_queue_try_pop(DropboxCommandQueue* t_queue);
+gpointer dropbox_command_queue_timeout_pop(DropboxCommandQueue* t_queue, guint64 t_timeout);
+guint dropbox_command_queue_length(DropboxCommandQueue* t_queue);
+
+G_END_DECLS
+
+#endif
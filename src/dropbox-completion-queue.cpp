@@ -0,0 +1,268 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include <glib.h>
+
+#include "g-util.h"
+#include "dropbox-completion-queue.h"
+#include "dropbox-trace.h"
+
+struct CompletionSource
+{
+    GSource                     source;
+    DropboxCompletionQueue*     queue;
+};
+
+/* Looking at the clock isn't free, only do it every so many completions */
+static const guint COMPLETION_CLOCK_INTERVAL = 8;
+
+static void list_append(DropboxCompletionList* t_list, DropboxCompletion* t_completion)
+{
+    t_completion->next = nullptr;
+
+    if (t_list->tail != nullptr)
+    {
+        t_list->tail->next = t_completion;
+    }
+    else
+    {
+        t_list->head = t_completion;
+    }
+
+    t_list->tail = t_completion;
+}
+
+static DropboxCompletion* list_pop(DropboxCompletionList* t_list)
+{
+    DropboxCompletion* completion = t_list->head;
+
+    if (completion != nullptr)
+    {
+        t_list->head = completion->next;
+
+        if (t_list->head == nullptr)
+        {
+            t_list->tail = nullptr;
+        }
+    }
+
+    return completion;
+}
+
+static gboolean has_pending(DropboxCompletionQueue* t_queue)
+{
+    return t_queue->urgent.head != nullptr || t_queue->pending.head != nullptr;
+}
+
+/* Work left over from the last dispatch makes us ready right away */
+static gboolean completion_source_prepare(GSource* t_source, gint* t_timeout)
+{
+    *t_timeout = -1;
+
+    return has_pending(((CompletionSource *) t_source)->queue);
+}
+
+static gboolean completion_source_check(GSource* t_source)
+{
+    return has_pending(((CompletionSource *) t_source)->queue);
+}
+
+static gboolean completion_source_dispatch(GSource* t_source, GSourceFunc t_callback, gpointer t_ud)
+{
+    DropboxCompletionQueue* queue = ((CompletionSource *) t_source)->queue;
+    // Reset the wakeup before taking the stack, pushes after this wake us again
+    if (queue->fd >= 0)
+    {
+        guint64 count;
+        ssize_t ignored = read(queue->fd, &count, sizeof(count));
+        (void) ignored;
+    }
+    else
+    {
+        g_source_set_ready_time(t_source, -1);
+    }
+
+    DropboxCompletion* completion = queue->head.exchange(nullptr, std::memory_order_acquire);
+    DropboxCompletion* ordered = nullptr;
+
+    // The stack holds the newest completion first
+    while (completion != nullptr)
+    {
+        DropboxCompletion* next = completion->next;
+
+        completion->next = ordered;
+        ordered = completion;
+        completion = next;
+    }
+
+    while (ordered != nullptr)
+    {
+        DropboxCompletion* next = ordered->next;
+        gboolean urgent = queue->urgent_func != nullptr && queue->urgent_func(ordered, queue->ud);
+
+        list_append(urgent ? &(queue->urgent) : &(queue->pending), ordered);
+        ordered = next;
+    }
+
+    gint64 start = g_get_monotonic_time();
+    gint64 now = start;
+    guint count = 0;
+
+    while ((completion = list_pop(&(queue->urgent))) != nullptr || (completion = list_pop(&(queue->pending))) != nullptr)
+    {
+        queue->func(completion, queue->ud);
+
+        if (queue->budget > 0 && ++count % COMPLETION_CLOCK_INTERVAL == 0 && (now = g_get_monotonic_time()) - start >= queue->budget)
+        {
+            if (has_pending(queue))
+            {
+                debug("finished %u completions, continuing next iteration", count);
+                queue->deferred++;
+            }
+
+            break;
+        }
+    }
+
+    if (queue->budget > 0)
+    {
+        // A single slow completion can take us over, not just too many of them
+        if (count % COMPLETION_CLOCK_INTERVAL != 0)
+        {
+            now = g_get_monotonic_time();
+        }
+
+        if (now - start > queue->budget)
+        {
+            queue->over_budget++;
+        }
+    }
+
+    queue->batches++;
+    dropbox_trace_complete("completion_batch", start, 0);
+
+    return true;
+}
+
+static GSourceFuncs completion_source_funcs = {
+    completion_source_prepare,
+    completion_source_check,
+    completion_source_dispatch,
+    nullptr
+};
+
+/**
+ * Attaches the source to the default main context, t_func is called there
+ * for every completion.
+ *
+ * @note This function should only be called once on initialization
+ */
+void dropbox_completion_queue_init(DropboxCompletionQueue* t_queue, DropboxCompletionFunc t_func, gpointer t_ud)
+{
+    t_queue->head.store(nullptr, std::memory_order_relaxed);
+    t_queue->func = t_func;
+    t_queue->urgent_func = nullptr;
+    t_queue->ud = t_ud;
+
+    t_queue->urgent.head = t_queue->urgent.tail = nullptr;
+    t_queue->pending.head = t_queue->pending.tail = nullptr;
+    t_queue->budget = 0;
+    t_queue->batches = 0;
+    t_queue->over_budget = 0;
+    t_queue->deferred = 0;
+
+    t_queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    t_queue->source = g_source_new(&completion_source_funcs, sizeof(CompletionSource));
+    ((CompletionSource *) t_queue->source)->queue = t_queue;
+    g_source_set_name(t_queue->source, "dropbox-completions");
+
+    // Like the idle sources this replaces, so redraws and input go first
+    g_source_set_priority(t_queue->source, G_PRIORITY_DEFAULT_IDLE);
+
+    // Without an eventfd, the ready time wakes the context as well, just less cheaply
+    if (t_queue->fd >= 0)
+    {
+        g_source_add_unix_fd(t_queue->source, t_queue->fd, G_IO_IN);
+    }
+    else
+    {
+        dropbox_log_warning("could not create an eventfd for completions, falling back to ready times");
+    }
+
+    g_source_attach(t_queue->source, nullptr);
+}
+
+/**
+ * Limits the time a dispatch may spend on completions to t_budget
+ * microseconds, 0 means no limit.
+ *
+ * @note Only call this on the main loop
+ */
+void dropbox_completion_queue_set_budget(DropboxCompletionQueue* t_queue, gint64 t_budget)
+{
+    t_queue->budget = t_budget;
+}
+
+/**
+ * t_func is called with the queue's user data once for every completion as
+ * it reaches the main loop. Completions it returns true for skip ahead of the
+ * ones that are still waiting.
+ *
+ * @note Only call this on the main loop
+ */
+void dropbox_completion_queue_set_urgent_func(DropboxCompletionQueue* t_queue, DropboxCompletionUrgentFunc t_func)
+{
+    t_queue->urgent_func = t_func;
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void dropbox_completion_queue_push(DropboxCompletionQueue* t_queue, DropboxCompletion* t_completion)
+{
+    DropboxCompletion* head = t_queue->head.load(std::memory_order_relaxed);
+
+    do
+    {
+        t_completion->next = head;
+    }
+    while (!t_queue->head.compare_exchange_weak(head, t_completion, std::memory_order_release, std::memory_order_relaxed));
+
+    // Whoever found the stack empty wakes the main loop, the others ride along
+    if (head == nullptr)
+    {
+        guint64 one = 1;
+
+        if (t_queue->fd < 0)
+        {
+            g_source_set_ready_time(t_queue->source, 0);
+        }
+        else if (write(t_queue->fd, &one, sizeof(one)) < 0)
+        {
+            debug("could not wake the main loop for completions");
+        }
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_COMPLETION_QUEUE_H
+#define DROPBOX_COMPLETION_QUEUE_H
+
+#include <atomic>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Hands finished requests from the command thread to the main loop.
+ *
+ * Completions are pushed onto a lock-free stack. A single main loop source
+ * takes the whole stack at once and calls the handler for every completion in
+ * the order they were pushed. The source is woken through an eventfd, which
+ * is only written when the stack was empty, so a burst of replies costs one
+ * wakeup rather than one idle source per file.
+ *
+ * With a budget set, a dispatch stops once it has used up its time and leaves
+ * the rest for the next main loop iteration, so nautilus gets to redraw in
+ * between. Completions the urgent function picks out are handled first.
+ */
+struct DropboxCompletion
+{
+    DropboxCompletion*  next;
+};
+
+typedef void (*DropboxCompletionFunc)(DropboxCompletion*, gpointer);
+typedef gboolean (*DropboxCompletionUrgentFunc)(DropboxCompletion*, gpointer);
+
+struct DropboxCompletionList
+{
+    DropboxCompletion*  head;
+    DropboxCompletion*  tail;
+};
+
+struct DropboxCompletionQueue
+{
+    std::atomic<DropboxCompletion*> head;
+    gint                            fd;
+    GSource*                        source;
+    DropboxCompletionFunc           func;
+    DropboxCompletionUrgentFunc     urgent_func;
+    gpointer                        ud;
+
+    // Only touched on the main loop
+    DropboxCompletionList           urgent;
+    DropboxCompletionList           pending;
+    gint64                          budget;
+
+    // Dispatches, those that took longer than the budget, and those that left work behind
+    guint64                         batches;
+    guint64                         over_budget;
+    guint64                         deferred;
+};
+
+void dropbox_completion_queue_init(DropboxCompletionQueue* t_queue, DropboxCompletionFunc t_func, gpointer t_ud);
+void dropbox_completion_queue_set_budget(DropboxCompletionQueue* t_queue, gint64 t_budget);
+void dropbox_completion_queue_set_urgent_func(DropboxCompletionQueue* t_queue, DropboxCompletionUrgentFunc t_func);
+void dropbox_completion_queue_push(DropboxCompletionQueue* t_queue, DropboxCompletion* t_completion);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "g-util.h"
+#include "dropbox-file-path.h"
+#include "dropbox-metrics.h"
+#include "dropbox-path-util.h"
+
+static GQuark file_path_quark()
+{
+    static GQuark quark = 0;
+
+    if (quark == 0)
+    {
+        quark = g_quark_from_static_string("dropbox-file-path");
+    }
+
+    return quark;
+}
+
+static guint next_generation()
+{
+    static gint last_generation = 0;
+
+    return (guint) g_atomic_int_add(&last_generation, 1) + 1;
+}
+
+/* Takes ownership of t_uri */
+static DropboxFilePath* file_path_new(gchar* t_uri)
+{
+    DropboxFilePath* file_path = g_new0(DropboxFilePath, 1);
+    gchar* filename;
+
+    file_path->ref_count = 1;
+    file_path->uri = t_uri;
+    file_path->generation = next_generation();
+
+    filename = t_uri != nullptr ? g_filename_from_uri(t_uri, nullptr, nullptr) : nullptr;
+
+    // Not a local file
+    if (filename == nullptr)
+    {
+        return file_path;
+    }
+
+    if (!dropbox_path_util_canonicalize_in_place(filename))
+    {
+        file_path->invalid = true;
+        g_free(filename);
+
+        return file_path;
+    }
+
+    const gchar** charsets;
+
+    // No need to convert if the filesystem encoding already is UTF-8
+    if (g_get_filename_charsets(&charsets))
+    {
+        if (g_utf8_validate(filename, -1, nullptr))
+        {
+            file_path->path = filename;
+        }
+        else
+        {
+            g_free(filename);
+        }
+    }
+    else
+    {
+        file_path->path = g_filename_to_utf8(filename, -1, nullptr, nullptr, nullptr);
+        g_free(filename);
+    }
+
+    if (file_path->path == nullptr)
+    {
+        // Oooh, filename wasn't correctly encoded
+        debug("file wasn't correctly encoded %s", t_uri);
+    }
+    else
+    {
+        file_path->hash = dropbox_path_util_hash(file_path->path);
+    }
+
+    return file_path;
+}
+
+/**
+ * Returns the path of t_file, decoding it only if its URI changed since the last call.
+ * The returned path belongs to the file, take a reference to keep it around.
+ *
+ * @note Only call this on the main loop
+ */
+DropboxFilePath* dropbox_file_path_get(NautilusFileInfo* t_file)
+{
+    return dropbox_file_path_get_for_uri(t_file, nautilus_file_info_get_uri(t_file));
+}
+
+/**
+ * Like dropbox_file_path_get, for callers that already fetched the URI of t_file.
+ * Takes ownership of t_uri.
+ *
+ * @note Only call this on the main loop
+ */
+DropboxFilePath* dropbox_file_path_get_for_uri(NautilusFileInfo* t_file, gchar* t_uri)
+{
+    DropboxFilePath* file_path;
+
+    file_path = (DropboxFilePath *) g_object_get_qdata(G_OBJECT(t_file), file_path_quark());
+
+    if (file_path != nullptr && g_strcmp0(file_path->uri, t_uri) == 0)
+    {
+        dropbox_metrics_count(METRIC_FILE_PATH_HITS);
+        g_free(t_uri);
+        return file_path;
+    }
+
+    dropbox_metrics_count(METRIC_FILE_PATH_MISSES);
+
+    // This drops our reference to the path of the old URI
+    file_path = file_path_new(t_uri);
+    g_object_set_qdata_full(G_OBJECT(t_file), file_path_quark(), file_path, (GDestroyNotify) dropbox_file_path_unref);
+
+    return file_path;
+}
+
+/* Below this many files per thread, handing them to the pool costs more than it saves */
+static const guint PARALLEL_DECODE_MIN = 1024;
+
+/* The chunks of one selection, the main loop waits until the pool is done with all of them */
+struct DecodeJob
+{
+    GMutex              mutex;
+    GCond               done;
+    guint               remaining;
+};
+
+struct DecodeChunk
+{
+    gchar**             uris;
+    DropboxFilePath**   paths;
+    guint               count;
+    DecodeJob*          job;
+};
+
+static void decode_chunk(DecodeChunk* t_chunk)
+{
+    for (guint i = 0; i < t_chunk->count; i++)
+    {
+        t_chunk->paths[i] = file_path_new(t_chunk->uris[i]);
+    }
+}
+
+static void pool_decode_chunk(DecodeChunk* t_chunk, gpointer t_ud)
+{
+    DecodeJob* job = t_chunk->job;
+
+    decode_chunk(t_chunk);
+
+    g_mutex_lock(&(job->mutex));
+
+    if (--job->remaining == 0)
+    {
+        g_cond_signal(&(job->done));
+    }
+
+    g_mutex_unlock(&(job->mutex));
+}
+
+/* Shared by every big selection, so their threads are only started once */
+static GThreadPool* decode_pool(guint t_threads)
+{
+    static GThreadPool* pool = nullptr;
+
+    if (pool == nullptr)
+    {
+        pool = g_thread_pool_new((GFunc) pool_decode_chunk, nullptr, t_threads, false, nullptr);
+    }
+
+    return pool;
+}
+
+/* Decodes t_count URIs, spread over as many threads as it's worth */
+static void decode_uris(gchar** t_uris, DropboxFilePath** t_paths, guint t_count)
+{
+    guint processors = g_get_num_processors();
+    guint n_chunks = MIN(processors, t_count / PARALLEL_DECODE_MIN);
+
+    if (n_chunks <= 1)
+    {
+        DecodeChunk chunk = { t_uris, t_paths, t_count, nullptr };
+        decode_chunk(&chunk);
+
+        return;
+    }
+
+    DecodeChunk* chunks = g_new(DecodeChunk, n_chunks);
+    guint per_chunk = (t_count + n_chunks - 1) / n_chunks;
+    DecodeJob job;
+
+    g_mutex_init(&(job.mutex));
+    g_cond_init(&(job.done));
+    job.remaining = n_chunks - 1;
+
+    for (guint c = 0; c < n_chunks; c++)
+    {
+        guint start = MIN(c * per_chunk, t_count);
+
+        chunks[c].uris = t_uris + start;
+        chunks[c].paths = t_paths + start;
+        chunks[c].count = MIN(per_chunk, t_count - start);
+        chunks[c].job = &job;
+    }
+
+    // This thread takes the first chunk itself
+    GThreadPool* pool = decode_pool(processors - 1);
+
+    for (guint c = 1; c < n_chunks; c++)
+    {
+        g_thread_pool_push(pool, &(chunks[c]), nullptr);
+    }
+
+    decode_chunk(&(chunks[0]));
+
+    g_mutex_lock(&(job.mutex));
+
+    while (job.remaining > 0)
+    {
+        g_cond_wait(&(job.done), &(job.mutex));
+    }
+
+    g_mutex_unlock(&(job.mutex));
+
+    g_cond_clear(&(job.done));
+    g_mutex_clear(&(job.mutex));
+    g_free(chunks);
+}
+
+/**
+ * Does dropbox_file_path_get for every file in t_files at once. The files
+ * whose path isn't cached yet are decoded together, on several threads if
+ * there are enough of them.
+ *
+ * The paths belong to the files, take a reference to keep them around.
+ *
+ * @note Only call this on the main loop
+ */
+void dropbox_file_path_get_all(NautilusFileInfo** t_files, guint t_count, DropboxFilePath** t_paths)
+{
+    guint* missing = g_new(guint, t_count);
+    gchar** uris = g_new(gchar *, t_count);
+    DropboxFilePath** decoded = g_new(DropboxFilePath *, t_count);
+    guint n_missing = 0;
+
+    // Only nautilus' own calls have to happen on this thread
+    for (guint i = 0; i < t_count; i++)
+    {
+        gchar* uri = nautilus_file_info_get_uri(t_files[i]);
+        DropboxFilePath* file_path = (DropboxFilePath *) g_object_get_qdata(G_OBJECT(t_files[i]), file_path_quark());
+
+        if (file_path != nullptr && g_strcmp0(file_path->uri, uri) == 0)
+        {
+            t_paths[i] = file_path;
+            g_free(uri);
+        }
+        else
+        {
+            missing[n_missing] = i;
+            uris[n_missing] = uri;
+            n_missing++;
+        }
+    }
+
+    dropbox_metrics_add(METRIC_FILE_PATH_HITS, t_count - n_missing);
+    dropbox_metrics_add(METRIC_FILE_PATH_MISSES, n_missing);
+
+    decode_uris(uris, decoded, n_missing);
+
+    for (guint j = 0; j < n_missing; j++)
+    {
+        guint i = missing[j];
+        DropboxFilePath* file_path = (DropboxFilePath *) g_object_get_qdata(G_OBJECT(t_files[i]), file_path_quark());
+
+        // The same file may be listed twice, keep the path the first one got
+        if (file_path != nullptr && g_strcmp0(file_path->uri, decoded[j]->uri) == 0)
+        {
+            dropbox_file_path_unref(decoded[j]);
+            t_paths[i] = file_path;
+
+            continue;
+        }
+
+        g_object_set_qdata_full(G_OBJECT(t_files[i]), file_path_quark(), decoded[j], (GDestroyNotify) dropbox_file_path_unref);
+        t_paths[i] = decoded[j];
+    }
+
+    g_free(decoded);
+    g_free(uris);
+    g_free(missing);
+}
+
+/**
+ * Gives the path a new generation, after dropbox told us the file changed.
+ *
+ * @note Only call this on the main loop
+ */
+void dropbox_file_path_touch(DropboxFilePath* t_path)
+{
+    t_path->generation = next_generation();
+}
+
+/**
+ * @note This function is threadsafe
+ */
+DropboxFilePath* dropbox_file_path_ref(DropboxFilePath* t_path)
+{
+    g_atomic_int_inc(&(t_path->ref_count));
+
+    return t_path;
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void dropbox_file_path_unref(DropboxFilePath* t_path)
+{
+    if (g_atomic_int_dec_and_test(&(t_path->ref_count)))
+    {
+        g_free(t_path->uri);
+        g_free(t_path->path);
+        g_free(t_path);
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_FILE_PATH_H
+#define DROPBOX_FILE_PATH_H
+
+#include <glib.h>
+
+#include <libnautilus-extension/nautilus-file-info.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The decoded, canonical UTF-8 path of a file object, cached on the object
+ * itself so the URI only has to be decoded once. The cache is keyed on the
+ * URI, so a renamed file gets a fresh entry.
+ *
+ * path is NULL if the file isn't local or its name isn't valid UTF-8,
+ * invalid is set if it is local but the path couldn't be canonicalized.
+ *
+ * generation changes whenever dropbox reports a change to the file, and is
+ * never reused, so anything derived from its status can be keyed on it.
+ */
+struct DropboxFilePath
+{
+    gint        ref_count;
+    gchar*      uri;
+    gchar*      path;
+    guint64     hash;
+    guint       generation;
+    gboolean    invalid;
+};
+
+DropboxFilePath* dropbox_file_path_get(NautilusFileInfo* t_file);
+DropboxFilePath* dropbox_file_path_get_for_uri(NautilusFileInfo* t_file, gchar* t_uri);
+void dropbox_file_path_get_all(NautilusFileInfo** t_files, guint t_count, DropboxFilePath** t_paths);
+
+void dropbox_file_path_touch(DropboxFilePath* t_path);
+
+DropboxFilePath* dropbox_file_path_ref(DropboxFilePath* t_path);
+void dropbox_file_path_unref(DropboxFilePath* t_path);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include <atomic>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "dropbox-log.h"
+
+/* The last this many events are kept, about three quarters of a megabyte */
+static const guint LOG_CAPACITY = 4096;
+
+/* How often the flusher looks for new events when nothing urgent comes in */
+static const gint64 FLUSH_INTERVAL_USEC = G_USEC_PER_SEC / 4;
+
+static const gchar* level_names[] = { "TRACE", "DEBUG", "INFO", "WARNING", "ERROR" };
+
+// Static, so calls made before init are kept as well
+static DropboxLogEvent events[LOG_CAPACITY];
+static std::atomic<guint64> next_event(0);
+static gint64 started = 0;
+
+#ifdef ND_DEBUG
+static std::atomic<gint> output_level(DROPBOX_LOG_TRACE);
+#else
+static std::atomic<gint> output_level(DROPBOX_LOG_WARNING);
+#endif
+
+static GMutex flush_mutex;
+static GCond flush_cond;
+static std::atomic<bool> flusher_running(false);
+static std::atomic<bool> dumped_on_error(false);
+
+static gboolean format_event(guint64 t_index, gint t_level, GString* t_out);
+static void write_all(gint t_fd, GString* t_out);
+
+static gint current_tid()
+{
+    static thread_local gint tid = 0;
+
+    if (tid == 0)
+    {
+        tid = (gint) syscall(SYS_gettid);
+    }
+
+    return tid;
+}
+
+/**
+ * Returns a slot for the caller to fill in, t_index identifies it to publish.
+ *
+ * @note This function is threadsafe
+ */
+DropboxLogEvent* dropbox_log_claim(guint64* t_index)
+{
+    *t_index = next_event.fetch_add(1, std::memory_order_relaxed);
+    DropboxLogEvent* event = &(events[*t_index % LOG_CAPACITY]);
+
+    // Readers skip the slot while it is being written
+    event->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    event->timestamp = g_get_monotonic_time();
+    event->tid = current_tid();
+
+    return event;
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void dropbox_log_publish(DropboxLogEvent* t_event, guint64 t_index)
+{
+    t_event->sequence.store(t_index + 1, std::memory_order_release);
+
+    // Warnings and errors shouldn't wait for the next flush
+    if (t_event->site->level < DROPBOX_LOG_WARNING)
+    {
+        return;
+    }
+
+    // The first error comes with what led up to it, the ring has that whatever the level
+    if (t_event->site->level >= DROPBOX_LOG_ERROR && !dumped_on_error.exchange(true))
+    {
+        dropbox_log_dump(STDERR_FILENO);
+    }
+    else if (flusher_running.load(std::memory_order_acquire))
+    {
+        g_mutex_lock(&flush_mutex);
+        g_cond_signal(&flush_cond);
+        g_mutex_unlock(&flush_mutex);
+    }
+    else if (t_event->site->level >= output_level.load(std::memory_order_relaxed))
+    {
+        GString* out = g_string_new(nullptr);
+
+        format_event(t_index, DROPBOX_LOG_TRACE, out);
+        write_all(STDERR_FILENO, out);
+        g_string_free(out, true);
+    }
+}
+
+/*
+ * Formats the event at t_index into t_out.
+ *
+ * Returns:
+ * false if it was overwritten or is still being written.
+ */
+static gboolean format_event(guint64 t_index, gint t_level, GString* t_out)
+{
+    DropboxLogEvent* slot = &(events[t_index % LOG_CAPACITY]);
+
+    if (slot->sequence.load(std::memory_order_acquire) != t_index + 1)
+    {
+        return false;
+    }
+
+    DropboxLogEvent event;
+
+    event.timestamp = slot->timestamp;
+    event.site = slot->site;
+    event.format = slot->format;
+    event.tid = slot->tid;
+    memcpy(event.payload, slot->payload, sizeof(event.payload));
+
+    // A writer may have lapped us while we copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (slot->sequence.load(std::memory_order_relaxed) != t_index + 1)
+    {
+        return false;
+    }
+
+    if (event.site->level < t_level)
+    {
+        return true;
+    }
+
+    gint64 since = event.timestamp - started;
+
+    g_string_append_printf(t_out, "[%5" G_GINT64_FORMAT ".%06" G_GINT64_FORMAT "] %-7s %d %s: ",
+        since / G_USEC_PER_SEC, since % G_USEC_PER_SEC, level_names[event.site->level], event.tid, event.site->function);
+    event.format(t_out, event.site->format, event.payload);
+    g_string_append_c(t_out, '\n');
+
+    return true;
+}
+
+static void write_all(gint t_fd, GString* t_out)
+{
+    gsize written = 0;
+
+    while (written < t_out->len)
+    {
+        ssize_t result = write(t_fd, t_out->str + written, t_out->len - written);
+
+        if (result <= 0)
+        {
+            break;
+        }
+
+        written += result;
+    }
+}
+
+static gpointer flusher_thread(gpointer t_ud)
+{
+    guint64 flushed = GPOINTER_TO_SIZE(t_ud);
+    GString* out = g_string_new(nullptr);
+
+    while (true)
+    {
+        g_mutex_lock(&flush_mutex);
+        g_cond_wait_until(&flush_cond, &flush_mutex, g_get_monotonic_time() + FLUSH_INTERVAL_USEC);
+        g_mutex_unlock(&flush_mutex);
+
+        guint64 end = next_event.load(std::memory_order_acquire);
+
+        if (end - flushed > LOG_CAPACITY)
+        {
+            g_string_append_printf(out, "%" G_GUINT64_FORMAT " log events lost\n", end - flushed - LOG_CAPACITY);
+            flushed = end - LOG_CAPACITY;
+        }
+
+        // Stop at the first event that is still being written, it's picked up next time
+        while (flushed < end && format_event(flushed, output_level.load(std::memory_order_relaxed), out))
+        {
+            flushed++;
+        }
+
+        write_all(STDERR_FILENO, out);
+        g_string_truncate(out, 0);
+    }
+
+    return nullptr;
+}
+
+static gboolean dump_on_signal(gpointer t_ud)
+{
+    dropbox_log_dump(STDERR_FILENO);
+
+    return true;
+}
+
+/*
+ * Dumps the ring on the way down. This allocates, which isn't safe in a
+ * signal handler, but at worst the dump is lost along with the process.
+ */
+static void dump_on_crash(int t_signal)
+{
+    dropbox_log_dump(STDERR_FILENO);
+
+    // The default action is back in place by now
+    raise(t_signal);
+}
+
+/* Nautilus and the other extensions share our signals, leave the ones they use alone */
+static gboolean signal_is_unused(int t_signal)
+{
+    struct sigaction current;
+
+    return sigaction(t_signal, nullptr, &current) == 0 && !(current.sa_flags & SA_SIGINFO) && current.sa_handler == SIG_DFL;
+}
+
+static void install_crash_handler(int t_signal)
+{
+    struct sigaction action;
+
+    if (!signal_is_unused(t_signal))
+    {
+        return;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = dump_on_crash;
+    action.sa_flags = SA_RESETHAND | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(t_signal, &action, nullptr);
+}
+
+/**
+ * Writes every event still in the ring to t_fd, whatever its level.
+ *
+ * @note This function is threadsafe
+ */
+void dropbox_log_dump(gint t_fd)
+{
+    guint64 end = next_event.load(std::memory_order_acquire);
+    guint64 start = end > LOG_CAPACITY ? end - LOG_CAPACITY : 0;
+    GString* out = g_string_new("recent log events:\n");
+
+    for (guint64 index = start; index < end; index++)
+    {
+        format_event(index, DROPBOX_LOG_TRACE, out);
+    }
+
+    write_all(t_fd, out);
+    g_string_free(out, true);
+}
+
+/**
+ * Sets up the ways to get at the ring, SIGUSR1 and crashes, then reads
+ * DNA_LOG_LEVEL, and starts writing the log if it is set or this is a
+ * debug build.
+ *
+ * @note Only call this on the main loop, once on initialization
+ */
+void dropbox_log_init()
+{
+    const gchar* level = g_getenv("DNA_LOG_LEVEL");
+
+    started = g_get_monotonic_time();
+
+    if (signal_is_unused(SIGUSR1))
+    {
+        g_unix_signal_add(SIGUSR1, dump_on_signal, nullptr);
+    }
+
+    install_crash_handler(SIGSEGV);
+    install_crash_handler(SIGBUS);
+    install_crash_handler(SIGILL);
+    install_crash_handler(SIGFPE);
+    install_crash_handler(SIGABRT);
+
+    if (level == nullptr || level[0] == '\0')
+    {
+#ifdef ND_DEBUG
+        dropbox_log_start(DROPBOX_LOG_TRACE);
+#endif
+        return;
+    }
+
+    gint chosen = output_level.load(std::memory_order_relaxed);
+
+    for (gint i = 0; i < (gint) G_N_ELEMENTS(level_names); i++)
+    {
+        if (g_ascii_strcasecmp(level, level_names[i]) == 0)
+        {
+            chosen = i;
+        }
+    }
+
+    if (g_ascii_isdigit(level[0]))
+    {
+        chosen = CLAMP(atoi(level), DROPBOX_LOG_TRACE, DROPBOX_LOG_ERROR);
+    }
+
+    output_level.store(chosen, std::memory_order_relaxed);
+    dropbox_log_start(chosen);
+}
+
+/**
+ * Starts the thread that writes the log, if it isn't running yet, and
+ * shows at least everything from t_level up.
+ *
+ * @note Only call this on the main loop
+ */
+void dropbox_log_start(gint t_level)
+{
+    if (t_level < output_level.load(std::memory_order_relaxed))
+    {
+        output_level.store(t_level, std::memory_order_relaxed);
+    }
+
+    if (flusher_running.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    flusher_running.store(true, std::memory_order_release);
+
+    // Earlier warnings were written straight away, the rest is still in the SIGUSR1 dump
+    gsize first = (gsize) next_event.load(std::memory_order_acquire);
+
+    g_thread_unref(g_thread_new("dropbox-log", flusher_thread, GSIZE_TO_POINTER(first)));
+}
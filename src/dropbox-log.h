@@ -0,0 +1,239 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_LOG_H
+#define DROPBOX_LOG_H
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <tuple>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+
+/*
+ * A leveled logger that is cheap enough to leave on.
+ *
+ * Calls below DROPBOX_LOG_MIN_LEVEL are compiled out. The others copy their
+ * arguments into a slot of a fixed ring, strings included, and return.
+ *
+ * Once logging is configured, by DNA_LOG_LEVEL or an ND_DEBUG build, a
+ * background thread formats the slots that pass the runtime level and writes
+ * them to stderr in batches. Until then there is no thread, and the rare
+ * warnings and errors are written by whoever logs them.
+ *
+ * Either way the ring is a record of the most recent events of every
+ * compiled in level. It goes to stderr on SIGUSR1, with the first error and
+ * when the process crashes. These handlers live in nautilus' process, so
+ * they're only installed for signals nobody else handles already.
+ */
+#define DROPBOX_LOG_TRACE   0
+#define DROPBOX_LOG_DEBUG   1
+#define DROPBOX_LOG_INFO    2
+#define DROPBOX_LOG_WARNING 3
+#define DROPBOX_LOG_ERROR   4
+
+#ifndef DROPBOX_LOG_MIN_LEVEL
+#ifdef ND_DEBUG
+#define DROPBOX_LOG_MIN_LEVEL DROPBOX_LOG_TRACE
+#else
+#define DROPBOX_LOG_MIN_LEVEL DROPBOX_LOG_INFO
+#endif
+#endif
+
+/* Everything that is known about a log call at compile time */
+struct DropboxLogSite
+{
+    gint            level;
+    const gchar*    function;
+    const gchar*    format;
+};
+
+typedef void (*DropboxLogFormatFunc)(GString*, const gchar*, const guint8*);
+
+/* Room for the arguments of one call, longer strings are cut short */
+static const gsize DROPBOX_LOG_PAYLOAD = 192;
+
+struct DropboxLogEvent
+{
+    std::atomic<guint64>    sequence;
+    gint64                  timestamp;
+    const DropboxLogSite*   site;
+    DropboxLogFormatFunc    format;
+    gint                    tid;
+    alignas(8) guint8       payload[DROPBOX_LOG_PAYLOAD];
+};
+
+G_BEGIN_DECLS
+
+void dropbox_log_init();
+void dropbox_log_start(gint t_level);
+
+DropboxLogEvent* dropbox_log_claim(guint64* t_index);
+void dropbox_log_publish(DropboxLogEvent* t_event, guint64 t_index);
+void dropbox_log_dump(gint t_fd);
+
+G_END_DECLS
+
+/* Arguments are stored as they are, except strings, which are copied behind them */
+template <typename T>
+struct DropboxLogArg
+{
+    typedef T stored;
+
+    static stored store(T t_value, guint8* t_payload, gsize& t_used)
+    {
+        return t_value;
+    }
+
+    static T load(stored t_value, const guint8* t_payload)
+    {
+        return t_value;
+    }
+};
+
+template <>
+struct DropboxLogArg<const gchar*>
+{
+    // Offset of the copy in the payload
+    typedef guint16 stored;
+
+    static stored store(const gchar* t_value, guint8* t_payload, gsize& t_used)
+    {
+        // Out of room, point at the terminator of the previous string
+        if (t_used >= DROPBOX_LOG_PAYLOAD)
+        {
+            return (stored) (DROPBOX_LOG_PAYLOAD - 1);
+        }
+
+        stored offset = (stored) t_used;
+        gsize length = t_value != nullptr ? strlen(t_value) : 6;
+        gsize room = DROPBOX_LOG_PAYLOAD - t_used - 1;
+
+        length = MIN(length, room);
+        memcpy(t_payload + t_used, t_value != nullptr ? t_value : "(null)", length);
+        t_payload[t_used + length] = '\0';
+        t_used += length + 1;
+
+        return offset;
+    }
+
+    static const gchar* load(stored t_offset, const guint8* t_payload)
+    {
+        return (const gchar *) t_payload + t_offset;
+    }
+};
+
+template <>
+struct DropboxLogArg<gchar*> : DropboxLogArg<const gchar*>
+{
+};
+
+template <gsize... I>
+struct DropboxLogIndices
+{
+};
+
+template <gsize N, gsize... I>
+struct DropboxLogMakeIndices : DropboxLogMakeIndices<N - 1, N - 1, I...>
+{
+};
+
+template <gsize... I>
+struct DropboxLogMakeIndices<0, I...>
+{
+    typedef DropboxLogIndices<I...> type;
+};
+
+template <typename... Args>
+struct DropboxLogFormatter
+{
+    typedef std::tuple<typename DropboxLogArg<Args>::stored...> Stored;
+
+    template <gsize... I>
+    static void format_with(GString* t_out, const gchar* t_format, const guint8* t_payload, DropboxLogIndices<I...>)
+    {
+        const Stored* stored = (const Stored *) t_payload;
+
+        // Unused when there are no arguments
+        (void) stored;
+
+        g_string_append_printf(t_out, t_format, DropboxLogArg<Args>::load(std::get<I>(*stored), t_payload)...);
+    }
+
+    static void format(GString* t_out, const gchar* t_format, const guint8* t_payload)
+    {
+        format_with(t_out, t_format, t_payload, typename DropboxLogMakeIndices<sizeof...(Args)>::type());
+    }
+};
+
+/* Called through the macros below, which check the format string */
+template <typename... Args>
+void dropbox_log_write(const DropboxLogSite* t_site, Args... t_args)
+{
+    typedef typename DropboxLogFormatter<Args...>::Stored Stored;
+    static_assert(sizeof(Stored) <= DROPBOX_LOG_PAYLOAD / 2, "too many log arguments");
+
+    guint64 index;
+    DropboxLogEvent* event = dropbox_log_claim(&index);
+    gsize used = sizeof(Stored);
+
+    // Braces evaluate the arguments in order, so the strings end up in order too
+    new (event->payload) Stored{DropboxLogArg<Args>::store(t_args, event->payload, used)...};
+    (void) used;
+
+    event->site = t_site;
+    event->format = DropboxLogFormatter<Args...>::format;
+
+    dropbox_log_publish(event, index);
+}
+
+#define dropbox_log(level, format, ...) do { \
+        static const DropboxLogSite dropbox_log_site = { level, __FUNCTION__, format }; \
+        if (false) \
+        { \
+            g_printf(format, ## __VA_ARGS__); \
+        } \
+        dropbox_log_write(&dropbox_log_site, ## __VA_ARGS__); \
+    } while (0)
+
+#if DROPBOX_LOG_MIN_LEVEL <= DROPBOX_LOG_TRACE
+#define dropbox_log_trace(format, ...) dropbox_log(DROPBOX_LOG_TRACE, format, ## __VA_ARGS__)
+#else
+#define dropbox_log_trace(format, ...) do {} while (0)
+#endif
+
+#if DROPBOX_LOG_MIN_LEVEL <= DROPBOX_LOG_DEBUG
+#define dropbox_log_debug(format, ...) dropbox_log(DROPBOX_LOG_DEBUG, format, ## __VA_ARGS__)
+#else
+#define dropbox_log_debug(format, ...) do {} while (0)
+#endif
+
+#if DROPBOX_LOG_MIN_LEVEL <= DROPBOX_LOG_INFO
+#define dropbox_log_info(format, ...) dropbox_log(DROPBOX_LOG_INFO, format, ## __VA_ARGS__)
+#else
+#define dropbox_log_info(format, ...) do {} while (0)
+#endif
+
+#define dropbox_log_warning(format, ...) dropbox_log(DROPBOX_LOG_WARNING, format, ## __VA_ARGS__)
+#define dropbox_log_error(format, ...) dropbox_log(DROPBOX_LOG_ERROR, format, ## __VA_ARGS__)
+
+#endif
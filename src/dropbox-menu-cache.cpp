@@ -0,0 +1,150 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <glib.h>
+
+#include "dropbox-menu-cache.h"
+
+static void entry_free(DropboxMenuCacheEntry* t_entry)
+{
+    g_hash_table_unref(t_entry->response);
+    g_free(t_entry);
+}
+
+/**
+ * @note This function should only be called once on initialization
+ */
+void dropbox_menu_cache_init(DropboxMenuCache* t_cache, guint t_capacity)
+{
+    g_mutex_init(&(t_cache->mutex));
+    t_cache->entries = g_hash_table_new_full((GHashFunc) g_int64_hash, (GEqualFunc) g_int64_equal, nullptr, (GDestroyNotify) entry_free);
+    g_queue_init(&(t_cache->order));
+    t_cache->capacity = t_capacity;
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void dropbox_menu_cache_clear(DropboxMenuCache* t_cache)
+{
+    g_mutex_lock(&(t_cache->mutex));
+    g_queue_clear(&(t_cache->order));
+    g_hash_table_remove_all(t_cache->entries);
+    g_mutex_unlock(&(t_cache->mutex));
+}
+
+/* The splitmix64 finalizer, spreads every input bit over the whole result */
+static guint64 mix(guint64 t_x)
+{
+    t_x = (t_x ^ (t_x >> 30)) * G_GUINT64_CONSTANT(0xbf58476d1ce4e5b9);
+    t_x = (t_x ^ (t_x >> 27)) * G_GUINT64_CONSTANT(0x94d049bb133111eb);
+
+    return t_x ^ (t_x >> 31);
+}
+
+guint64 dropbox_menu_cache_key_init(guint t_generation)
+{
+    return mix(t_generation);
+}
+
+/*
+ * Adds a selected path to a key. The paths are summed up, so the key doesn't
+ * depend on the order nautilus lists the selection in.
+ */
+guint64 dropbox_menu_cache_key_add(guint64 t_key, guint64 t_path_hash, guint t_path_generation)
+{
+    return t_key + mix(t_path_hash ^ mix(t_path_generation));
+}
+
+/**
+ * Returns:
+ * A new reference to the cached reply, or NULL if there is none.
+ *
+ * @note This function is threadsafe
+ */
+GHashTable* dropbox_menu_cache_lookup(DropboxMenuCache* t_cache, guint64 t_key)
+{
+    DropboxMenuCacheEntry* entry;
+    GHashTable* response = nullptr;
+
+    g_mutex_lock(&(t_cache->mutex));
+    entry = (DropboxMenuCacheEntry *) g_hash_table_lookup(t_cache->entries, &t_key);
+
+    if (entry != nullptr)
+    {
+        response = g_hash_table_ref(entry->response);
+    }
+
+    g_mutex_unlock(&(t_cache->mutex));
+
+    return response;
+}
+
+/**
+ * @note This function is threadsafe
+ */
+gboolean dropbox_menu_cache_contains(DropboxMenuCache* t_cache, guint64 t_key)
+{
+    gboolean found;
+
+    g_mutex_lock(&(t_cache->mutex));
+    found = g_hash_table_lookup(t_cache->entries, &t_key) != nullptr;
+    g_mutex_unlock(&(t_cache->mutex));
+
+    return found;
+}
+
+/**
+ * Stores a reply, replacing any older reply for the same selection.
+ * The cache takes its own reference to t_response.
+ *
+ * @note This function is threadsafe
+ */
+void dropbox_menu_cache_insert(DropboxMenuCache* t_cache, guint64 t_key, GHashTable* t_response)
+{
+    DropboxMenuCacheEntry* entry;
+
+    g_mutex_lock(&(t_cache->mutex));
+    entry = (DropboxMenuCacheEntry *) g_hash_table_lookup(t_cache->entries, &t_key);
+
+    if (entry != nullptr)
+    {
+        g_hash_table_unref(entry->response);
+        entry->response = g_hash_table_ref(t_response);
+        g_mutex_unlock(&(t_cache->mutex));
+
+        return;
+    }
+
+    while (g_queue_get_length(&(t_cache->order)) >= t_cache->capacity)
+    {
+        DropboxMenuCacheEntry* oldest = (DropboxMenuCacheEntry *) g_queue_pop_head(&(t_cache->order));
+        g_hash_table_remove(t_cache->entries, &(oldest->key));
+    }
+
+    entry = g_new(DropboxMenuCacheEntry, 1);
+    entry->key = t_key;
+    entry->response = g_hash_table_ref(t_response);
+
+    // The key lives in the entry, so it is freed along with it
+    g_hash_table_insert(t_cache->entries, &(entry->key), entry);
+    g_queue_push_tail(&(t_cache->order), entry);
+    g_mutex_unlock(&(t_cache->mutex));
+}
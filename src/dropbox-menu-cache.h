@@ -0,0 +1,67 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_MENU_CACHE_H
+#define DROPBOX_MENU_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Replies to icon_overlay_context_options, keyed by the selection they were
+ * asked for, so a right-click can usually be answered without waiting on the
+ * daemon. The oldest entries are dropped once the cache is full.
+ *
+ * The key covers the generation of every selected path as well as a global
+ * one, so changed files simply stop matching their old replies instead of
+ * having to be looked up and evicted.
+ *
+ * Replies are filled in from the command thread and read on the main loop.
+ * Like the provider that owns it, and the command thread that fills it, the
+ * cache lives as long as the process, so it is never torn down.
+ */
+struct DropboxMenuCacheEntry
+{
+    guint64     key;
+    GHashTable* response;
+};
+
+struct DropboxMenuCache
+{
+    GMutex      mutex;
+    GHashTable* entries;
+    GQueue      order;
+    guint       capacity;
+};
+
+void dropbox_menu_cache_init(DropboxMenuCache* t_cache, guint t_capacity);
+void dropbox_menu_cache_clear(DropboxMenuCache* t_cache);
+
+guint64 dropbox_menu_cache_key_init(guint t_generation);
+guint64 dropbox_menu_cache_key_add(guint64 t_key, guint64 t_path_hash, guint t_path_generation);
+
+GHashTable* dropbox_menu_cache_lookup(DropboxMenuCache* t_cache, guint64 t_key);
+gboolean dropbox_menu_cache_contains(DropboxMenuCache* t_cache, guint64 t_key);
+void dropbox_menu_cache_insert(DropboxMenuCache* t_cache, guint64 t_key, GHashTable* t_response);
+
+G_END_DECLS
+
+#endif
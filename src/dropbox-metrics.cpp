@@ -0,0 +1,279 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <atomic>
+
+#include <glib.h>
+
+#include "dropbox-log.h"
+#include "dropbox-metrics.h"
+
+static const gchar* counter_names[METRIC_COUNTERS] = {
+    "connections",
+    "reconnections",
+    "hook_events",
+    "menu_cache_hits",
+    "menu_cache_misses",
+    "file_path_hits",
+    "file_path_misses"
+};
+
+// Indexed by DropboxMetricsCommand, METRIC_CMD_OTHER has no name to match
+static const gchar* command_names[METRIC_COMMANDS] = {
+    "other_commands",
+    "get_emblems",
+    "icon_overlay_file_status",
+    "get_folder_tag",
+    "icon_overlay_context_options",
+    "icon_overlay_context_action",
+    "get_emblem_paths"
+};
+
+struct MetricsGauge
+{
+    const gchar*                name;
+    DropboxMetricsGaugeFunc     func;
+    gpointer                    ud;
+};
+
+static std::atomic<guint64> counters[METRIC_COUNTERS];
+
+static DropboxMetricsHistogram histograms[METRIC_COMMANDS];
+static GSList* gauges = nullptr;
+
+// Only touched by the dump, to turn counters into rates
+static guint64 last_counters[METRIC_COUNTERS];
+static gint64 last_dump = 0;
+static gint64 started = 0;
+
+/* One log event per line, a whole summary wouldn't fit in one */
+static gboolean dump_to_log(gpointer t_ud)
+{
+    GString* out = g_string_new(nullptr);
+
+    dropbox_metrics_dump(out);
+
+    gchar** lines = g_strsplit(out->str, "\n", -1);
+
+    for (gchar** line = lines; *line != nullptr; line++)
+    {
+        if (**line != '\0')
+        {
+            dropbox_log_info("%s", *line);
+        }
+    }
+
+    g_strfreev(lines);
+    g_string_free(out, true);
+
+    return true;
+}
+
+/**
+ * Starts the periodic dump if DNA_METRICS_INTERVAL asks for one. It goes to
+ * the log at INFO level, so that level is shown from then on.
+ *
+ * @note Only call this on the main loop, once on initialization
+ */
+void dropbox_metrics_init()
+{
+    const gchar* interval = g_getenv("DNA_METRICS_INTERVAL");
+
+    started = last_dump = g_get_monotonic_time();
+
+    if (interval != nullptr && g_ascii_strtoull(interval, nullptr, 10) > 0)
+    {
+        dropbox_log_start(DROPBOX_LOG_INFO);
+        g_timeout_add_seconds((guint) g_ascii_strtoull(interval, nullptr, 10), (GSourceFunc) dump_to_log, nullptr);
+    }
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void dropbox_metrics_count(DropboxMetricsCounter t_counter)
+{
+    counters[t_counter].fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void dropbox_metrics_add(DropboxMetricsCounter t_counter, guint64 t_amount)
+{
+    counters[t_counter].fetch_add(t_amount, std::memory_order_relaxed);
+}
+
+/**
+ * Finds the histogram slot for the command t_name. Commands we don't know
+ * about share METRIC_CMD_OTHER.
+ *
+ * @note This function is threadsafe
+ */
+DropboxMetricsCommand dropbox_metrics_command_for(const gchar* t_name)
+{
+    for (guint i = METRIC_CMD_OTHER + 1; i < METRIC_COMMANDS; i++)
+    {
+        if (g_strcmp0(t_name, command_names[i]) == 0)
+        {
+            return (DropboxMetricsCommand) i;
+        }
+    }
+
+    return METRIC_CMD_OTHER;
+}
+
+/**
+ * Adds a latency of t_usec microseconds to the histogram of t_command.
+ *
+ * @note This function is threadsafe
+ */
+void dropbox_metrics_record(DropboxMetricsCommand t_command, gint64 t_usec)
+{
+    DropboxMetricsHistogram* histogram = &(histograms[t_command]);
+    guint64 usec = t_usec > 0 ? (guint64) t_usec : 0;
+    guint bucket = 0;
+
+    while (bucket < DROPBOX_METRICS_BUCKETS - 1 && (usec >> bucket) != 0)
+    {
+        bucket++;
+    }
+
+    histogram->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram->count.fetch_add(1, std::memory_order_relaxed);
+    histogram->sum.fetch_add(usec, std::memory_order_relaxed);
+
+    guint64 max = histogram->max.load(std::memory_order_relaxed);
+
+    while (usec > max && !histogram->max.compare_exchange_weak(max, usec, std::memory_order_relaxed))
+    {
+    }
+}
+
+/**
+ * Adds a value that is read when the metrics are dumped, like a queue length.
+ * t_func is called on the main loop.
+ *
+ * @note Only call this on the main loop
+ */
+void dropbox_metrics_add_gauge(const gchar* t_name, DropboxMetricsGaugeFunc t_func, gpointer t_ud)
+{
+    MetricsGauge* gauge = g_new(MetricsGauge, 1);
+
+    gauge->name = t_name;
+    gauge->func = t_func;
+    gauge->ud = t_ud;
+
+    gauges = g_slist_append(gauges, gauge);
+}
+
+/* The upper bound of the bucket that holds the given fraction of the samples */
+static guint64 histogram_percentile(guint64* t_buckets, guint64 t_count, gdouble t_fraction)
+{
+    guint64 wanted = (guint64) (t_count * t_fraction);
+    guint64 seen = 0;
+
+    for (guint i = 0; i < DROPBOX_METRICS_BUCKETS; i++)
+    {
+        seen += t_buckets[i];
+
+        if (seen > wanted)
+        {
+            return i == 0 ? 0 : G_GUINT64_CONSTANT(1) << i;
+        }
+    }
+
+    return G_GUINT64_CONSTANT(1) << (DROPBOX_METRICS_BUCKETS - 1);
+}
+
+static void dump_histogram(const gchar* t_name, DropboxMetricsHistogram* t_histogram, GString* t_out)
+{
+    guint64 buckets[DROPBOX_METRICS_BUCKETS];
+    guint64 count = 0;
+
+    // Recording may go on meanwhile, so count what we copied rather than trusting count
+    for (guint i = 0; i < DROPBOX_METRICS_BUCKETS; i++)
+    {
+        buckets[i] = t_histogram->buckets[i].load(std::memory_order_relaxed);
+        count += buckets[i];
+    }
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    g_string_append_printf(t_out, "  %-30s %10" G_GUINT64_FORMAT " mean %8" G_GUINT64_FORMAT "us p50 <%" G_GUINT64_FORMAT "us p90 <%" G_GUINT64_FORMAT "us p99 <%" G_GUINT64_FORMAT "us max %" G_GUINT64_FORMAT "us\n",
+        t_name, count, t_histogram->sum.load(std::memory_order_relaxed) / MAX(t_histogram->count.load(std::memory_order_relaxed), 1),
+        histogram_percentile(buckets, count, 0.5), histogram_percentile(buckets, count, 0.9), histogram_percentile(buckets, count, 0.99),
+        t_histogram->max.load(std::memory_order_relaxed));
+}
+
+/*
+ * Appends a readable summary to t_out. Rates are per second since the
+ * previous dump.
+ *
+ * @note Only call this on the main loop
+ */
+void dropbox_metrics_dump(GString* t_out)
+{
+    gint64 now = g_get_monotonic_time();
+    gdouble elapsed = MAX(now - last_dump, 1) / (gdouble) G_USEC_PER_SEC;
+
+    g_string_append_printf(t_out, "dna metrics after %" G_GINT64_FORMAT "s\n", (now - started) / G_USEC_PER_SEC);
+
+    for (guint i = 0; i < METRIC_COUNTERS; i++)
+    {
+        guint64 value = counters[i].load(std::memory_order_relaxed);
+
+        g_string_append_printf(t_out, "  %-30s %10" G_GUINT64_FORMAT " %10.1f/s\n", counter_names[i], value, (value - last_counters[i]) / elapsed);
+        last_counters[i] = value;
+    }
+
+    guint64 hits = counters[METRIC_MENU_CACHE_HITS].load(std::memory_order_relaxed);
+    guint64 misses = counters[METRIC_MENU_CACHE_MISSES].load(std::memory_order_relaxed);
+
+    if (hits + misses > 0)
+    {
+        g_string_append_printf(t_out, "  %-30s %9.1f%%\n", "menu_cache_hit_rate", hits * 100.0 / (hits + misses));
+    }
+
+    hits = counters[METRIC_FILE_PATH_HITS].load(std::memory_order_relaxed);
+    misses = counters[METRIC_FILE_PATH_MISSES].load(std::memory_order_relaxed);
+
+    if (hits + misses > 0)
+    {
+        g_string_append_printf(t_out, "  %-30s %9.1f%%\n", "file_path_hit_rate", hits * 100.0 / (hits + misses));
+    }
+
+    for (GSList* li = gauges; li != nullptr; li = li->next)
+    {
+        MetricsGauge* gauge = (MetricsGauge *) li->data;
+
+        g_string_append_printf(t_out, "  %-30s %10" G_GINT64_FORMAT "\n", gauge->name, gauge->func(gauge->ud));
+    }
+
+    for (guint i = 0; i < METRIC_COMMANDS; i++)
+    {
+        dump_histogram(command_names[i], &(histograms[i]), t_out);
+    }
+
+    last_dump = now;
+}
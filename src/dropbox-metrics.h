@@ -0,0 +1,88 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_METRICS_H
+#define DROPBOX_METRICS_H
+
+#include <atomic>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Process wide counters and latency histograms that are always collected.
+ * Recording is a few relaxed atomic increments, so it can stay on in
+ * production. Nothing is printed unless DNA_METRICS_INTERVAL is set to a
+ * number of seconds, in which case a summary goes to the log that often.
+ */
+enum DropboxMetricsCounter {
+    METRIC_CONNECTIONS,
+    METRIC_RECONNECTIONS,
+    METRIC_HOOK_EVENTS,
+    METRIC_MENU_CACHE_HITS,
+    METRIC_MENU_CACHE_MISSES,
+    METRIC_FILE_PATH_HITS,
+    METRIC_FILE_PATH_MISSES,
+    METRIC_COUNTERS
+};
+
+/*
+ * Every command dropbox answers gets its own latency histogram. The slot is
+ * looked up once, when the command is created, so recording never has to
+ * look at the name.
+ */
+enum DropboxMetricsCommand {
+    METRIC_CMD_OTHER,
+    METRIC_CMD_GET_EMBLEMS,
+    METRIC_CMD_FILE_STATUS,
+    METRIC_CMD_FOLDER_TAG,
+    METRIC_CMD_CONTEXT_OPTIONS,
+    METRIC_CMD_CONTEXT_ACTION,
+    METRIC_CMD_EMBLEM_PATHS,
+    METRIC_COMMANDS
+};
+
+/* Bucket i counts latencies below 2^i microseconds that didn't fit in bucket i - 1 */
+static const guint DROPBOX_METRICS_BUCKETS = 32;
+
+struct DropboxMetricsHistogram
+{
+    std::atomic<guint64>    buckets[DROPBOX_METRICS_BUCKETS];
+    std::atomic<guint64>    count;
+    std::atomic<guint64>    sum;
+    std::atomic<guint64>    max;
+};
+
+typedef gint64 (*DropboxMetricsGaugeFunc)(gpointer);
+
+void dropbox_metrics_init();
+
+void dropbox_metrics_count(DropboxMetricsCounter t_counter);
+void dropbox_metrics_add(DropboxMetricsCounter t_counter, guint64 t_amount);
+DropboxMetricsCommand dropbox_metrics_command_for(const gchar* t_name);
+void dropbox_metrics_record(DropboxMetricsCommand t_command, gint64 t_usec);
+void dropbox_metrics_add_gauge(const gchar* t_name, DropboxMetricsGaugeFunc t_func, gpointer t_ud);
+
+void dropbox_metrics_dump(GString* t_out);
+
+G_END_DECLS
+
+#endif
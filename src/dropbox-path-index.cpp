@@ -0,0 +1,391 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstddef>
+#include <cstring>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "g-util.h"
+#include "dropbox-path-index.h"
+
+static GQuark node_quark()
+{
+    static GQuark quark = 0;
+
+    if (quark == 0)
+    {
+        quark = g_quark_from_static_string("dropbox-path-index-node");
+    }
+
+    return quark;
+}
+
+static DropboxPathNode* node_new(DropboxPathNode* t_parent, const gchar* t_name, gsize t_length)
+{
+    DropboxPathNode* node;
+
+    // The name is stored inline, right behind the node itself
+    node = (DropboxPathNode *) g_malloc(offsetof(DropboxPathNode, name) + t_length + 1);
+    node->parent = t_parent;
+    node->children = nullptr;
+    node->file = nullptr;
+    node->newer = nullptr;
+    node->older = nullptr;
+    node->used = 0;
+    memcpy(node->name, t_name, t_length);
+    node->name[t_length] = '\0';
+
+    if (t_parent->children == nullptr)
+    {
+        t_parent->children = g_hash_table_new((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal);
+    }
+
+    g_hash_table_insert(t_parent->children, node->name, node);
+
+    return node;
+}
+
+/*
+ * Frees a node and every ancestor that no longer holds a file or children.
+ * The root node is embedded in the index and is never freed.
+ */
+static void node_prune(DropboxPathNode* t_node)
+{
+    while (t_node->parent != nullptr && t_node->file == nullptr && t_node->children == nullptr)
+    {
+        DropboxPathNode* parent = t_node->parent;
+
+        g_hash_table_remove(parent->children, t_node->name);
+
+        if (g_hash_table_size(parent->children) == 0)
+        {
+            g_hash_table_destroy(parent->children);
+            parent->children = nullptr;
+        }
+
+        g_free(t_node);
+        t_node = parent;
+    }
+}
+
+static DropboxPathIndex* node_get_index(DropboxPathNode* t_node)
+{
+    while (t_node->parent != nullptr)
+    {
+        t_node = t_node->parent;
+    }
+
+    // The root node is the first member of the index
+    return (DropboxPathIndex *) t_node;
+}
+
+/*
+ * Walks the tree one path component at a time. Empty components are skipped,
+ * so callers should still pass canonical paths to get sensible results.
+ *
+ * Returns:
+ * The node for the path, or NULL if it does not exist and t_create is false.
+ */
+static DropboxPathNode* node_lookup(DropboxPathNode* t_node, const gchar* t_path, gboolean t_create)
+{
+    gchar buffer[256];
+    const gchar* component = t_path;
+
+    while (true)
+    {
+        while (*component == '/')
+        {
+            component++;
+        }
+
+        if (*component == '\0')
+        {
+            return t_node;
+        }
+
+        const gchar* end = strchr(component, '/');
+        gsize length = end != nullptr ? (gsize) (end - component) : strlen(component);
+
+        // The children table needs a terminated key, names are rarely longer than the buffer
+        gchar* key = length < sizeof(buffer) ? buffer : (gchar *) g_malloc(length + 1);
+        memcpy(key, component, length);
+        key[length] = '\0';
+
+        DropboxPathNode* child = nullptr;
+
+        if (t_node->children != nullptr)
+        {
+            child = (DropboxPathNode *) g_hash_table_lookup(t_node->children, key);
+        }
+
+        if (child == nullptr && t_create)
+        {
+            child = node_new(t_node, key, length);
+        }
+
+        if (key != buffer)
+        {
+            g_free(key);
+        }
+
+        if (child == nullptr)
+        {
+            return nullptr;
+        }
+
+        t_node = child;
+        component += length;
+    }
+}
+
+static void node_link_newest(DropboxPathIndex* t_index, DropboxPathNode* t_node)
+{
+    t_node->newer = nullptr;
+    t_node->older = t_index->newest;
+    t_node->used = ++t_index->clock;
+
+    if (t_index->newest != nullptr)
+    {
+        t_index->newest->newer = t_node;
+    }
+    else
+    {
+        t_index->oldest = t_node;
+    }
+
+    t_index->newest = t_node;
+}
+
+static void node_unlink(DropboxPathIndex* t_index, DropboxPathNode* t_node)
+{
+    // Walks that were about to visit this node continue with the next one
+    for (GSList* li = t_index->walks; li != nullptr; li = li->next)
+    {
+        DropboxPathIndexWalk* walk = (DropboxPathIndexWalk *) li->data;
+
+        if (walk->next == t_node)
+        {
+            walk->next = t_node->older;
+        }
+    }
+
+    if (t_node->newer != nullptr)
+    {
+        t_node->newer->older = t_node->older;
+    }
+    else
+    {
+        t_index->newest = t_node->older;
+    }
+
+    if (t_node->older != nullptr)
+    {
+        t_node->older->newer = t_node->newer;
+    }
+    else
+    {
+        t_index->oldest = t_node->newer;
+    }
+
+    t_node->newer = t_node->older = nullptr;
+}
+
+/* Called by glib when a tracked file object is finalized */
+static void when_file_dies(DropboxPathNode* t_node)
+{
+    DropboxPathIndex* index = node_get_index(t_node);
+
+    node_unlink(index, t_node);
+    t_node->file = nullptr;
+    index->size--;
+
+    node_prune(t_node);
+}
+
+static void node_detach(DropboxPathIndex* t_index, DropboxPathNode* t_node)
+{
+    g_object_steal_qdata(G_OBJECT(t_node->file), node_quark());
+    node_unlink(t_index, t_node);
+    t_node->file = nullptr;
+    t_index->size--;
+}
+
+void dropbox_path_index_init(DropboxPathIndex* t_index)
+{
+    t_index->root.parent = nullptr;
+    t_index->root.children = nullptr;
+    t_index->root.file = nullptr;
+    t_index->root.newer = nullptr;
+    t_index->root.older = nullptr;
+    t_index->root.used = 0;
+    t_index->root.name[0] = '\0';
+    t_index->size = 0;
+    t_index->newest = nullptr;
+    t_index->oldest = nullptr;
+    t_index->clock = 0;
+    t_index->walks = nullptr;
+}
+
+NautilusFileInfo* dropbox_path_index_lookup(DropboxPathIndex* t_index, const gchar* t_path)
+{
+    DropboxPathNode* node = node_lookup(&(t_index->root), t_path, false);
+
+    return node != nullptr ? node->file : nullptr;
+}
+
+/*
+ * Maps t_path to t_file, dropping the previous path of t_file if it had one.
+ *
+ * Returns:
+ * The file object that was mapped to t_path before, if it was a different one.
+ * It is no longer tracked, so the caller should disconnect anything it
+ * attached to it.
+ */
+NautilusFileInfo* dropbox_path_index_insert(DropboxPathIndex* t_index, const gchar* t_path, NautilusFileInfo* t_file)
+{
+    DropboxPathNode* node = node_lookup(&(t_index->root), t_path, true);
+    DropboxPathNode* old_node = (DropboxPathNode *) g_object_get_qdata(G_OBJECT(t_file), node_quark());
+    NautilusFileInfo* evicted = nullptr;
+
+    if (old_node == node)
+    {
+        node_unlink(t_index, node);
+        node_link_newest(t_index, node);
+
+        return nullptr;
+    }
+
+    /* This happens when nautilus allocates another file object for a filename
+     * without first deleting the original file object, the old one is obsolete */
+    if (node->file != nullptr)
+    {
+        evicted = node->file;
+        node_detach(t_index, node);
+    }
+
+    if (old_node != nullptr)
+    {
+        node_detach(t_index, old_node);
+    }
+
+    node->file = t_file;
+    g_object_set_qdata_full(G_OBJECT(t_file), node_quark(), node, (GDestroyNotify) when_file_dies);
+    node_link_newest(t_index, node);
+    t_index->size++;
+
+    // Only prune once the new node holds a file, it might be an ancestor of the old one
+    if (old_node != nullptr)
+    {
+        node_prune(old_node);
+    }
+
+    return evicted;
+}
+
+gboolean dropbox_path_index_contains(DropboxPathIndex* t_index, NautilusFileInfo* t_file)
+{
+    return g_object_get_qdata(G_OBJECT(t_file), node_quark()) != nullptr;
+}
+
+gboolean dropbox_path_index_has_path(DropboxPathIndex* t_index, NautilusFileInfo* t_file, const gchar* t_path)
+{
+    DropboxPathNode* node = (DropboxPathNode *) g_object_get_qdata(G_OBJECT(t_file), node_quark());
+
+    return node != nullptr && node_lookup(&(t_index->root), t_path, false) == node;
+}
+
+/* Marks t_file as the most recently used file */
+void dropbox_path_index_touch(DropboxPathIndex* t_index, NautilusFileInfo* t_file)
+{
+    DropboxPathNode* node = (DropboxPathNode *) g_object_get_qdata(G_OBJECT(t_file), node_quark());
+
+    if (node != nullptr && node != t_index->newest)
+    {
+        node_unlink(t_index, node);
+        node_link_newest(t_index, node);
+    }
+}
+
+/*
+ * Returns:
+ * true if t_file is one of roughly the t_count most recently used files.
+ * Files that were touched more than once count more than once, so this is
+ * cheap rather than exact.
+ */
+gboolean dropbox_path_index_is_recent(DropboxPathIndex* t_index, NautilusFileInfo* t_file, guint t_count)
+{
+    DropboxPathNode* node = (DropboxPathNode *) g_object_get_qdata(G_OBJECT(t_file), node_quark());
+
+    return node != nullptr && t_index->clock - node->used < t_count;
+}
+
+void dropbox_path_index_remove(DropboxPathIndex* t_index, NautilusFileInfo* t_file)
+{
+    DropboxPathNode* node = (DropboxPathNode *) g_object_get_qdata(G_OBJECT(t_file), node_quark());
+
+    if (node != nullptr)
+    {
+        node_detach(t_index, node);
+        node_prune(node);
+    }
+}
+
+/**
+ * Starts a walk over all files, the most recently used ones first.
+ * Files may be added, touched or removed between steps.
+ * Files that are touched during the walk may be skipped.
+ */
+void dropbox_path_index_walk_start(DropboxPathIndex* t_index, DropboxPathIndexWalk* t_walk)
+{
+    t_walk->next = t_index->newest;
+
+    if (g_slist_find(t_index->walks, t_walk) == nullptr)
+    {
+        t_index->walks = g_slist_prepend(t_index->walks, t_walk);
+    }
+}
+
+void dropbox_path_index_walk_stop(DropboxPathIndex* t_index, DropboxPathIndexWalk* t_walk)
+{
+    t_index->walks = g_slist_remove(t_index->walks, t_walk);
+    t_walk->next = nullptr;
+}
+
+/*
+ * Returns:
+ * The next file of the walk, or NULL when it is done. A finished walk is
+ * stopped automatically.
+ */
+NautilusFileInfo* dropbox_path_index_walk_next(DropboxPathIndex* t_index, DropboxPathIndexWalk* t_walk)
+{
+    DropboxPathNode* node = t_walk->next;
+
+    if (node == nullptr)
+    {
+        dropbox_path_index_walk_stop(t_index, t_walk);
+        return nullptr;
+    }
+
+    t_walk->next = node->older;
+
+    return node->file;
+}
@@ -0,0 +1,87 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_PATH_INDEX_H
+#define DROPBOX_PATH_INDEX_H
+
+#include <glib.h>
+
+#include <libnautilus-extension/nautilus-file-info.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Two-way mapping between canonical paths and the file objects nautilus
+ * handed us. Paths are stored as a tree of path components, so every
+ * directory name is kept exactly once no matter how many files live in it.
+ * The file -> path direction is a handle stored as qdata on the file object,
+ * which also takes care of dropping the mapping when the file is finalized.
+ *
+ * Nodes holding a file are also kept in a list ordered by when nautilus last
+ * asked about them, so walks visit recently used files first.
+ *
+ * Only use this from the main loop.
+ */
+struct DropboxPathNode
+{
+    DropboxPathNode*    parent;
+    GHashTable*         children;
+    NautilusFileInfo*   file;
+    DropboxPathNode*    newer;
+    DropboxPathNode*    older;
+    guint64             used;
+    gchar               name[1];
+};
+
+struct DropboxPathIndex
+{
+    DropboxPathNode     root;
+    guint               size;
+    DropboxPathNode*    newest;
+    DropboxPathNode*    oldest;
+    guint64             clock;
+    GSList*             walks;
+};
+
+/* A walk from the most to the least recently used file, safe against removals */
+struct DropboxPathIndexWalk
+{
+    DropboxPathNode*    next;
+};
+
+void dropbox_path_index_init(DropboxPathIndex* t_index);
+
+NautilusFileInfo* dropbox_path_index_lookup(DropboxPathIndex* t_index, const gchar* t_path);
+NautilusFileInfo* dropbox_path_index_insert(DropboxPathIndex* t_index, const gchar* t_path, NautilusFileInfo* t_file);
+
+gboolean dropbox_path_index_contains(DropboxPathIndex* t_index, NautilusFileInfo* t_file);
+gboolean dropbox_path_index_has_path(DropboxPathIndex* t_index, NautilusFileInfo* t_file, const gchar* t_path);
+
+void dropbox_path_index_touch(DropboxPathIndex* t_index, NautilusFileInfo* t_file);
+gboolean dropbox_path_index_is_recent(DropboxPathIndex* t_index, NautilusFileInfo* t_file, guint t_count);
+void dropbox_path_index_remove(DropboxPathIndex* t_index, NautilusFileInfo* t_file);
+
+void dropbox_path_index_walk_start(DropboxPathIndex* t_index, DropboxPathIndexWalk* t_walk);
+void dropbox_path_index_walk_stop(DropboxPathIndex* t_index, DropboxPathIndexWalk* t_walk);
+NautilusFileInfo* dropbox_path_index_walk_next(DropboxPathIndex* t_index, DropboxPathIndexWalk* t_walk);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <glib.h>
+
+#include "dropbox-path-util.h"
+
+/*
+ * Checks the character after a '/' at t_path[t_pos].
+ * Returns true if it starts an empty, '.' or '..' component.
+ */
+static inline gboolean is_navigation_component(const gchar* t_path, gsize t_pos)
+{
+    const gchar* next = t_path + t_pos + 1;
+
+    if (next[0] == '/')
+    {
+        return true;
+    }
+
+    if (next[0] != '.')
+    {
+        return false;
+    }
+
+    // "/." or "/.." followed by a separator or the end, but not "/.hidden"
+    if (next[1] == '/' || next[1] == '\0')
+    {
+        return true;
+    }
+
+    return next[1] == '.' && (next[2] == '/' || next[2] == '\0');
+}
+
+/*
+ * Checks whether a path is already in the form canonicalize returns it,
+ * i.e. it contains no "//", "/./" or "/../" and has no trailing separator.
+ *
+ * Arguments:
+ * - path: absolute input path
+ * - length: length of the path, excluding the terminator
+ */
+gboolean dropbox_path_util_is_canonical(const gchar* t_path, gsize t_length)
+{
+    gsize i = 0;
+
+    if (t_length == 1)
+    {
+        return true;
+    }
+
+    if (t_path[t_length - 1] == '/')
+    {
+        return false;
+    }
+
+#ifdef __SSE2__
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i dot = _mm_set1_epi8('.');
+
+    /* Look for a '/' followed by another '/' or a '.' sixteen characters at a time.
+     * The second load reads one character further, which at most hits the terminator. */
+    for (; i + 16 <= t_length; i += 16)
+    {
+        __m128i current = _mm_loadu_si128((const __m128i *) (t_path + i));
+        __m128i next = _mm_loadu_si128((const __m128i *) (t_path + i + 1));
+
+        __m128i candidates = _mm_and_si128(
+            _mm_cmpeq_epi8(current, slash),
+            _mm_or_si128(_mm_cmpeq_epi8(next, slash), _mm_cmpeq_epi8(next, dot))
+        );
+
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(candidates);
+
+        // Most of these are hidden files, which are fine
+        while (mask != 0)
+        {
+            unsigned int bit = __builtin_ctz(mask);
+
+            if (is_navigation_component(t_path, i + bit))
+            {
+                return false;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i < t_length; i++)
+    {
+        if (t_path[i] == '/' && is_navigation_component(t_path, i))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Simplifies a path by removing navigation elements such as '.' and '..'
+ * in a single pass, without allocating.
+ *
+ * Arguments:
+ * - path: absolute input path to be canonicalized
+ * - buf: output buffer, may be the same as path to canonicalize in place
+ * - buflen: size of buf, only needs to hold the input path
+ *
+ * Returns:
+ * path itself if it was already canonical, buf holding the simplified path
+ * otherwise. NULL if the path has too many parent directory references or
+ * if buf is too small.
+ */
+const gchar* dropbox_path_util_canonicalize(const gchar* t_path, gchar* t_buf, gsize t_buflen)
+{
+    gsize length = strlen(t_path);
+
+    g_assert(t_path[0] == '/');
+
+    if (dropbox_path_util_is_canonical(t_path, length))
+    {
+        return t_path;
+    }
+
+    // The output is never longer than the input
+    if (t_buf != t_path && t_buflen <= length)
+    {
+        return nullptr;
+    }
+
+    /* Every component is written as "/name". The write position never passes the
+     * start of the component being read, so this also works in place. */
+    gsize r = 0, w = 0;
+
+    while (r < length)
+    {
+        while (r < length && t_path[r] == '/')
+        {
+            r++;
+        }
+
+        if (r == length)
+        {
+            break;
+        }
+
+        gsize start = r;
+
+        while (r < length && t_path[r] != '/')
+        {
+            r++;
+        }
+
+        gsize n = r - start;
+
+        if (n == 1 && t_path[start] == '.')
+        {
+            continue;
+        }
+
+        if (n == 2 && t_path[start] == '.' && t_path[start + 1] == '.')
+        {
+            if (w == 0)
+            {
+                // Input path has too many parent directory references and is invalid
+                return nullptr;
+            }
+
+            // Drop the last component we wrote
+            while (t_buf[--w] != '/')
+            {
+            }
+
+            continue;
+        }
+
+        t_buf[w++] = '/';
+        memmove(t_buf + w, t_path + start, n);
+        w += n;
+    }
+
+    if (w == 0)
+    {
+        t_buf[w++] = '/';
+    }
+
+    t_buf[w] = '\0';
+
+    return t_buf;
+}
+
+/*
+ * Returns:
+ * true if t_path now holds its canonical form, false if it was invalid.
+ */
+gboolean dropbox_path_util_canonicalize_in_place(gchar* t_path)
+{
+    return dropbox_path_util_canonicalize(t_path, t_path, strlen(t_path) + 1) != nullptr;
+}
+
+/*
+ * A 64 bit FNV-1a hash, wide enough to tell the paths of a big selection
+ * apart without comparing them.
+ */
+guint64 dropbox_path_util_hash(const gchar* t_path)
+{
+    guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+
+    for (const gchar* c = t_path; *c != '\0'; c++)
+    {
+        hash = (hash ^ (guchar) *c) * G_GUINT64_CONSTANT(1099511628211);
+    }
+
+    return hash;
+}
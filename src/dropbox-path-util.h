@@ -0,0 +1,37 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_PATH_UTIL_H
+#define DROPBOX_PATH_UTIL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean dropbox_path_util_is_canonical(const gchar* t_path, gsize t_length);
+
+const gchar* dropbox_path_util_canonicalize(const gchar* t_path, gchar* t_buf, gsize t_buflen);
+gboolean dropbox_path_util_canonicalize_in_place(gchar* t_path);
+
+guint64 dropbox_path_util_hash(const gchar* t_path);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,416 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstring>
+
+#include <glib.h>
+
+#include "g-util.h"
+#include "dropbox-roots.h"
+#include "dropbox-path-util.h"
+
+static gint read_hex4(const gchar* t_s)
+{
+    gint value = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        gint digit = g_ascii_xdigit_value(t_s[i]);
+
+        if (digit < 0)
+        {
+            return -1;
+        }
+
+        value = (value << 4) | digit;
+    }
+
+    return value;
+}
+
+/*
+ * Decodes the JSON string starting right after its opening quote.
+ *
+ * Returns:
+ * The decoded string, or NULL if it is malformed.
+ */
+static gchar* read_json_string(const gchar* t_s)
+{
+    GString* out = g_string_new(nullptr);
+
+    while (*t_s != '"')
+    {
+        if (*t_s == '\0')
+        {
+            g_string_free(out, true);
+            return nullptr;
+        }
+
+        if (*t_s != '\\')
+        {
+            g_string_append_c(out, *t_s++);
+            continue;
+        }
+
+        t_s++;
+
+        switch (*t_s++)
+        {
+            case '"':  g_string_append_c(out, '"'); break;
+            case '\\': g_string_append_c(out, '\\'); break;
+            case '/':  g_string_append_c(out, '/'); break;
+            case 'b':  g_string_append_c(out, '\b'); break;
+            case 'f':  g_string_append_c(out, '\f'); break;
+            case 'n':  g_string_append_c(out, '\n'); break;
+            case 'r':  g_string_append_c(out, '\r'); break;
+            case 't':  g_string_append_c(out, '\t'); break;
+            case 'u':
+            {
+                gint c = read_hex4(t_s);
+
+                if (c < 0)
+                {
+                    g_string_free(out, true);
+                    return nullptr;
+                }
+
+                t_s += 4;
+
+                // Characters outside the BMP come as a surrogate pair
+                if (c >= 0xD800 && c <= 0xDBFF && t_s[0] == '\\' && t_s[1] == 'u')
+                {
+                    gint low = read_hex4(t_s + 2);
+
+                    if (low >= 0xDC00 && low <= 0xDFFF)
+                    {
+                        c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                        t_s += 6;
+                    }
+                }
+
+                g_string_append_unichar(out, (gunichar) c);
+                break;
+            }
+            default:
+                g_string_free(out, true);
+                return nullptr;
+        }
+    }
+
+    return g_string_free(out, false);
+}
+
+static const gchar* skip_space(const gchar* t_s)
+{
+    while (g_ascii_isspace(*t_s))
+    {
+        t_s++;
+    }
+
+    return t_s;
+}
+
+/*
+ * Skips the JSON string starting right after its opening quote.
+ *
+ * Returns:
+ * The character after the closing quote, or NULL if it is unterminated.
+ */
+static const gchar* skip_json_string(const gchar* t_s)
+{
+    for (; *t_s != '"'; t_s++)
+    {
+        if (*t_s == '\\' && t_s[1] != '\0')
+        {
+            t_s++;
+        }
+        else if (*t_s == '\0')
+        {
+            return nullptr;
+        }
+    }
+
+    return t_s + 1;
+}
+
+/*
+ * Skips any JSON value, nested objects and arrays included.
+ *
+ * Returns:
+ * The character after the value, or NULL if it is malformed.
+ */
+static const gchar* skip_json_value(const gchar* t_s)
+{
+    int depth = 0;
+
+    t_s = skip_space(t_s);
+
+    do
+    {
+        switch (*t_s)
+        {
+            case '\0':
+                return nullptr;
+            case '"':
+                if ((t_s = skip_json_string(t_s + 1)) == nullptr)
+                {
+                    return nullptr;
+                }
+                break;
+            case '{':
+            case '[':
+                depth++;
+                t_s++;
+                break;
+            case '}':
+            case ']':
+                if (depth == 0)
+                {
+                    return t_s;
+                }
+
+                depth--;
+                t_s++;
+                break;
+            case ',':
+                if (depth == 0)
+                {
+                    return t_s;
+                }
+
+                t_s++;
+                break;
+            default:
+                t_s++;
+                break;
+        }
+    }
+    while (depth > 0 || (*t_s != ',' && *t_s != '}' && *t_s != ']' && *t_s != '\0' && !g_ascii_isspace(*t_s)));
+
+    return t_s;
+}
+
+typedef void (*JsonMemberFunc)(const gchar* t_key, const gchar* t_value, gpointer t_ud);
+
+/*
+ * Walks the members of the JSON object starting at t_s, calling t_func with
+ * every decoded key and the start of its value.
+ *
+ * Returns:
+ * The character after the object, or NULL if it is malformed.
+ */
+static const gchar* foreach_json_member(const gchar* t_s, JsonMemberFunc t_func, gpointer t_ud)
+{
+    t_s = skip_space(t_s);
+
+    if (*t_s++ != '{')
+    {
+        return nullptr;
+    }
+
+    for (t_s = skip_space(t_s); *t_s != '}'; t_s = skip_space(t_s + 1))
+    {
+        if (*t_s != '"')
+        {
+            return nullptr;
+        }
+
+        gchar* key = read_json_string(t_s + 1);
+
+        if (key == nullptr || (t_s = skip_space(skip_json_string(t_s + 1))) == nullptr || *t_s != ':')
+        {
+            g_free(key);
+            return nullptr;
+        }
+
+        const gchar* value = skip_space(t_s + 1);
+
+        t_func(key, value, t_ud);
+        g_free(key);
+
+        if ((t_s = skip_json_value(value)) == nullptr)
+        {
+            return nullptr;
+        }
+
+        t_s = skip_space(t_s);
+
+        if (*t_s == '}')
+        {
+            break;
+        }
+
+        if (*t_s != ',')
+        {
+            return nullptr;
+        }
+    }
+
+    return t_s + 1;
+}
+
+static void add_root(DropboxRoots* t_roots, const gchar* t_path)
+{
+    gchar* filename;
+    DropboxRoot root;
+
+    if (t_path[0] != '/')
+    {
+        return;
+    }
+
+    filename = g_filename_from_utf8(t_path, -1, nullptr, nullptr, nullptr);
+
+    if (filename == nullptr || !dropbox_path_util_canonicalize_in_place(filename))
+    {
+        g_free(filename);
+        return;
+    }
+
+    root.uri = g_filename_to_uri(filename, nullptr, nullptr);
+    g_free(filename);
+
+    if (root.uri == nullptr)
+    {
+        return;
+    }
+
+    root.length = strlen(root.uri);
+
+    // The filesystem root holds everything, there is nothing to filter
+    if (root.uri[root.length - 1] == '/')
+    {
+        root.length--;
+    }
+
+    debug("dropbox root: %s", root.uri);
+    g_array_append_val(t_roots->roots, root);
+}
+
+/* Only the "path" of the account object itself is a root, not paths nested deeper */
+static void account_member(const gchar* t_key, const gchar* t_value, DropboxRoots* t_roots)
+{
+    if (strcmp(t_key, "path") != 0 || *t_value != '"')
+    {
+        return;
+    }
+
+    gchar* path = read_json_string(t_value + 1);
+
+    if (path != nullptr)
+    {
+        add_root(t_roots, path);
+        g_free(path);
+    }
+}
+
+static void top_level_member(const gchar* t_key, const gchar* t_value, DropboxRoots* t_roots)
+{
+    if (*t_value == '{')
+    {
+        foreach_json_member(t_value, (JsonMemberFunc) account_member, t_roots);
+    }
+}
+
+void dropbox_roots_init(DropboxRoots* t_roots)
+{
+    t_roots->roots = nullptr;
+}
+
+void dropbox_roots_clear(DropboxRoots* t_roots)
+{
+    if (t_roots->roots == nullptr)
+    {
+        return;
+    }
+
+    for (guint i = 0; i < t_roots->roots->len; i++)
+    {
+        g_free(g_array_index(t_roots->roots, DropboxRoot, i).uri);
+    }
+
+    g_array_free(t_roots->roots, true);
+    t_roots->roots = nullptr;
+}
+
+/*
+ * Reads the folders of every linked account from ~/.dropbox/info.json,
+ * which the daemon writes when it starts. It looks like
+ *
+ * {"personal": {"path": "/home/user/Dropbox", ...}, "business": {"path": ...}}
+ *
+ * If the file is missing or holds no usable path the roots become unknown.
+ */
+void dropbox_roots_load(DropboxRoots* t_roots)
+{
+    gchar* filename;
+    gchar* contents;
+
+    dropbox_roots_clear(t_roots);
+
+    filename = g_build_filename(g_get_home_dir(), ".dropbox", "info.json", nullptr);
+
+    if (!g_file_get_contents(filename, &contents, nullptr, nullptr))
+    {
+        debug("couldn't read %s, not filtering files by dropbox root", filename);
+        g_free(filename);
+        return;
+    }
+
+    t_roots->roots = g_array_new(false, false, sizeof(DropboxRoot));
+
+    if (foreach_json_member(contents, (JsonMemberFunc) top_level_member, t_roots) == nullptr)
+    {
+        debug("%s is malformed, using the roots read so far", filename);
+    }
+
+    g_free(filename);
+    g_free(contents);
+
+    if (t_roots->roots->len == 0)
+    {
+        dropbox_roots_clear(t_roots);
+    }
+}
+
+/*
+ * Checks whether t_uri is one of the roots or lies below one of them.
+ * This only compares strings, so it is cheap enough to run on every file
+ * nautilus shows.
+ */
+gboolean dropbox_roots_contains_uri(DropboxRoots* t_roots, const gchar* t_uri)
+{
+    if (t_roots->roots == nullptr)
+    {
+        return true;
+    }
+
+    for (guint i = 0; i < t_roots->roots->len; i++)
+    {
+        DropboxRoot* root = &g_array_index(t_roots->roots, DropboxRoot, i);
+
+        if (strncmp(t_uri, root->uri, root->length) == 0 && (t_uri[root->length] == '\0' || t_uri[root->length] == '/'))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
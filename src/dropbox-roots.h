@@ -0,0 +1,55 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_ROOTS_H
+#define DROPBOX_ROOTS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The folders Dropbox syncs, stored as the file URIs nautilus hands us so
+ * files can be matched against them before their URI is decoded.
+ *
+ * If the roots are unknown, every file is assumed to be inside Dropbox.
+ *
+ * Only use this from the main loop.
+ */
+struct DropboxRoot
+{
+    gchar*  uri;
+    gsize   length;
+};
+
+struct DropboxRoots
+{
+    GArray* roots;
+};
+
+void dropbox_roots_init(DropboxRoots* t_roots);
+void dropbox_roots_load(DropboxRoots* t_roots);
+void dropbox_roots_clear(DropboxRoots* t_roots);
+
+gboolean dropbox_roots_contains_uri(DropboxRoots* t_roots, const gchar* t_uri);
+
+G_END_DECLS
+
+#endif
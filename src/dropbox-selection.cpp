@@ -0,0 +1,99 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <glib.h>
+
+#include "dropbox-selection.h"
+
+/**
+ * Only the paths of t_files are kept, not the files themselves, so the
+ * selection can be released on any thread.
+ *
+ * @note Only call this on the main loop
+ */
+DropboxSelection* dropbox_selection_new(GList* t_files)
+{
+    DropboxSelection* selection = g_new(DropboxSelection, 1);
+    NautilusFileInfo** files;
+    guint i = 0, n_args = 0;
+
+    selection->ref_count = 1;
+    selection->count = g_list_length(t_files);
+    selection->paths = g_new(DropboxFilePath *, selection->count);
+    selection->path_args = g_new(const gchar *, selection->count + 1);
+    selection->local = true;
+
+    files = g_new(NautilusFileInfo *, selection->count);
+
+    for (GList* li = t_files; li != nullptr; li = li->next)
+    {
+        files[i++] = NAUTILUS_FILE_INFO(li->data);
+    }
+
+    dropbox_file_path_get_all(files, selection->count, selection->paths);
+    g_free(files);
+
+    for (i = 0; i < selection->count; i++)
+    {
+        // The paths may outlive the files they were cached on
+        dropbox_file_path_ref(selection->paths[i]);
+
+        if (selection->paths[i]->path != nullptr)
+        {
+            selection->path_args[n_args++] = selection->paths[i]->path;
+        }
+        else
+        {
+            selection->local = false;
+        }
+    }
+
+    selection->path_args[n_args] = nullptr;
+
+    return selection;
+}
+
+/**
+ * @note This function is threadsafe
+ */
+DropboxSelection* dropbox_selection_ref(DropboxSelection* t_selection)
+{
+    g_atomic_int_inc(&(t_selection->ref_count));
+
+    return t_selection;
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void dropbox_selection_unref(DropboxSelection* t_selection)
+{
+    if (g_atomic_int_dec_and_test(&(t_selection->ref_count)))
+    {
+        for (guint i = 0; i < t_selection->count; i++)
+        {
+            dropbox_file_path_unref(t_selection->paths[i]);
+        }
+
+        g_free(t_selection->path_args);
+        g_free(t_selection->paths);
+        g_free(t_selection);
+    }
+}
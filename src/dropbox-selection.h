@@ -0,0 +1,59 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_SELECTION_H
+#define DROPBOX_SELECTION_H
+
+#include <glib.h>
+
+#include <libnautilus-extension/nautilus-file-info.h>
+
+#include "dropbox-file-path.h"
+
+G_BEGIN_DECLS
+
+/*
+ * The files a context menu was built for. Every item of the menu shares
+ * one reference to it instead of keeping its own copy of the file list.
+ * Only the paths are kept, not the file objects, because the last
+ * reference is often dropped on the command thread or the callback pool.
+ *
+ * The paths are decoded once, when the selection is made. path_args lists
+ * them for the daemon, pointing into paths rather than copying them, so the
+ * options and action commands can both send it as is. It only holds the
+ * files that have a path, local is false if that isn't all of them.
+ */
+struct DropboxSelection
+{
+    gint                ref_count;
+    guint               count;
+    DropboxFilePath**   paths;
+    const gchar**       path_args;
+    gboolean            local;
+};
+
+DropboxSelection* dropbox_selection_new(GList* t_files);
+
+DropboxSelection* dropbox_selection_ref(DropboxSelection* t_selection);
+void dropbox_selection_unref(DropboxSelection* t_selection);
+
+G_END_DECLS
+
+#endif
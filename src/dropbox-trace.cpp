@@ -0,0 +1,279 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <atomic>
+#include <cstring>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "dropbox-log.h"
+#include "dropbox-trace.h"
+
+/* About a minute of a busy folder, a few megabytes */
+static const guint TRACE_CAPACITY = 1 << 16;
+
+gboolean dropbox_trace_enabled = false;
+
+static DropboxTraceEvent* events = nullptr;
+static std::atomic<guint64> next_event(0);
+static std::atomic<guint64> last_id(0);
+static gchar* trace_filename = nullptr;
+
+static gint current_tid()
+{
+    static thread_local gint tid = 0;
+
+    if (tid == 0)
+    {
+        tid = (gint) syscall(SYS_gettid);
+    }
+
+    return tid;
+}
+
+static void record(gchar t_phase, const gchar* t_name, gint64 t_timestamp, gint64 t_duration, guint64 t_id)
+{
+    guint64 index = next_event.fetch_add(1, std::memory_order_relaxed);
+    DropboxTraceEvent* event = &(events[index & (TRACE_CAPACITY - 1)]);
+
+    // Readers skip the slot while it is being written
+    event->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    event->timestamp = t_timestamp;
+    event->duration = t_duration;
+    event->id = t_id;
+    event->tid = current_tid();
+    event->phase = t_phase;
+    g_strlcpy(event->name, t_name, sizeof(event->name));
+
+    event->sequence.store(index + 1, std::memory_order_release);
+}
+
+static gboolean write_on_signal(gpointer t_ud)
+{
+    GError* error = nullptr;
+
+    if (!dropbox_trace_write(trace_filename, &error))
+    {
+        dropbox_log_warning("could not write the trace: %s", error->message);
+        g_error_free(error);
+    }
+
+    return true;
+}
+
+/**
+ * Turns tracing on if DNA_TRACE_FILE is set.
+ *
+ * @note Only call this on the main loop, once on initialization
+ */
+void dropbox_trace_init()
+{
+    const gchar* filename = g_getenv("DNA_TRACE_FILE");
+
+    if (filename == nullptr || filename[0] == '\0')
+    {
+        return;
+    }
+
+    trace_filename = g_strdup(filename);
+    events = g_new0(DropboxTraceEvent, TRACE_CAPACITY);
+    dropbox_trace_enabled = true;
+
+    struct sigaction current;
+
+    // Don't take the signal from nautilus or another extension
+    if (sigaction(SIGUSR2, nullptr, &current) == 0 && !(current.sa_flags & SA_SIGINFO) && current.sa_handler == SIG_DFL)
+    {
+        g_unix_signal_add(SIGUSR2, write_on_signal, nullptr);
+    }
+}
+
+/**
+ * Hands out the ids that tie async spans together. They're never reused,
+ * and 0 means no id, which is all you get while tracing is off.
+ *
+ * @note This function is threadsafe
+ */
+guint64 dropbox_trace_next_id()
+{
+    if (!dropbox_trace_enabled)
+    {
+        return 0;
+    }
+
+    return last_id.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+/**
+ * Starts a span that may end on another thread, t_id pairs it with its end.
+ *
+ * @note This function is threadsafe
+ */
+void dropbox_trace_async_begin(const gchar* t_name, guint64 t_id)
+{
+    if (dropbox_trace_enabled)
+    {
+        record('b', t_name, g_get_monotonic_time(), 0, t_id);
+    }
+}
+
+/**
+ * @note This function is threadsafe
+ */
+void dropbox_trace_async_end(const gchar* t_name, guint64 t_id)
+{
+    if (dropbox_trace_enabled)
+    {
+        record('e', t_name, g_get_monotonic_time(), 0, t_id);
+    }
+}
+
+/**
+ * Records a span on this thread that started at t_start and ends now.
+ *
+ * @note This function is threadsafe
+ */
+void dropbox_trace_complete(const gchar* t_name, gint64 t_start, guint64 t_id)
+{
+    if (dropbox_trace_enabled)
+    {
+        record('X', t_name, t_start, g_get_monotonic_time() - t_start, t_id);
+    }
+}
+
+/*
+ * Appends t_string as a JSON string. Command names come from the daemon and
+ * may be cut off in the middle of a character, so only the valid UTF-8
+ * prefix is kept.
+ */
+static void append_json_string(GString* t_out, const gchar* t_string)
+{
+    const gchar* end;
+
+    g_utf8_validate(t_string, -1, &end);
+    g_string_append_c(t_out, '"');
+
+    for (const gchar* c = t_string; c < end; c++)
+    {
+        switch (*c)
+        {
+            case '"':
+                g_string_append(t_out, "\\\"");
+                break;
+
+            case '\\':
+                g_string_append(t_out, "\\\\");
+                break;
+
+            default:
+                if ((guchar) *c < 0x20)
+                {
+                    g_string_append_printf(t_out, "\\u%04x", (guchar) *c);
+                }
+                else
+                {
+                    g_string_append_c(t_out, *c);
+                }
+        }
+    }
+
+    g_string_append_c(t_out, '"');
+}
+
+/*
+ * Writes the events in the ring as Chrome trace JSON. Recording goes on
+ * meanwhile, events that are overwritten while we copy them are left out.
+ *
+ * Returns:
+ * false with t_error set if the file couldn't be written.
+ */
+gboolean dropbox_trace_write(const gchar* t_filename, GError** t_error)
+{
+    if (!dropbox_trace_enabled)
+    {
+        return true;
+    }
+
+    guint64 end = next_event.load(std::memory_order_acquire);
+    guint64 start = end > TRACE_CAPACITY ? end - TRACE_CAPACITY : 0;
+    GString* out = g_string_new("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    gint pid = getpid();
+    gboolean first = true;
+
+    for (guint64 index = start; index < end; index++)
+    {
+        DropboxTraceEvent* slot = &(events[index & (TRACE_CAPACITY - 1)]);
+        DropboxTraceEvent event;
+
+        if (slot->sequence.load(std::memory_order_acquire) != index + 1)
+        {
+            continue;
+        }
+
+        event.timestamp = slot->timestamp;
+        event.duration = slot->duration;
+        event.id = slot->id;
+        event.tid = slot->tid;
+        event.phase = slot->phase;
+        memcpy(event.name, slot->name, sizeof(event.name));
+
+        // A writer may have lapped us while we copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot->sequence.load(std::memory_order_relaxed) != index + 1)
+        {
+            continue;
+        }
+
+        event.name[sizeof(event.name) - 1] = '\0';
+
+        g_string_append(out, first ? "{\"name\":" : ",\n{\"name\":");
+        append_json_string(out, event.name);
+        g_string_append_printf(out, ",\"cat\":\"dna\",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d",
+            event.phase, event.timestamp, pid, event.tid);
+
+        if (event.phase == 'X')
+        {
+            g_string_append_printf(out, ",\"dur\":%" G_GINT64_FORMAT, event.duration);
+        }
+
+        if (event.id != 0)
+        {
+            g_string_append_printf(out, ",\"id\":\"0x%" G_GINT64_MODIFIER "x\"", event.id);
+        }
+
+        g_string_append_c(out, '}');
+        first = false;
+    }
+
+    g_string_append(out, "\n]}\n");
+
+    gboolean written = g_file_set_contents(t_filename, out->str, out->len, t_error);
+    g_string_free(out, true);
+
+    return written;
+}
@@ -0,0 +1,69 @@
+/*
+ *
+ * DNA - Dropbox for Nautilus on Arch
+ * Copyright (C) 2018 Robert Monden
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_TRACE_H
+#define DROPBOX_TRACE_H
+
+#include <atomic>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Opt-in tracing of where requests spend their time, for looking at in
+ * Perfetto or chrome://tracing.
+ *
+ * Setting DNA_TRACE_FILE turns it on. Events then go into a fixed size ring
+ * that overwrites the oldest ones, without taking locks. SIGUSR2 and
+ * unloading the extension write what's in the ring to that file as Chrome
+ * trace JSON. The signal is shared with the rest of nautilus, so if
+ * something else handles it already the trace is only written on unload.
+ *
+ * Spans that start and end on one thread are complete events, spans that
+ * cross threads are async events tied together by an id from
+ * dropbox_trace_next_id, which the request keeps for as long as it lives.
+ * Addresses would do too, but they get reused once a request is freed.
+ */
+struct DropboxTraceEvent
+{
+    std::atomic<guint64>    sequence;
+    gint64                  timestamp;
+    gint64                  duration;
+    guint64                 id;
+    gint                    tid;
+    gchar                   phase;
+    gchar                   name[35];
+};
+
+extern gboolean dropbox_trace_enabled;
+
+void dropbox_trace_init();
+
+guint64 dropbox_trace_next_id();
+void dropbox_trace_async_begin(const gchar* t_name, guint64 t_id);
+void dropbox_trace_async_end(const gchar* t_name, guint64 t_id);
+void dropbox_trace_complete(const gchar* t_name, gint64 t_start, guint64 t_id);
+
+gboolean dropbox_trace_write(const gchar* t_filename, GError** t_error);
+
+G_END_DECLS
+
+#endif
@@ -51,6 +51,10 @@
 #include <gtk/gtk.h>
 
 #include "nautilus-dropbox.h"
+#include "dropbox-capture.h"
+#include "dropbox-log.h"
+#include "dropbox-metrics.h"
+#include "dropbox-trace.h"
 
 static GType type_list[1];
 
@@ -58,6 +62,10 @@ void nautilus_module_initialize(GTypeModule* t_module)
 {
     g_print("Initializing %s\n", PACKAGE_STRING);
 
+    dropbox_log_init();
+    dropbox_metrics_init();
+    dropbox_trace_init();
+    dropbox_capture_init();
     nautilus_dropbox_register_type(t_module);
     type_list[0] = NAUTILUS_TYPE_DROPBOX;
 
@@ -67,11 +75,27 @@ void nautilus_module_initialize(GTypeModule* t_module)
     );
 
     dropbox_use_operation_in_progress_workaround = true;
+
+    const gchar* budget = g_getenv("DNA_COMPLETION_BUDGET_USEC");
+
+    if (budget != nullptr)
+    {
+        dropbox_completion_budget_usec = g_ascii_strtoll(budget, nullptr, 10);
+    }
 }
 
 void nautilus_module_shutdown()
 {
     g_print("Shutting down dropbox extension\n");
+
+    const gchar* trace_file = g_getenv("DNA_TRACE_FILE");
+
+    if (trace_file != nullptr)
+    {
+        dropbox_trace_write(trace_file, nullptr);
+    }
+
+    dropbox_capture_close();
 }
 
 void nautilus_module_list_types(const GType** t_types, int* t_num_types)
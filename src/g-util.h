@@ -46,22 +46,14 @@
 #include <glib.h>
 #include <glib/gprintf.h>
 
-G_BEGIN_DECLS
-
-#ifdef ND_DEBUG
-
-#define debug_enter() {g_print("Entering "); g_print(__FUNCTION__); g_printf("\n");}
-#define debug(format, ...) {g_print(__FUNCTION__); g_print(": "); \
-    g_printf(format, ## __VA_ARGS__); g_print("\n");}
-#define debug_return(v) {g_print("Exiting "); g_print(__FUNCTION__); g_printf("\n"); return v;}
+#include "dropbox-log.h"
 
-#else
-
-#define debug_enter() do {} while(0)
-#define debug(format, ...) do {} while(0)
-#define debug_return(v) do {} while(0)
+G_BEGIN_DECLS
 
-#endif
+/* These go through the structured logger, which drops them from builds without ND_DEBUG */
+#define debug_enter() dropbox_log_trace("entering")
+#define debug(format, ...) dropbox_log_debug(format, ## __VA_ARGS__)
+#define debug_return(v) do { dropbox_log_trace("exiting"); return v; } while (0)
 
 G_END_DECLS
 
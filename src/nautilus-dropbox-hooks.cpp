@@ -55,6 +55,8 @@
 #include "g-util.h"
 #include "dropbox-client-util.h"
 #include "nautilus-dropbox-hooks.h"
+#include "dropbox-metrics.h"
+#include "dropbox-capture.h"
 #include "dna-util.h"
 
 struct HookData
@@ -120,7 +122,7 @@ static gboolean handle_hook_server_input(GIOChannel* t_chan, GIOCondition t_cond
 
                     if (!parse_result)
                     {
-                        debug("bad parse");
+                        dropbox_log_warning("bad hook argument from dropbox");
                         return false;
                     }
                 }
@@ -131,6 +133,7 @@ static gboolean handle_hook_server_input(GIOChannel* t_chan, GIOCondition t_cond
             HookData* hd;
             hd = (HookData *)
             g_hash_table_lookup(t_hookserv->dispatch_table, t_hookserv->hhsi.command_name);
+            dropbox_metrics_count(METRIC_HOOK_EVENTS);
 
             if (hd != nullptr)
             {
@@ -149,7 +152,7 @@ static gboolean handle_hook_server_input(GIOChannel* t_chan, GIOCondition t_cond
 
 static void watch_killer(NautilusDropboxHookserv* t_hookserv)
 {
-    debug("hook client disconnected");
+    dropbox_log_info("hook client disconnected");
 
     t_hookserv->connected = false;
 
@@ -245,6 +248,7 @@ static gboolean try_to_connect(NautilusDropboxHookserv* t_hookserv)
 
     /* great we connected!, let's create the channel and wait on it */
     t_hookserv->chan = g_io_channel_unix_new(t_hookserv->socket);
+    dropbox_capture_channel(t_hookserv->chan, DROPBOX_CAPTURE_HOOK);
     g_io_channel_set_line_term(t_hookserv->chan, "\n", -1);
     g_io_channel_set_close_on_unref(t_hookserv->chan, true);
 
@@ -275,7 +279,7 @@ static gboolean try_to_connect(NautilusDropboxHookserv* t_hookserv)
         (GDestroyNotify) watch_killer
     );
 
-    debug("hook client connected");
+    dropbox_log_info("hook client connected");
     t_hookserv->connected = true;
     g_hook_list_invoke(&(t_hookserv->onconnect_hooklist), false);
 
@@ -51,6 +51,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -62,138 +63,105 @@
 #include <libnautilus-extension/nautilus-info-provider.h>
 
 #include "g-util.h"
+#include "dropbox-client-util.h"
 #include "dropbox-command-client.h"
 #include "nautilus-dropbox.h"
 #include "nautilus-dropbox-hooks.h"
+#include "dropbox-path-index.h"
+#include "dropbox-path-util.h"
+#include "dropbox-file-path.h"
+#include "dropbox-selection.h"
+#include "dropbox-metrics.h"
+#include "dropbox-trace.h"
 
 static char* emblems[] = {"dropbox-uptodate", "dropbox-syncing", "dropbox-unsyncable"};
 gchar* DEFAULT_EMBLEM_PATHS[2] = { EMBLEMDIR , nullptr };
 
 gboolean dropbox_use_nautilus_submenu_workaround;
 gboolean dropbox_use_operation_in_progress_workaround;
+gint64 dropbox_completion_budget_usec = 4000;
 
 static GType dropbox_type = 0;
 
-/*
- * Simplifies a path by removing navigation elements such as '.' and '..'
- *
- * Arguments:
- * - path: input path to be canonicalized
- *
- * Returns:
- * Canonicalized path if input path is valid.
- * NULL otherwise.
- */
-static gchar* canonicalize_path(gchar* t_path)
+static void reset_file(NautilusFileInfo* t_file)
 {
-    int i, j = 0;
-    gchar* toret = nullptr;
-    gchar** cpy, elts;
+    debug("resetting file %p", (void *) t_file);
+    nautilus_file_info_invalidate_extension_info(t_file);
+}
+
+/* Number of selections we keep the context options of */
+static const guint MENU_CACHE_SIZE = 256;
 
-    g_assert(t_path != nullptr);
-    g_assert(t_path[0] == '/');
+/* Time a reset may take per main loop iteration, so nautilus can still redraw in between */
+static const gint64 RESET_BUDGET_USEC = 4000;
 
-    elts = g_strsplit(t_path, "/", 0);
-    cpy = g_new(gchar *, g_strv_length(elts) + 1);
-    cpy[j++] = "/";
+/* Looking at the clock isn't free, only do it every so many files */
+static const guint RESET_CLOCK_INTERVAL = 32;
 
-    for (i = 0; elts[i] != nullptr; i++)
+static gboolean reset_files_step(NautilusDropbox* t_cvs)
+{
+    gint64 deadline = g_get_monotonic_time() + RESET_BUDGET_USEC;
+    NautilusFileInfo* file;
+    guint count = 0;
+
+    while ((file = dropbox_path_index_walk_next(&(t_cvs->file_index), &(t_cvs->reset_walk))) != nullptr)
     {
-        if (strcmp(elts[i], "..") == 0)
-        {
-            if (j > 0)
-            {
-                j--;
-            }
-            else
-            {
-                // Input path has too many parent directory references and is invalid
-                toret = nullptr;
-                goto exit;
-            }
-        }
-        else if (strcmp(elts[i], ".") != 0 && elts[i][0] != '\0')
+        reset_file(file);
+
+        if (++count % RESET_CLOCK_INTERVAL == 0 && g_get_monotonic_time() >= deadline)
         {
-            cpy[j++] = elts[i];
+            debug("reset %u files, continuing next iteration", count);
+            return true;
         }
     }
 
-    cpy[j] = nullptr;
-    toret = g_build_filenamev(cpy);
-
-    exit:
-        g_free(cpy);
-        g_strfreev(elts);
-
-    return toret;
-}
-
-static void reset_file(NautilusFileInfo* t_file)
-{
-    debug("resetting file %p", (void *) t_file);
-    nautilus_file_info_invalidate_extension_info(t_file);
-}
-
-gboolean reset_all_files(NautilusDropbox* t_cvs)
-{
-    /* Only run this on the main loop or you'll cause problems.
-     * This works because you can call a function pointer with
-     * more arguments than it takes */
-    g_hash_table_foreach(t_cvs->obj2filename, (GHFunc) reset_file, nullptr);
+    t_cvs->reset_source = 0;
 
     return false;
 }
 
-
-static void when_file_dies(NautilusDropbox* t_cvs, NautilusFileInfo* t_address)
+/*
+ * Invalidates every file we track, the most recently used ones first, a few
+ * milliseconds per main loop iteration at a time.
+ *
+ * If a reset is still running it starts over from the most recently used file,
+ * so both requests are served by one pass over the rest.
+ */
+gboolean reset_all_files(NautilusDropbox* t_cvs)
 {
-    gchar* filename;
-
-    filename = g_hash_table_lookup(t_cvs->obj2filename, t_address);
+    // Only run this on the main loop or you'll cause problems.
+    dropbox_path_index_walk_start(&(t_cvs->file_index), &(t_cvs->reset_walk));
 
-    /* we never got a change to view this file */
-    if (filename != nullptr)
+    if (t_cvs->reset_source == 0)
     {
-        g_hash_table_remove(t_cvs->filename2obj, filename);
-        g_hash_table_remove(t_cvs->obj2filename, t_address);
+        t_cvs->reset_source = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, (GSourceFunc) reset_files_step, t_cvs, nullptr);
     }
+
+    return false;
 }
 
+/* The path index drops files on its own when they are finalized,
+ * so there is no need for a weak reference here. */
 static void changed_cb(NautilusFileInfo* t_file, NautilusDropbox* t_cvs)
 {
-    // Check if this file's path has changed, if so update the hash and invalidate the file
-    gchar* filename, pfilename;
-    gchar* filename2;
-    gchar* uri;
-
-    uri = nautilus_file_info_get_uri(t_file);
-    pfilename = g_filename_from_uri(uri, nullptr, nullptr);
-    filename = pfilename ? canonicalize_path(pfilename) : nullptr;
-
-    // Canonicalization will only null-out a non-null filename if it is invalid
-    g_assert((pfilename == nullptr && filename == nullptr) || (pfilename != nullptr && filename != nullptr));
+    // Check if this file's path has changed, if so update the index and invalidate the file
+    DropboxFilePath* file_path;
 
-    filename2 =  g_hash_table_lookup(t_cvs->obj2filename, t_file);
-
-    g_free(pfilename);
-    g_free(uri);
-
-    // If filename2 is NULL we've never seen this file in update_file_info
-    if (filename2 == nullptr)
+    // If it's not in the index we've never seen this file in update_file_info
+    if (!dropbox_path_index_contains(&(t_cvs->file_index), t_file))
     {
-        g_free(filename);
         return;
     }
 
-    if (filename == nullptr)
-    {
-        // A file has moved to offline storage. Lets remove it from our tables.
-        g_object_weak_unref(G_OBJECT(t_file), (GWeakNotify) when_file_dies, t_cvs);
+    // This only decodes the URI again if it changed
+    file_path = dropbox_file_path_get(t_file);
 
-        g_hash_table_remove(t_cvs->filename2obj, filename2);
-        g_hash_table_remove(t_cvs->obj2filename, t_file);
+    if (file_path->path == nullptr)
+    {
+        // A file has moved to offline storage. Lets remove it from our index.
+        dropbox_path_index_remove(&(t_cvs->file_index), t_file);
 
-        g_signal_handlers_disconnect_by_func(t_file, G_CALLBACK(changed_cb), t_cvs);
+        g_signal_handlers_disconnect_by_func(t_file, (gpointer) G_CALLBACK(changed_cb), t_cvs);
         reset_file(t_file);
 
         return;
@@ -201,106 +169,93 @@ static void changed_cb(NautilusFileInfo* t_file, NautilusDropbox* t_cvs)
 
     /* This is a hack, because nautilus doesn't do this for us, for some reason
      * the file's path has changed */
-    if (strcmp(filename, filename2) != 0)
+    if (!dropbox_path_index_has_path(&(t_cvs->file_index), t_file, file_path->path))
     {
-        debug("shifty old: %s, new %s", filename2, filename);
-
-        // Gotta do this first, the call after this frees filename2
-        g_hash_table_remove(t_cvs->filename2obj, filename2);
-        g_hash_table_replace(t_cvs->obj2filename, t_file, g_strdup(filename));
+        debug("shifty new: %s", file_path->path);
 
-        NautilusFileInfo *f2;
+        NautilusFileInfo* f2;
 
-        // We shouldn't have another mapping from filename to an object
-        f2 = g_hash_table_lookup(t_cvs->filename2obj, filename);
+        // We shouldn't have another mapping from filename to an object, the index drops it if we do
+        f2 = dropbox_path_index_insert(&(t_cvs->file_index), file_path->path, t_file);
 
         if (f2 != nullptr)
         {
-            // Lets fix it if it's true, just remove the mapping
-            g_hash_table_remove(t_cvs->filename2obj, filename);
-            g_hash_table_remove(t_cvs->obj2filename, f2);
+            g_signal_handlers_disconnect_by_func(f2, (gpointer) G_CALLBACK(changed_cb), t_cvs);
         }
 
-        g_hash_table_insert(t_cvs->filename2obj, g_strdup(filename), t_file);
         reset_file(t_file);
     }
-
-    g_free(filename);
 }
 
 static NautilusOperationResult nautilus_dropbox_update_file_info(NautilusInfoProvider* t_provider, NautilusFileInfo* t_file, GClosure* t_update_complete, NautilusOperationHandle** t_handle)
 {
     NautilusDropbox* cvs = NAUTILUS_DROPBOX(t_provider);
 
-    // This code adds this file object to our two-way hash of file objects so we can shell touch these files later
-    
-    gchar* pfilename, uri;
+    // This code adds this file object to our path index so we can shell touch these files later
+    DropboxFilePath* file_path;
+    gchar* uri;
 
-    uri = nautilus_file_info_get_uri(file);
-    pfilename = g_filename_from_uri(uri, nullptr, nullptr);
-    g_free(uri);
+    uri = nautilus_file_info_get_uri(t_file);
 
-    if (pfilename != nullptr)
+    // Files outside Dropbox never get an emblem, don't spend anything on them
+    if (!dropbox_roots_contains_uri(&(cvs->roots), uri))
     {
-        int cmp = 0;
-        gchar* stored_filename;
-        gchar* filename;
-
-        filename = canonicalize_path(pfilename);
-        g_free(pfilename);
+        g_free(uri);
 
-        if (filename == nullptr)
+        // It may have been tracked before we knew the roots, or moved out of Dropbox since
+        if (dropbox_path_index_contains(&(cvs->file_index), t_file))
         {
-            // pfilename path was invalid if canonicalize operation nulled it out
-            return NAUTILUS_OPERATION_FAILED;
+            dropbox_path_index_remove(&(cvs->file_index), t_file);
+            g_signal_handlers_disconnect_by_func(t_file, (gpointer) G_CALLBACK(changed_cb), cvs);
         }
 
-        stored_filename = g_hash_table_lookup(cvs->obj2filename, t_file);
+        return NAUTILUS_OPERATION_COMPLETE;
+    }
 
-        // Don't worry about the dup checks, gcc is smart enough to optimize this GCSE ftw
-        if ((stored_filename != nullptr && (cmp = strcmp(stored_filename, filename)) != 0) || stored_filename == nullptr)
-        {
-            if (stored_filename != nullptr && cmp != 0)
-            {
-                // This happens when the filename changes name on a file obj but changed_cb isn't called
-                g_object_weak_unref(G_OBJECT(t_file), (GWeakNotify) when_file_dies, cvs);
-                g_hash_table_remove(cvs->obj2filename, t_file);
-                g_hash_table_remove(cvs->filename2obj, stored_filename);
-                g_signal_handlers_disconnect_by_func(t_file, G_CALLBACK(changed_cb), cvs);
-            }
-            else if (stored_filename == nullptr)
-            {
-                NautilusFileInfo* f2;
+    // Decoded once per file object, and again only if its URI changes
+    file_path = dropbox_file_path_get_for_uri(t_file, uri);
 
-                if ((f2 = g_hash_table_lookup(cvs->filename2obj, filename)) != nullptr)
-                {
-                    /* If the filename exists in the filename2obj hash
-                     * but the file obj doesn't exist in the obj2filename hash:
-                     *
-                     * this happens when nautilus allocates another file object
-                     * for a filename without first deleting the original file object
-                     *
-                     * just remove the association to the older file object, it's obsolete
-                     */
-                    g_object_weak_unref(G_OBJECT(f2), (GWeakNotify) when_file_dies, cvs);
-                    g_signal_handlers_disconnect_by_func(f2, G_CALLBACK(changed_cb), cvs);
-                    g_hash_table_remove(cvs->filename2obj, filename);
-                    g_hash_table_remove(cvs->obj2filename, f2);
-                }
-            }
+    if (file_path->invalid)
+    {
+        // The path was invalid if the canonicalize operation failed
+        return NAUTILUS_OPERATION_FAILED;
+    }
 
-            // Too chatty (???)
-            g_object_weak_ref(G_OBJECT(t_file), (GWeakNotify) when_file_dies, cvs);
-            g_hash_table_insert(cvs->filename2obj, g_strdup(filename), t_file);
-            g_hash_table_insert(cvs->obj2filename, t_file, g_strdup(filename));
-            g_signal_connect(t_file, "changed", G_CALLBACK(changed_cb), cvs);
-        }
+    if (file_path->path == nullptr)
+    {
+        return NAUTILUS_OPERATION_COMPLETE;
+    }
 
-        g_free(filename);
+    /* Either we've never seen this file object, or its filename changed
+     * without changed_cb being called */
+    if (dropbox_path_index_has_path(&(cvs->file_index), t_file, file_path->path))
+    {
+        // Nautilus is showing it, so keep it at the front of the resets
+        dropbox_path_index_touch(&(cvs->file_index), t_file);
     }
     else
     {
-        return NAUTILUS_OPERATION_COMPLETE;
+        gboolean tracked = dropbox_path_index_contains(&(cvs->file_index), t_file);
+        NautilusFileInfo* f2;
+
+        /* If the filename was already mapped to another file object:
+         *
+         * this happens when nautilus allocates another file object
+         * for a filename without first deleting the original file object
+         *
+         * the index drops the association to the older file object, it's obsolete
+         */
+        f2 = dropbox_path_index_insert(&(cvs->file_index), file_path->path, t_file);
+
+        if (f2 != nullptr)
+        {
+            g_signal_handlers_disconnect_by_func(f2, (gpointer) G_CALLBACK(changed_cb), cvs);
+        }
+
+        if (!tracked)
+        {
+            g_signal_connect(t_file, "changed", G_CALLBACK(changed_cb), cvs);
+        }
     }
 
     if (!dropbox_client_is_connected(&(cvs->dc)) || nautilus_file_info_is_gone(t_file))
@@ -314,8 +269,12 @@ static NautilusOperationResult nautilus_dropbox_update_file_info(NautilusInfoPro
     dfic->provider = t_provider;
     dfic->dc.request_type = GET_FILE_INFO;
     dfic->update_complete = g_closure_ref(t_update_complete);
-    dfic->file = g_object_ref(t_file);
+    dfic->file = (NautilusFileInfo *) g_object_ref(t_file);
+    dfic->path = dropbox_file_path_ref(file_path);
+
+    dfic->dc.trace_id = dropbox_trace_next_id();
 
+    dropbox_trace_async_begin("file_info", dfic->dc.trace_id);
     dropbox_command_client_request(&(cvs->dc.dcc), (DropboxCommand *) dfic);
 
     *t_handle = (NautilusOperationHandle *) dfic;
@@ -330,30 +289,204 @@ static void handle_shell_touch(GHashTable* t_args, NautilusDropbox* t_cvs)
     if ((path = g_hash_table_lookup(t_args, "path")) != nullptr && path[0][0] == '/')
     {
         NautilusFileInfo* file;
-        gchar* filename;
+        const gchar* filename;
+        gchar buffer[PATH_MAX];
 
-        filename = canonicalize_path(path[0]);
+        filename = dropbox_path_util_canonicalize(path[0], buffer, sizeof(buffer));
 
         if (filename != nullptr)
         {
             debug("shell touch for %s", filename);
 
-            file = g_hash_table_lookup(t_cvs->filename2obj, filename);
+            file = dropbox_path_index_lookup(&(t_cvs->file_index), filename);
 
             if (file != nullptr)
             {
                 debug("gonna reset %s", filename);
                 reset_file(file);
+
+                // Its status changed, so might the options dropbox offers for it
+                dropbox_file_path_touch(dropbox_file_path_get(file));
             }
+        }
+    }
+}
+
+/* A request for the context options of a selection */
+struct MenuOptionsRequest
+{
+    NautilusDropbox*    cvs;
+    guint64             key;
+    gboolean            notify;
+};
+
+/*
+ * Called on the main loop for a right-clicked selection, and on the
+ * callback pool for prefetches.
+ */
+static void menu_options_cb(GHashTable* t_response, MenuOptionsRequest* t_request)
+{
+    NautilusDropbox* cvs = t_request->cvs;
+
+    /* Replies without options are cached too, otherwise every update
+     * would send nautilus right back to ask for them again */
+    if (t_response != nullptr)
+    {
+        dropbox_menu_cache_insert(&(cvs->menu_cache), t_request->key, t_response);
+    }
+
+    // Prefetches have nobody waiting for them
+    if (t_request->notify)
+    {
+        if (cvs->menu_pending && cvs->menu_pending_key == t_request->key)
+        {
+            cvs->menu_pending = false;
+        }
+
+        /* A failed request is cached as a reply without options, so the
+         * placeholder goes away instead of nautilus asking again right away.
+         * It is retried once the selection changes or dropbox reconnects. */
+        if (t_response == nullptr)
+        {
+            GHashTable* no_options = g_hash_table_new(g_str_hash, g_str_equal);
 
-            g_free(filename);
+            dropbox_menu_cache_insert(&(cvs->menu_cache), t_request->key, no_options);
+            g_hash_table_unref(no_options);
         }
+
+        // Nautilus asks for the items again, and finds them in the cache this time
+        nautilus_menu_provider_emit_items_updated_signal(NAUTILUS_MENU_PROVIDER(cvs));
+    }
+
+    g_free(t_request);
+}
+
+/* What a menu command sends, kept alive until the command is done with it */
+struct MenuCommandArgs
+{
+    DropboxSelection*   selection;
+    gchar*              verb[2];
+};
+
+static void menu_command_args_free(MenuCommandArgs* t_args)
+{
+    dropbox_selection_unref(t_args->selection);
+    g_free(t_args->verb[0]);
+    g_free(t_args);
+}
+
+/*
+ * Creates a command about the files of t_selection. The paths are sent
+ * straight from the selection, so commands for huge selections don't copy them.
+ */
+static DropboxGeneralCommand* menu_command_new(const gchar* t_command, DropboxSelection* t_selection, const gchar* t_verb)
+{
+    DropboxGeneralCommand* dgc = g_new0(DropboxGeneralCommand, 1);
+    MenuCommandArgs* args = g_new(MenuCommandArgs, 1);
+
+    args->selection = dropbox_selection_ref(t_selection);
+    args->verb[0] = g_strdup(t_verb);
+    args->verb[1] = nullptr;
+
+    dgc->dc.request_type = GENERAL_COMMAND;
+    dgc->command_name = g_strdup(t_command);
+    dgc->metric = dropbox_metrics_command_for(t_command);
+
+    // The values belong to args
+    dgc->command_args = g_hash_table_new((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal);
+    g_hash_table_insert(dgc->command_args, (gpointer) "paths", t_selection->path_args);
+
+    if (t_verb != nullptr)
+    {
+        g_hash_table_insert(dgc->command_args, (gpointer) "verb", args->verb);
+    }
+
+    dgc->args_data = args;
+    dgc->args_data_destroy = (GDestroyNotify) menu_command_args_free;
+
+    return dgc;
+}
+
+static DropboxGeneralCommand* menu_options_command_new(NautilusDropbox* t_cvs, DropboxSelection* t_selection, guint64 t_key, gboolean t_notify)
+{
+    DropboxGeneralCommand* dgc = menu_command_new("icon_overlay_context_options", t_selection, nullptr);
+    MenuOptionsRequest* request = g_new(MenuOptionsRequest, 1);
+
+    request->cvs = t_cvs;
+    request->key = t_key;
+    request->notify = t_notify;
+
+    dgc->handler = (NautilusDropboxCommandResponseHandler) menu_options_cb;
+    dgc->handler_ud = request;
+    dgc->dispatch = t_notify ? DISPATCH_MAIN_LOOP : DISPATCH_POOL;
+
+    return dgc;
+}
+
+/* Stands in for the Dropbox menu until its options come in */
+static GList* menu_placeholder_new()
+{
+    NautilusMenuItem* item = nautilus_menu_item_new("NautilusDropbox::root_item", "Dropbox", "Loading Dropbox Options", "dropbox");
+    GValue sensitive = { 0 };
+
+    g_value_init(&sensitive, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&sensitive, false);
+    g_object_set_property(G_OBJECT(item), "sensitive", &sensitive);
+
+    return g_list_append(nullptr, item);
+}
+
+/* Starts the menu cache key of a selection */
+static guint64 menu_cache_key_new(NautilusDropbox* t_cvs)
+{
+    return dropbox_menu_cache_key_init((guint) g_atomic_int_get(&(t_cvs->menu_generation)));
+}
+
+/* Only the files nautilus asked about last are prefetched, a big directory would double the traffic and flush the cache */
+static const guint PREFETCH_FILES = 16;
+
+/*
+ * Asks the daemon for the context options of a single file in the background,
+ * so a right-click on it can be answered from the cache.
+ */
+static void prefetch_menu_options(NautilusDropbox* t_cvs, NautilusFileInfo* t_file, DropboxFilePath* t_path)
+{
+    if (!dropbox_path_index_is_recent(&(t_cvs->file_index), t_file, PREFETCH_FILES))
+    {
+        return;
+    }
+
+    guint64 key = dropbox_menu_cache_key_add(menu_cache_key_new(t_cvs), t_path->hash, t_path->generation);
+
+    if (dropbox_menu_cache_contains(&(t_cvs->menu_cache), key) || dropbox_command_client_is_prefetch_full(&(t_cvs->dc.dcc)))
+    {
+        return;
     }
+
+    GList files = { t_file, nullptr, nullptr };
+    DropboxSelection* selection = dropbox_selection_new(&files);
+
+    dropbox_command_client_prefetch(&(t_cvs->dc.dcc), (DropboxCommand *) menu_options_command_new(t_cvs, selection, key, false));
+    dropbox_selection_unref(selection);
+}
+
+/* Nautilus asks about what it shows first, so that many of the files it last asked about are likely on screen */
+static const guint VISIBLE_FILES = 256;
+
+static gboolean completion_is_visible(DropboxCompletion* t_completion, gpointer t_ud)
+{
+    DropboxFileInfoCommandResponse* dficr = (DropboxFileInfoCommandResponse *) t_completion;
+    NautilusDropbox* cvs = NAUTILUS_DROPBOX(dficr->dfic->provider);
+
+    return dropbox_path_index_is_recent(&(cvs->file_index), dficr->dfic->file, VISIBLE_FILES);
 }
 
 gboolean nautilus_dropbox_finish_file_info_command(DropboxFileInfoCommandResponse* t_dficr)
 {
     NautilusOperationResult result = NAUTILUS_OPERATION_FAILED;
+    gint64 start = dropbox_trace_enabled ? g_get_monotonic_time() : 0;
+
+    dropbox_trace_async_end("delivery", t_dficr->dfic->dc.trace_id);
 
     if (!t_dficr->dfic->cancelled)
     {
@@ -424,6 +557,12 @@ gboolean nautilus_dropbox_finish_file_info_command(DropboxFileInfoCommandRespons
         }
     }
 
+    // Nautilus knows about this file now, chances are it gets right-clicked next
+    if (result == NAUTILUS_OPERATION_COMPLETE && t_dficr->dfic->path->path != nullptr)
+    {
+        prefetch_menu_options(NAUTILUS_DROPBOX(t_dficr->dfic->provider), t_dficr->dfic->file, t_dficr->dfic->path);
+    }
+
     // Complete the info request
     if (!dropbox_use_operation_in_progress_workaround)
     {
@@ -449,6 +588,10 @@ gboolean nautilus_dropbox_finish_file_info_command(DropboxFileInfoCommandRespons
     // Unref the objects we didn't create
     g_closure_unref(t_dficr->dfic->update_complete);
     g_object_unref(t_dficr->dfic->file);
+    dropbox_file_path_unref(t_dficr->dfic->path);
+
+    dropbox_trace_complete("finish", start, t_dficr->dfic->dc.trace_id);
+    dropbox_trace_async_end("file_info", t_dficr->dfic->dc.trace_id);
 
     // Now free the structs
     g_free(t_dficr->dfic);
@@ -464,285 +607,263 @@ static void nautilus_dropbox_cancel_update(NautilusInfoProvider* t_provider, Nau
 
 static void menu_item_cb(NautilusMenuItem* t_item, NautilusDropbox* t_cvs)
 {
+    DropboxSelection* selection;
     gchar* verb;
-    GList* files;
-    DropboxGeneralCommand* dcac;
 
-    dcac = g_new(DropboxGeneralCommand, 1);
+    selection = (DropboxSelection *) g_object_get_data(G_OBJECT(t_item), "nautilus_dropbox_selection");
+    verb = (gchar *) g_object_get_data(G_OBJECT(t_item), "nautilus_dropbox_verb");
+
+    // The paths were decoded when the menu was built
+    dropbox_command_client_request(&(t_cvs->dc.dcc), (DropboxCommand *) menu_command_new("icon_overlay_context_action", selection, verb));
+}
+
+/* State shared by every item of a menu while it is being built */
+struct MenuParser
+{
+    NautilusMenuProvider*   provider;
+    DropboxSelection*       selection;
+    GString*                action;
+    GList*                  tail;
+};
 
-    files = g_object_get_data(G_OBJECT(t_item), "nautilus_dropbox_files");
-    verb = g_object_get_data(G_OBJECT(t_item), "nautilus_dropbox_verb");
+static int parse_menu_options(MenuParser* t_parser, gchar* t_options, NautilusMenu* t_menu);
 
-    dcac->dc.request_type = GENERAL_COMMAND;
+/*
+ * Adds a single option to t_menu. An option looks like "name~inner~verb",
+ * every part URL encoded. If the decoded inner part holds options itself it
+ * becomes a submenu and the verb is ignored, otherwise it is the tooltip of
+ * an item that sends the verb.
+ *
+ * t_option is split and decoded in place.
+ *
+ * Returns:
+ * The number of items that were added.
+ */
+static int parse_menu_option(MenuParser* t_parser, gchar* t_option, NautilusMenu* t_menu)
+{
+    gchar* item_name = t_option;
+    gchar* item_inner;
+    gchar* verb;
+    gsize action_length = t_parser->action->len;
+    int ret;
 
-    // Build the argument list
-    dcac->command_args = g_hash_table_new_full((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal, (GDestroyNotify) g_free, (GDestroyNotify) g_strfreev);
+    if ((item_inner = strchr(item_name, '~')) == nullptr || (verb = strchr(item_inner + 1, '~')) == nullptr)
+    {
+        return 0;
+    }
 
-    gchar** arglist;
-    guint i;
+    *item_inner++ = '\0';
+    *verb++ = '\0';
 
-    arglist = g_new0(gchar *, g_list_length(files) + 1);
+    dropbox_client_util_url_decode_in_place(item_name);
+    dropbox_client_util_url_decode_in_place(item_inner);
+    dropbox_client_util_url_decode_in_place(verb);
 
-    for (GList* li = files, i = 0; li != nullptr; li = g_list_next(li))
+    if (strchr(item_inner, '~') != nullptr)
     {
-        char* uri = nautilus_file_info_get_uri(NAUTILUS_FILE_INFO(li->data));
-        char* path = g_filename_from_uri(uri, nullptr, nullptr);
+        NautilusMenuItem* item;
+        NautilusMenu* submenu = nautilus_menu_new();
 
-        g_free(uri);
+        g_string_append(t_parser->action, item_name);
+        g_string_append(t_parser->action, "::");
 
-        if (!path)
-        {
-            continue;
-        }
+        ret = parse_menu_options(t_parser, item_inner, submenu);
+
+        item = nautilus_menu_item_new(t_parser->action->str, item_name, "", nullptr);
+        nautilus_menu_item_set_submenu(item, submenu);
+        nautilus_menu_append_item(t_menu, item);
 
-        arglist[i] = path;
-        i++;
+        g_object_unref(item);
+        g_object_unref(submenu);
     }
+    else
+    {
+        NautilusMenuItem* item;
+        bool grayed_out = false;
 
-    g_hash_table_insert(dcac->command_args, g_strdup("paths"), arglist);
+        g_string_append(t_parser->action, verb);
 
-    gchar** arglist;
-    arglist = g_new(gchar *, 2);
-    arglist[0] = g_strdup(verb);
-    arglist[1] = nullptr;
-    g_hash_table_insert(dcac->command_args, g_strdup("verb"), arglist);
+        if (item_name[0] == '!')
+        {
+            item_name++;
+            grayed_out = true;
+        }
 
-    dcac->command_name = g_strdup("icon_overlay_context_action");
-    dcac->handler = nullptr;
-    dcac->handler_ud = nullptr;
+        item = nautilus_menu_item_new(t_parser->action->str, item_name, item_inner, nullptr);
 
-    dropbox_command_client_request(&(t_cvs->dc.dcc), (DropboxCommand *) dcac);
-}
+        nautilus_menu_append_item(t_menu, item);
 
-static char from_hex(gchar t_ch)
-{
-    return isdigit(ch) ? t_ch - '0' : tolower(t_ch) - 'a' + 10;
-}
+        // All items of the menu share the selection
+        g_object_set_data_full(G_OBJECT(item), "nautilus_dropbox_selection", dropbox_selection_ref(t_parser->selection), (GDestroyNotify) dropbox_selection_unref);
 
-// decode in --> out, but dont fill more than n chars into out
-// returns len of out if thing went well, -1 if n wasn't big enough
-// can be used in place (whoa!)
-int GhettoURLDecode(gchar* t_out, gchar* t_in, int t_n)
-{
-    char* out_initial;
+        // Add the verb metadata
+        g_object_set_data_full(G_OBJECT(item), "nautilus_dropbox_verb", g_strdup(verb), (GDestroyNotify) g_free);
+        g_signal_connect(item, "activate", G_CALLBACK (menu_item_cb), t_parser->provider);
 
-    for(out_initial = out; out - out_initial < n && *in != '\0'; out++)
-    {
-        if (*in == '%')
+        if (grayed_out)
         {
-            if ((in[1] != '\0') && (in[2] != '\0'))
-            {
-                *out = from_hex(in[1]) << 4 | from_hex(in[2]);
-                in += 3;
-            }
-            else
-            {
-                // Input string isn't well-formed
-                return -1;
-            }
+            GValue sensitive = { 0 };
+            g_value_init(&sensitive, G_TYPE_BOOLEAN);
+            g_value_set_boolean (&sensitive, false);
+            g_object_set_property(G_OBJECT(item), "sensitive", &sensitive);
         }
-        else
+
+        /* Taken from nautilus-file-repairer (http://repairer.kldp.net/):
+         * this code is a workaround for a bug of nautilus
+         * See: http://bugzilla.gnome.org/show_bug.cgi?id=508878 */
+        if (dropbox_use_nautilus_submenu_workaround)
         {
-            *out = *in;
-            in++;
+            // Appending to the last element doesn't have to walk the list
+            g_list_append(t_parser->tail, g_object_ref(item));
+            t_parser->tail = t_parser->tail->next;
         }
-    }
 
-    if (out - out_initial < n)
-    {
-        *out = '\0';
-        return out - out_initial;
+        g_object_unref(item);
+        ret = 1;
     }
 
-    return -1;
+    // The action name is shared, drop what this item added
+    g_string_truncate(t_parser->action, action_length);
+
+    return ret;
 }
 
-static int nautilus_dropbox_parse_menu(gchar** t_options, NautilusMenu* t_menu, GString* t_old_action_string, GList* t_toret, NautilusMenuProvider* t_provider, GList* t_files)
+/*
+ * Adds the '|' separated options in t_options to t_menu, splitting them in place.
+ */
+static int parse_menu_options(MenuParser* t_parser, gchar* t_options, NautilusMenu* t_menu)
 {
     int ret = 0;
 
-    for (int i = 0; t_options[i] != nullptr; i++)
+    for (gchar* option = t_options; option != nullptr; )
     {
-        gchar** option_info = g_strsplit(t_options[i], "~", 3);
-
-        // If this is a valid string
-        if (option_info[0] == nullptr || option_info[1] == nullptr || option_info[2] == nullptr || option_info[3] != nullptr)
-        {
-            g_strfreev(option_info);
-            continue;
-        }
+        gchar* next = strchr(option, '|');
 
-        gchar* item_name = option_info[0];
-        gchar* item_inner = option_info[1];
-        gchar* verb = option_info[2];
-
-        GhettoURLDecode(item_name, item_name, strlen(item_name));
-        GhettoURLDecode(verb, verb, strlen(verb));
-        GhettoURLDecode(item_inner, item_inner, strlen(item_inner));
-
-        /* If the inner section has a menu in it then we create a submenu.  The verb will be ignored.
-         * Otherwise add the verb to our map and add the menu item to the list. */
-        if (strchr(item_inner, '~') != nullptr)
+        if (next != nullptr)
         {
-            GString* new_action_string = g_string_new(t_old_action_string->str);
-            gchar** suboptions = g_strsplit(item_inner, "|", -1);
-            NautilusMenuItem* item;
-            NautilusMenu* submenu = nautilus_menu_new();
-
-            g_string_append(new_action_string, item_name);
-            g_string_append(new_action_string, "::");
-
-            ret += nautilus_dropbox_parse_menu(suboptions, submenu, new_action_string, t_toret, t_provider, t_files);
-
-            item = nautilus_menu_item_new(new_action_string->str, item_name, "", nullptr);
-            nautilus_menu_item_set_submenu(item, submenu);
-            nautilus_menu_append_item(t_menu, item);
-
-            g_strfreev(suboptions);
-            g_object_unref(item);
-            g_object_unref(submenu);
-            g_string_free(new_action_string, true);
+            *next++ = '\0';
         }
-        else
-        {
-            NautilusMenuItem* item;
-            GString* new_action_string = g_string_new(t_old_action_string->str);
-            bool grayed_out = false;
-
-            g_string_append(new_action_string, verb);
-
-            if (item_name[0] == '!')
-            {
-                item_name++;
-                grayed_out = true;
-            }
-
-            item = nautilus_menu_item_new(new_action_string->str, item_name, item_inner, nullptr);
 
-            nautilus_menu_append_item(t_menu, item);
+        ret += parse_menu_option(t_parser, option, t_menu);
+        option = next;
+    }
 
-            // Add the file metadata to this item
-            g_object_set_data_full(G_OBJECT(item), "nautilus_dropbox_files", nautilus_file_info_list_copy(t_files), (GDestroyNotify) nautilus_file_info_list_free);
+    return ret;
+}
 
-            // Add the verb metadata
-            g_object_set_data_full(G_OBJECT(item), "nautilus_dropbox_verb", g_strdup(verb), (GDestroyNotify) g_free);
-            g_signal_connect(item, "activate", G_CALLBACK (menu_item_cb), t_provider);
+/*
+ * Builds the menu from the options dropbox replied with. The reply may be
+ * cached, so it is left untouched and every option is parsed from a copy.
+ *
+ * With the submenu workaround every item is also appended to t_toret, which
+ * must then already hold the root item.
+ *
+ * Returns:
+ * The number of items that were added.
+ */
+int nautilus_dropbox_parse_menu(gchar** t_options, NautilusMenu* t_menu, GList* t_toret, NautilusMenuProvider* t_provider, DropboxSelection* t_selection)
+{
+    MenuParser parser;
+    int ret = 0;
 
-            if (grayed_out)
-            {
-                GValue sensitive = { 0 };
-                g_value_init(&sensitive, G_TYPE_BOOLEAN);
-                g_value_set_boolean (&sensitive, false);
-                g_object_set_property(G_OBJECT(item), "sensitive", &sensitive);
-            }
+    g_return_val_if_fail(t_toret != nullptr || !dropbox_use_nautilus_submenu_workaround, 0);
 
-            /* Taken from nautilus-file-repairer (http://repairer.kldp.net/):
-             * this code is a workaround for a bug of nautilus
-             * See: http://bugzilla.gnome.org/show_bug.cgi?id=508878 */
-            if (dropbox_use_nautilus_submenu_workaround)
-            {
-                t_toret = g_list_append(t_toret, item);
-            }
+    parser.provider = t_provider;
+    parser.selection = t_selection;
+    parser.action = g_string_new("NautilusDropbox::");
+    parser.tail = g_list_last(t_toret);
 
-            g_object_unref(item);
-            g_string_free(new_action_string, true);
-            ret++;
-        }
+    for (int i = 0; t_options[i] != nullptr; i++)
+    {
+        gchar* option = g_strdup(t_options[i]);
 
-        g_strfreev(option_info);
+        ret += parse_menu_option(&parser, option, t_menu);
+        g_free(option);
     }
 
-    return ret;
-}
-
-static void get_file_items_callback(GHashTable* t_response, gpointer t_ud)
-{
-    GAsyncQueue* reply_queue = t_ud;
-
-    /* Queue_push doesn't accept NULL as a value so we create an empty hash table
-     * if we got no response. */
-    g_async_queue_push(reply_queue, t_response ? g_hash_table_ref(t_response) : g_hash_table_new((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal));
+    g_string_free(parser.action, true);
 
-    g_async_queue_unref(reply_queue);
+    return ret;
 }
 
-
 static GList* nautilus_dropbox_get_file_items(NautilusMenuProvider* t_provider, GtkWidget* t_window, GList* t_files)
 {
+    if (t_files == nullptr)
+    {
+        return nullptr;
+    }
+
     /*
-     * 1. Convert files to filenames.
+     * 1. Convert files to filenames, once for the options and any action
+     *    that is picked. Usually decoded already by update_file_info, big
+     *    selections of new files are decoded on several threads.
      */
-    int file_count = g_list_length(t_files);
+    NautilusDropbox* cvs = NAUTILUS_DROPBOX(t_provider);
+    DropboxSelection* selection = dropbox_selection_new(t_files);
+    gboolean in_dropbox = false;
+    guint64 key = menu_cache_key_new(cvs);
 
-    if (file_count < 1)
+    // Oooh, filename wasn't correctly encoded, or isn't a local file.
+    if (!selection->local)
     {
+        dropbox_selection_unref(selection);
         return nullptr;
     }
 
-    gchar** paths = g_new0(gchar *, file_count + 1);
-    int i = 0;
-    GList* elem;
-
-    for (elem = t_files; elem; elem = elem->next, i++)
+    for (guint i = 0; i < selection->count; i++)
     {
-        gchar* uri = nautilus_file_info_get_uri(elem->data);
-        gchar* filename_un = uri ? g_filename_from_uri(uri, nullptr, nullptr) : nullptr;
-        gchar* filename = filename_un ? g_filename_to_utf8(filename_un, -1, nullptr, nullptr, nullptr) : nullptr;
-
-        g_free(uri);
-        g_free(filename_un);
+        DropboxFilePath* file_path = selection->paths[i];
 
-        // Oooh, filename wasn't correctly encoded, or isn't a local file.
-        if (filename == nullptr)
-        {
-            g_strfreev(paths);
-            return nullptr;
-        }
-
-        paths[i] = filename;
+        in_dropbox = in_dropbox || dropbox_roots_contains_uri(&(cvs->roots), file_path->uri);
+        key = dropbox_menu_cache_key_add(key, file_path->hash, file_path->generation);
     }
 
-    GAsyncQueue* reply_queue = g_async_queue_new_full((GDestroyNotify) g_hash_table_unref);
+    // Dropbox has nothing to offer for files outside of it, so don't wait for it to say so
+    if (!in_dropbox)
+    {
+        dropbox_selection_unref(selection);
+        return nullptr;
+    }
 
     /*
-     * 2. Create a DropboxGeneralCommand to call "icon_overlay_context_options"
+     * 2. Look for the options of this selection in the cache, they were
+     *    usually prefetched when nautilus asked for the file info or
+     *    fetched by an earlier right-click.
      */
-    DropboxGeneralCommand* dgc = g_new0(DropboxGeneralCommand, 1);
-    dgc->dc.request_type = GENERAL_COMMAND;
-    dgc->command_name = g_strdup("icon_overlay_context_options");
-    dgc->command_args = g_hash_table_new_full((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal, (GDestroyNotify) g_free, (GDestroyNotify) g_strfreev);
-    
-    g_hash_table_insert(dgc->command_args, g_strdup("paths"), paths);
+    GHashTable* context_options_response = dropbox_menu_cache_lookup(&(cvs->menu_cache), key);
 
-    dgc->handler = get_file_items_callback;
-    dgc->handler_ud = g_async_queue_ref(reply_queue);
-
-    /*
-     * 3. Queue it up for the helper thread to run it.
-     */
-    NautilusDropbox* cvs = NAUTILUS_DROPBOX(t_provider);
-    dropbox_command_client_request(&(cvs->dc.dcc), (DropboxCommand *) dgc);
+    dropbox_metrics_count(context_options_response != nullptr ? METRIC_MENU_CACHE_HITS : METRIC_MENU_CACHE_MISSES);
 
-    GTimeVal gtv;
+    if (context_options_response == nullptr)
+    {
+        GList* placeholder = nullptr;
+
+        /*
+         * 3. Not there, queue up a request for the helper thread to run, unless
+         *    the same selection is already being asked for. Nautilus is told to
+         *    ask for the items again once the reply is in the cache, until then
+         *    it shows a placeholder instead of us blocking the main loop.
+         */
+        if (dropbox_client_is_connected(&(cvs->dc)))
+        {
+            if (!cvs->menu_pending || cvs->menu_pending_key != key)
+            {
+                cvs->menu_pending = true;
+                cvs->menu_pending_key = key;
 
-    /*
-     * 4. We have to block until it's done because nautilus expects a reply.  But we will
-     * only block for 50 ms for a reply.
-     */
+                dropbox_command_client_request(&(cvs->dc.dcc), (DropboxCommand *) menu_options_command_new(cvs, selection, key, true));
+            }
 
-    g_get_current_time(&gtv);
-    g_time_val_add(&gtv, 50000);
+            placeholder = menu_placeholder_new();
+        }
 
-    GHashTable* context_options_response = g_async_queue_timed_pop(reply_queue, &gtv);
-    g_async_queue_unref(reply_queue);
+        dropbox_selection_unref(selection);
 
-    if (!context_options_response)
-    {
-        return nullptr;
+        return placeholder;
     }
 
     /*
-     * 5. Parse the reply.
+     * 4. Parse the reply.
      */
 
     char** options = g_hash_table_lookup(context_options_response, "options");
@@ -758,161 +879,163 @@ static GList* nautilus_dropbox_get_file_items(NautilusMenuProvider* t_provider,
         root_item = nautilus_menu_item_new("NautilusDropbox::root_item", "Dropbox", "Dropbox Options", "dropbox");
 
         toret = g_list_append(toret, root_item);
-        GString* action_string = g_string_new("NautilusDropbox::");
 
-        if (!nautilus_dropbox_parse_menu(options, root_menu, action_string, toret, t_provider, files))
+        // Every item refers to the selection instead of a copy of it
+        if (nautilus_dropbox_parse_menu(options, root_menu, toret, t_provider, selection))
         {
-            g_object_unref(toret);
+            nautilus_menu_item_set_submenu(root_item, root_menu);
+        }
+        else
+        {
+            // This drops the only reference to root_item
+            g_list_free_full(toret, (GDestroyNotify) g_object_unref);
             toret = nullptr;
         }
 
-        nautilus_menu_item_set_submenu(root_item, root_menu);
-
-        g_string_free(action_string, true);
         g_object_unref(root_menu);
     }
 
+    dropbox_selection_unref(selection);
     g_hash_table_unref(context_options_response);
 
     return toret;
 }
 
-gboolean add_emblem_paths(GHashTable* t_emblem_paths_response)
+/* Empty entries in an emblem path list are ignored */
+static gboolean emblem_paths_contain(gchar** t_paths, const gchar* t_path)
 {
-    // Only run this on the main loop or you'll cause problems.
-    if (!t_emblem_paths_response)
+    if (t_paths == nullptr || t_path[0] == '\0')
     {
         return false;
     }
 
-    gchar** emblem_paths_list;
-
-    GtkIconTheme* theme = gtk_icon_theme_get_default();
-
-    if (t_emblem_paths_response && (emblem_paths_list = g_hash_table_lookup(t_emblem_paths_response, "path")))
+    for (int i = 0; t_paths[i] != nullptr; i++)
     {
-        for (int i = 0; emblem_paths_list[i] != nullptr; i++)
+        if (strcmp(t_paths[i], t_path) == 0)
         {
-            if (emblem_paths_list[i][0])
-            {
-                gtk_icon_theme_append_search_path(theme, emblem_paths_list[i]);
-            }
+            return true;
         }
     }
-    g_hash_table_unref(t_emblem_paths_response);
 
     return false;
 }
 
-gboolean remove_emblem_paths(GHashTable* t_emblem_paths_response)
+/* Whether every path in t_a is in t_b, dropbox only ever sends a handful */
+static gboolean emblem_paths_subset(gchar** t_a, gchar** t_b)
 {
-    // Only run this on the main loop or you'll cause problems.
-    if (!t_emblem_paths_response)
-    {
-        return false;
-    }
-
-    gchar** emblem_paths_list = g_hash_table_lookup(t_emblem_paths_response, "path");
-    
-    if (!emblem_paths_list)
+    for (int i = 0; t_a != nullptr && t_a[i] != nullptr; i++)
     {
-        goto exit;
+        if (t_a[i][0] != '\0' && !emblem_paths_contain(t_b, t_a[i]))
+        {
+            return false;
+        }
     }
 
-    // We need to remove the old paths.
-    GtkIconTheme* icon_theme = gtk_icon_theme_get_default();
-    gchar** paths;
-    gint path_count;
-
-    gtk_icon_theme_get_search_path(icon_theme, &paths, &path_count);
+    return true;
+}
 
-    gint i, j, out = 0;
-    bool found = false;
+/*
+ * Swaps the old emblem paths in the icon theme search path for the new ones
+ * with a single update, since every change makes gtk drop its icon cache.
+ * Paths in both sets keep their place.
+ */
+static void apply_emblem_paths(gchar** t_old_paths, gchar** t_new_paths)
+{
+    // Only run this on the main loop or you'll cause problems.
+    GtkIconTheme* theme = gtk_icon_theme_get_default();
+    gchar** search_path;
+    gint search_path_count;
 
-    for (i = 0; i < path_count; i++)
+    if (theme == nullptr)
     {
-        bool keep = true;
+        return;
+    }
 
-        for (j = 0; emblem_paths_list[j] != NULL; j++)
-        {
-            if (emblem_paths_list[j][0])
-            {
-                if (!g_strcmp0(paths[i], emblem_paths_list[j]))
-                {
-                    found = true;
-                    keep = false;
-                    g_free(paths[i]);
+    gtk_icon_theme_get_search_path(theme, &search_path, &search_path_count);
 
-                    break;
-                }
-            }
-        }
+    GPtrArray* result = g_ptr_array_sized_new(search_path_count + (t_new_paths != nullptr ? g_strv_length(t_new_paths) : 0) + 1);
 
-        if (keep)
+    for (gint i = 0; i < search_path_count; i++)
+    {
+        if (!emblem_paths_contain(t_old_paths, search_path[i]) || emblem_paths_contain(t_new_paths, search_path[i]))
         {
-            paths[out] = paths[i];
-            out++;
+            g_ptr_array_add(result, search_path[i]);
         }
     }
 
-    // If we found one we need to reset the path to accomodate the changes
-    if (found)
+    for (int i = 0; t_new_paths != nullptr && t_new_paths[i] != nullptr; i++)
     {
-        paths[out] = nullptr; /* Clear the last one */
-        gtk_icon_theme_set_search_path(icon_theme, (const gchar **) paths, out);
+        if (t_new_paths[i][0] != '\0' && !emblem_paths_contain(search_path, t_new_paths[i]))
+        {
+            g_ptr_array_add(result, t_new_paths[i]);
+        }
     }
 
-    g_strfreev(paths);
+    g_ptr_array_add(result, nullptr);
+    gtk_icon_theme_set_search_path(theme, (const gchar **) result->pdata, result->len - 1);
 
-    exit:
-        g_hash_table_unref(t_emblem_paths_response);
-        return false;
+    g_ptr_array_free(result, true);
+    g_strfreev(search_path);
 }
 
-void get_emblem_paths_cb(GHashTable *t_emblem_paths_response, NautilusDropbox *t_cvs)
+/* Called on the main loop with the emblem paths dropbox just sent */
+static void get_emblem_paths_cb(GHashTable* t_response, NautilusDropbox* t_cvs)
 {
-    if (!t_emblem_paths_response)
+    if (t_response == nullptr)
     {
-        t_emblem_paths_response = g_hash_table_new((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal);
-        g_hash_table_insert(t_emblem_paths_response, "path", DEFAULT_EMBLEM_PATHS);
+        t_response = g_hash_table_new((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal);
+        g_hash_table_insert(t_response, (gpointer) "path", DEFAULT_EMBLEM_PATHS);
     }
     else
     {
         // Increase the ref so that finish_general_command doesn't delete it.
-        g_hash_table_ref(t_emblem_paths_response);
+        g_hash_table_ref(t_response);
     }
 
-    g_mutex_lock(t_cvs->emblem_paths_mutex);
+    gchar** old_paths = t_cvs->emblem_paths != nullptr ? (gchar **) g_hash_table_lookup(t_cvs->emblem_paths, "path") : nullptr;
+    gchar** new_paths = (gchar **) g_hash_table_lookup(t_response, "path");
 
-    if (t_cvs->emblem_paths)
+    // Usually the case when we reconnect, then the icons and the files can stay as they are
+    if (t_cvs->emblem_paths != nullptr && emblem_paths_subset(old_paths, new_paths) && emblem_paths_subset(new_paths, old_paths))
     {
-        g_idle_add((GSourceFunc) remove_emblem_paths, t_cvs->emblem_paths);
-        t_cvs->emblem_paths = nullptr;
+        debug("emblem paths unchanged");
+        g_hash_table_unref(t_response);
+
+        return;
     }
 
-    t_cvs->emblem_paths = t_emblem_paths_response;
-    g_mutex_unlock(t_cvs->emblem_paths_mutex);
+    apply_emblem_paths(old_paths, new_paths);
 
-    g_idle_add((GSourceFunc) add_emblem_paths, g_hash_table_ref(t_emblem_paths_response));
-    g_idle_add((GSourceFunc) reset_all_files, t_cvs);
+    if (t_cvs->emblem_paths != nullptr)
+    {
+        g_hash_table_unref(t_cvs->emblem_paths);
+    }
+
+    t_cvs->emblem_paths = t_response;
+
+    // Every file may look different now, so may the menus we cached for them
+    g_atomic_int_inc(&(t_cvs->menu_generation));
+    reset_all_files(t_cvs);
 }
 
 static void on_connect(NautilusDropbox* t_cvs)
 {
+    g_atomic_int_inc(&(t_cvs->menu_generation));
+
+    // The daemon may have been relinked or moved its folder while we were disconnected
+    dropbox_roots_load(&(t_cvs->roots));
+
     reset_all_files(t_cvs);
-    dropbox_command_client_send_command(&(t_cvs->dc.dcc), (NautilusDropboxCommandResponseHandler) get_emblem_paths_cb, t_cvs, "get_emblem_paths", nullptr);
+    dropbox_command_client_send_command_full(&(t_cvs->dc.dcc), DISPATCH_MAIN_LOOP, (NautilusDropboxCommandResponseHandler) get_emblem_paths_cb, t_cvs, "get_emblem_paths", nullptr);
 }
 
 static void on_disconnect(NautilusDropbox* t_cvs)
 {
     reset_all_files(t_cvs);
+    dropbox_menu_cache_clear(&(t_cvs->menu_cache));
 
-    g_mutex_lock(t_cvs->emblem_paths_mutex);
-
-    // This call will free the data too.
-    g_idle_add((GSourceFunc) remove_emblem_paths, t_cvs->emblem_paths);
-    t_cvs->emblem_paths = nullptr;
-    g_mutex_unlock(t_cvs->emblem_paths_mutex);
+    /* The emblem paths stay in the icon theme, dropbox almost always sends
+     * the same ones again when it comes back */
 }
 
 
@@ -928,14 +1051,21 @@ static void nautilus_dropbox_info_provider_iface_init (NautilusInfoProviderIface
 
 static void nautilus_dropbox_instance_init (NautilusDropbox* t_cvs)
 {
-    t_cvs->filename2obj = g_hash_table_new_full((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal, (GDestroyNotify) g_free, (GDestroyNotify) nullptr);
-    t_cvs->obj2filename = g_hash_table_new_full((GHashFunc) g_direct_hash, (GEqualFunc) g_direct_equal, (GDestroyNotify) nullptr, (GDestroyNotify) g_free);
-    t_cvs->emblem_paths_mutex = g_mutex_new();
+    dropbox_path_index_init(&(t_cvs->file_index));
+    t_cvs->reset_source = 0;
+    dropbox_roots_init(&(t_cvs->roots));
+    dropbox_menu_cache_init(&(t_cvs->menu_cache), MENU_CACHE_SIZE);
+    t_cvs->menu_generation = 0;
+    t_cvs->menu_pending = false;
     t_cvs->emblem_paths = nullptr;
 
     // Setup the connection object
     dropbox_client_setup(&(t_cvs->dc));
 
+    // Replies for what's on screen go first, and nautilus gets to redraw in between
+    dropbox_completion_queue_set_budget(&(t_cvs->dc.dcc.completions), dropbox_completion_budget_usec);
+    dropbox_completion_queue_set_urgent_func(&(t_cvs->dc.dcc.completions), completion_is_visible);
+
     // Our hooks
     nautilus_dropbox_hooks_add(&(t_cvs->dc.hookserv), "shell_touch", (DropboxUpdateHook) handle_shell_touch, t_cvs);
 
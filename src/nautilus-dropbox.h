@@ -48,10 +48,15 @@
 #include <glib-object.h>
 
 #include <libnautilus-extension/nautilus-info-provider.h>
+#include <libnautilus-extension/nautilus-menu-provider.h>
 
 #include "dropbox-command-client.h"
 #include "nautilus-dropbox-hooks.h"
 #include "dropbox-client.h"
+#include "dropbox-path-index.h"
+#include "dropbox-roots.h"
+#include "dropbox-menu-cache.h"
+#include "dropbox-selection.h"
 
 G_BEGIN_DECLS
 
@@ -67,9 +72,14 @@ typedef struct _NautilusDropboxClass NautilusDropboxClass;
 
 struct _NautilusDropbox {
     GObject parent_slot;
-    GHashTable* filename2obj;
-    GHashTable* obj2filename;
-    GMutex* emblem_paths_mutex;
+    DropboxPathIndex file_index;
+    DropboxPathIndexWalk reset_walk;
+    guint reset_source;
+    DropboxRoots roots;
+    DropboxMenuCache menu_cache;
+    gint menu_generation;
+    gboolean menu_pending;
+    guint64 menu_pending_key;
     GHashTable* emblem_paths;
     DropboxClient dc;
 };
@@ -81,9 +91,14 @@ struct _NautilusDropboxClass {
 GType nautilus_dropbox_get_type(void);
 void nautilus_dropbox_register_type(GTypeModule* module);
 
+int nautilus_dropbox_parse_menu(gchar** options, NautilusMenu* menu, GList* toret, NautilusMenuProvider* provider, DropboxSelection* selection);
+
 extern gboolean dropbox_use_nautilus_submenu_workaround;
 extern gboolean dropbox_use_operation_in_progress_workaround;
 
+/* Time in microseconds the main loop may spend on replies per iteration, 0 for no limit */
+extern gint64 dropbox_completion_budget_usec;
+
 G_END_DECLS
 
 #endif